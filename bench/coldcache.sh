@@ -0,0 +1,104 @@
+#!/bin/sh
+#
+# coldcache.sh
+# ls on a cold cache, with lstat() in readdir order and in inode order
+#
+# Makes an ext4 image of BENCH_IMAGE_MB megabytes, loop mounts it, has
+# mktree fill one directory with BENCH_ENTRIES files, and lists it with
+# each --stat-order BENCH_REPEAT times, writing back and dropping the
+# page, dentry and inode caches ( /proc/sys/vm/drop_caches ) before
+# every run; the fastest run is kept. Needs root. One JSON object per
+# --stat-order is appended to BENCH_OUT:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"entries":100000,"flags":"-fl",
+#    "stat_order":"inode","runs":3,"wall_ns":12345678,"status":0}
+#
+# The image is kept between runs, on a disk rather than a tmpfs the
+# difference is what a spinning disk or a cold SSD sees.
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_IMAGE       the ext4 image               ( /var/tmp/ls-bench.img )
+#   BENCH_IMAGE_MB    its size                     ( 1024 )
+#   BENCH_ENTRIES     files in the directory       ( 100000 )
+#   BENCH_FLAGS       flags of every listing       ( -fl )
+#   BENCH_REPEAT      runs per --stat-order        ( 3 )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+BENCH_IMAGE=${BENCH_IMAGE:-/var/tmp/ls-bench.img}
+BENCH_IMAGE_MB=${BENCH_IMAGE_MB:-1024}
+BENCH_ENTRIES=${BENCH_ENTRIES:-100000}
+BENCH_FLAGS=${BENCH_FLAGS:--fl}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+RUNONE=$BENCH/runone
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+if [ "$(id -u)" -ne 0 ]; then
+    echo "coldcache.sh: dropping caches and mounting need root" >&2
+    exit 1
+fi
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ] || [ ! -x "$RUNONE" ]; then
+    echo "coldcache.sh: build ls, bench/mktree and bench/runone first" \
+         "( make bench-cold )" >&2
+    exit 1
+fi
+
+if [ ! -f "$BENCH_IMAGE" ]; then
+    echo "making a ${BENCH_IMAGE_MB}M ext4 image in $BENCH_IMAGE" >&2
+    truncate -s "${BENCH_IMAGE_MB}M" "$BENCH_IMAGE" &&
+        mkfs.ext4 -q -F "$BENCH_IMAGE" || exit 1
+fi
+
+mnt=$(mktemp -d) || exit 1
+mount -o loop "$BENCH_IMAGE" "$mnt" || exit 1
+trap 'umount "$mnt"; rmdir "$mnt"' EXIT INT TERM
+
+dir=$mnt/flat-$BENCH_ENTRIES
+if [ ! -f "$dir.done" ]; then
+    rm -rf "$dir"
+    echo "making flat tree of $BENCH_ENTRIES entries in $dir" >&2
+    "$MKTREE" flat "$BENCH_ENTRIES" "$dir" || exit 1
+    touch "$dir.done"
+fi
+
+for order in readdir inode; do
+    best_wall=
+    status=0
+    i=0
+    while [ $i -lt "$BENCH_REPEAT" ]; do
+        sync
+        echo 3 > /proc/sys/vm/drop_caches
+        # shellcheck disable=SC2086
+        set -- $($RUNONE "$LS" $BENCH_FLAGS --stat-order=$order "$dir")
+        [ "$3" -ne 0 ] && status=$3
+        if [ -z "$best_wall" ] || [ "$1" -lt "$best_wall" ]; then
+            best_wall=$1
+        fi
+        i=$((i + 1))
+    done
+
+    line=$(printf '{"commit":"%s","time":%s,"entries":%s,"flags":"%s",' \
+        "$COMMIT" "$NOW" "$BENCH_ENTRIES" "$BENCH_FLAGS")
+    line=$line$(printf '"stat_order":"%s","runs":%s,"wall_ns":%s,' \
+        "$order" "$BENCH_REPEAT" "$best_wall")
+    line=$line$(printf '"status":%s}' "$status")
+
+    echo "$line" >> "$BENCH_OUT"
+    echo "$line"
+done
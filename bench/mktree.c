@@ -0,0 +1,230 @@
+/*
+ * mktree.c
+ * Make synthetic directory trees for benchmarking ls
+ *
+ * SYNOPSIS
+ * mktree flat|deep|mixed|longnames|uids count directory
+ *
+ *   flat       count regular files in one directory
+ *   deep       count entries in a tree of nested directories,
+ *              8 files and 4 subdirectories per directory
+ *   mixed      count entries in one directory: files, directories,
+ *              symbolic links ( some dangling ), fifos and hard links
+ *   longnames  count files with 200 character names
+ *   uids       count files owned by 500 different users and groups
+ *              ( only when run as root )
+ *
+ * Sizes and modification times are spread out so -S and -t have
+ * something to sort. The directory must not exist yet.
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+/* files and subdirectories of every directory of a deep tree */
+#define DEEP_FILES      8
+#define DEEP_DIRS       4
+
+/* first uid / gid and how many of them for "uids" */
+#define UID_BASE        10000
+#define UID_COUNT       500
+
+void usage();
+void make_file( const char * path, long i );
+long make_deep( const char * dir, long count, int depth );
+void make_mixed( const char * dir, long count );
+
+int g_is_root;
+
+void usage()
+{
+    fprintf ( stderr,
+        "usage: mktree flat|deep|mixed|longnames|uids count directory\n" );
+}
+
+void die( const char * what, const char * path )
+{
+    fprintf ( stderr, "mktree: %s '%s': %s\n", what, path,
+        strerror ( errno ) );
+    exit (1);
+}
+
+/*
+    a regular file of a size and mtime derived from i
+*/
+
+void make_file( const char * path, long i )
+{
+    struct timespec times[2];
+    int fd;
+
+    fd = open ( path, O_WRONLY | O_CREAT | O_EXCL, 0644 );
+    if ( fd < 0 )
+        die ( "can't create", path );
+
+    /* sparse, so a million files still fit in a tmpfs */
+    if ( ftruncate ( fd, ( i * 7919 ) % 1048576 ) < 0 )
+        die ( "can't truncate", path );
+
+    /* a few years of distinct times, in a scrambled order */
+    times[0].tv_sec = 1500000000 + ( i * 104729 ) % 100000000;
+    times[0].tv_nsec = ( i * 7 ) % 1000000000;
+    times[1] = times[0];
+    if ( futimens ( fd, times ) < 0 )
+        die ( "can't set times of", path );
+
+    close ( fd );
+}
+
+/*
+    fill dir with up to count entries, returns how many were made
+*/
+
+long make_deep( const char * dir, long count, int depth )
+{
+    char path [PATH_MAX];
+    long made = 0;
+    int i;
+
+    for ( i = 0; i < DEEP_FILES && made < count; i++, made++ )
+    {
+        snprintf ( path, sizeof(path), "%s/file%d", dir, i );
+        make_file ( path, made + depth * 1000 );
+    }
+
+    for ( i = 0; i < DEEP_DIRS && made < count; i++ )
+    {
+        snprintf ( path, sizeof(path), "%s/dir%d", dir, i );
+        if ( mkdir ( path, 0755 ) < 0 )
+            die ( "can't mkdir", path );
+        made++;
+
+        /* split what is left between the remaining subdirectories */
+        made += make_deep ( path, ( count - made ) / ( DEEP_DIRS - i ),
+                            depth + 1 );
+    }
+
+    return made;
+}
+
+void make_mixed( const char * dir, long count )
+{
+    char path [PATH_MAX];
+    char target [PATH_MAX];
+    long i;
+
+    for ( i = 0; i < count; i++ )
+    {
+        switch ( i % 6 )
+        {
+            case 0:
+            case 1:
+                snprintf ( path, sizeof(path), "%s/file%07ld", dir, i );
+                make_file ( path, i );
+                break;
+            case 2:
+                snprintf ( path, sizeof(path), "%s/dir%07ld", dir, i );
+                if ( mkdir ( path, 0755 ) < 0 )
+                    die ( "can't mkdir", path );
+                break;
+            case 3:
+                /* every other link points nowhere */
+                snprintf ( path, sizeof(path), "%s/link%07ld", dir, i );
+                snprintf ( target, sizeof(target), "%s%07ld",
+                    ( i / 6 ) % 2 ? "missing" : "file", i - 3 );
+                if ( symlink ( target, path ) < 0 )
+                    die ( "can't symlink", path );
+                break;
+            case 4:
+                snprintf ( path, sizeof(path), "%s/fifo%07ld", dir, i );
+                if ( mkfifo ( path, 0644 ) < 0 )
+                    die ( "can't mkfifo", path );
+                break;
+            case 5:
+                snprintf ( path, sizeof(path), "%s/hard%07ld", dir, i );
+                snprintf ( target, sizeof(target), "%s/file%07ld", dir,
+                    i - 5 );
+                if ( link ( target, path ) < 0 )
+                    die ( "can't link", path );
+                break;
+        }
+    }
+}
+
+int main ( int argc, char ** argv )
+{
+    char path [PATH_MAX];
+    char name [256];
+    char * kind;
+    char * dir;
+    long count;
+    long i;
+
+    if ( argc != 4 )
+    {
+        usage ();
+        exit (1);
+    }
+
+    kind = argv[1];
+    count = strtol ( argv[2], NULL, 0 );
+    dir = argv[3];
+    g_is_root = ( geteuid () == 0 );
+
+    if ( mkdir ( dir, 0755 ) < 0 )
+        die ( "can't mkdir", dir );
+
+    if ( strcmp ( kind, "flat" ) == 0 )
+    {
+        for ( i = 0; i < count; i++ )
+        {
+            snprintf ( path, sizeof(path), "%s/f%07ld", dir, i );
+            make_file ( path, i );
+        }
+    }
+    else if ( strcmp ( kind, "deep" ) == 0 )
+    {
+        make_deep ( dir, count, 0 );
+    }
+    else if ( strcmp ( kind, "mixed" ) == 0 )
+    {
+        make_mixed ( dir, count );
+    }
+    else if ( strcmp ( kind, "longnames" ) == 0 )
+    {
+        for ( i = 0; i < count; i++ )
+        {
+            memset ( name, 'n', 200 );
+            snprintf ( name + 192, sizeof(name) - 192, "%08ld", i );
+            snprintf ( path, sizeof(path), "%s/%s", dir, name );
+            make_file ( path, i );
+        }
+    }
+    else if ( strcmp ( kind, "uids" ) == 0 )
+    {
+        for ( i = 0; i < count; i++ )
+        {
+            snprintf ( path, sizeof(path), "%s/u%07ld", dir, i );
+            make_file ( path, i );
+            if ( g_is_root &&
+                 chown ( path, UID_BASE + i % UID_COUNT,
+                         UID_BASE + ( i * 7 ) % UID_COUNT ) < 0 )
+                die ( "can't chown", path );
+        }
+    }
+    else
+    {
+        usage ();
+        exit (1);
+    }
+
+    exit (0);
+}
@@ -0,0 +1,211 @@
+/*
+ * reqrate.c
+ * Listings per second, from fork/exec of ls and from an ls --server
+ *
+ * SYNOPSIS
+ * reqrate count socket ls [argument ...]
+ *
+ * Lists count times in each of three ways, with standard output going
+ * to /dev/null:
+ *
+ *   exec     fork and exec "ls argument ...", what a program running
+ *            ls pays today
+ *   client   fork and exec "ls --client=socket argument ..."
+ *   socket   send the request to the server on socket directly, as a
+ *            program would without running anything
+ *
+ * and prints one JSON object for each:
+ *
+ *   {"mode":"exec","requests":1000,"wall_ns":2345678901,
+ *    "requests_per_sec":426,"failed":0}
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/* as in ls.c : the directory, standard input, output and error */
+#define SERVER_FDS      4
+#define SERVER_MSG_MAX  65536
+
+long long now_ns();
+int run_exec( char ** argv, int null_fd );
+int run_socket( const char * path, const char * msg, size_t len,
+                int null_fd );
+void report( const char * mode, int count, long long wall_ns, int failed );
+
+long long now_ns()
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* exit status of argv, run with its output to null_fd */
+int run_exec( char ** argv, int null_fd )
+{
+    pid_t pid;
+    int status;
+
+    pid = fork ();
+    if ( pid < 0 )
+        return -1;
+    if ( pid == 0 )
+    {
+        dup2 ( null_fd, STDOUT_FILENO );
+        execvp ( argv[0], argv );
+        _exit (127);
+    }
+    if ( waitpid ( pid, &status, 0 ) < 0 )
+        return -1;
+    return WIFEXITED ( status ) ? WEXITSTATUS ( status ) : -1;
+}
+
+/* one request, the exit status the server answers with */
+int run_socket( const char * path, const char * msg, size_t len,
+                int null_fd )
+{
+    struct sockaddr_un addr;
+    union
+    {
+        struct cmsghdr align;
+        char buf [CMSG_SPACE ( sizeof(int) * SERVER_FDS )];
+    } control;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr * cp;
+    int fds [SERVER_FDS];
+    int fd, status = -1;
+
+    memset ( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    strncpy ( addr.sun_path, path, sizeof(addr.sun_path) - 1 );
+
+    fd = socket ( AF_UNIX, SOCK_SEQPACKET, 0 );
+    if ( fd < 0 )
+        return -1;
+    if ( connect ( fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 )
+    {
+        close ( fd );
+        return -1;
+    }
+
+    fds[0] = open ( ".", O_RDONLY | O_DIRECTORY );
+    fds[1] = null_fd;
+    fds[2] = null_fd;
+    fds[3] = STDERR_FILENO;
+
+    iov.iov_base = (void *)msg;
+    iov.iov_len = len;
+    memset ( &mh, 0, sizeof(mh) );
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    cp = CMSG_FIRSTHDR ( &mh );
+    cp->cmsg_level = SOL_SOCKET;
+    cp->cmsg_type = SCM_RIGHTS;
+    cp->cmsg_len = CMSG_LEN ( sizeof(fds) );
+    memcpy ( CMSG_DATA ( cp ), fds, sizeof(fds) );
+
+    if ( fds[0] >= 0 && sendmsg ( fd, &mh, MSG_NOSIGNAL ) >= 0 &&
+         recv ( fd, &status, sizeof(status), 0 ) != sizeof(status) )
+        status = -1;
+
+    if ( fds[0] >= 0 )
+        close ( fds[0] );
+    close ( fd );
+    return status;
+}
+
+void report( const char * mode, int count, long long wall_ns, int failed )
+{
+    printf ( "{\"mode\":\"%s\",\"requests\":%d,\"wall_ns\":%lld,"
+        "\"requests_per_sec\":%.0f,\"failed\":%d}\n", mode, count,
+        wall_ns, wall_ns > 0 ? count * 1e9 / wall_ns : 0.0, failed );
+}
+
+int main ( int argc, char ** argv )
+{
+    char ** client_argv;
+    char * client_opt;
+    char * msg;
+    size_t len = 0, n;
+    long long start;
+    int count, null_fd, failed, i;
+
+    if ( argc < 4 || ( count = atoi ( argv[1] ) ) < 1 )
+    {
+        fprintf ( stderr, "usage: reqrate count socket ls [argument ...]\n" );
+        exit (1);
+    }
+
+    null_fd = open ( "/dev/null", O_RDWR );
+    if ( null_fd < 0 )
+    {
+        fprintf ( stderr, "reqrate: can't open /dev/null: %s\n",
+            strerror ( errno ) );
+        exit (1);
+    }
+
+    /* ls --client=socket argument ... */
+    client_argv = calloc ( argc, sizeof(char *) );
+    client_opt = malloc ( strlen ( argv[2] ) + 10 );
+    if ( client_argv == NULL || client_opt == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    sprintf ( client_opt, "--client=%s", argv[2] );
+    client_argv[0] = argv[3];
+    client_argv[1] = client_opt;
+    for ( i = 4; i < argc; i++ )
+        client_argv[i - 2] = argv[i];
+
+    /* no environment, an empty string, the arguments */
+    msg = malloc ( SERVER_MSG_MAX );
+    if ( msg == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    msg[len++] = '\0';
+    for ( i = 4; i < argc; i++ )
+    {
+        n = strlen ( argv[i] ) + 1;
+        if ( len + n > SERVER_MSG_MAX )
+        {
+            fprintf ( stderr, "reqrate: arguments too long\n" );
+            exit (1);
+        }
+        memcpy ( msg + len, argv[i], n );
+        len += n;
+    }
+
+    start = now_ns ();
+    for ( i = 0, failed = 0; i < count; i++ )
+        failed += run_exec ( argv + 3, null_fd ) != 0;
+    report ( "exec", count, now_ns () - start, failed );
+
+    start = now_ns ();
+    for ( i = 0, failed = 0; i < count; i++ )
+        failed += run_exec ( client_argv, null_fd ) != 0;
+    report ( "client", count, now_ns () - start, failed );
+
+    start = now_ns ();
+    for ( i = 0, failed = 0; i < count; i++ )
+        failed += run_socket ( argv[2], msg, len, null_fd ) != 0;
+    report ( "socket", count, now_ns () - start, failed );
+
+    exit (0);
+}
@@ -0,0 +1,120 @@
+#!/bin/sh
+#
+# rowcost.sh
+# What printing a row costs, with the renderer made for the options and
+# with the generic one
+#
+# mktree makes a flat directory of BENCH_ENTRIES files under BENCH_DIR
+# ( kept between runs ), which is listed with each flag set of
+# BENCH_FLAGS, --renderer=generic and --renderer=auto, one thread and
+# --stats, BENCH_REPEAT times. The print phase of --stats is the time
+# spent making the rows, less write(2); the fastest run is kept. One
+# JSON object per flag set and renderer is appended to BENCH_OUT:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"entries":100000,"flags":"-l",
+#    "renderer":"auto","runs":5,"print_ns":12345678,"ns_per_row":123,
+#    "speedup":2.95}
+#
+# speedup is the generic renderer's time over this one's.
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_DIR         where the tree is made       ( /dev/shm/ls-bench )
+#   BENCH_ENTRIES     files in the directory       ( 100000 )
+#   BENCH_FLAGS       flag sets, ',' separated     ( -1,-F,-l,-liF,-lsh,-n )
+#   BENCH_REPEAT      runs per measurement         ( 5 )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+if [ -z "$BENCH_DIR" ]; then
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        BENCH_DIR=/dev/shm/ls-bench
+    else
+        BENCH_DIR=${TMPDIR:-/tmp}/ls-bench
+    fi
+fi
+
+BENCH_ENTRIES=${BENCH_ENTRIES:-100000}
+BENCH_FLAGS=${BENCH_FLAGS:-"-1,-F,-l,-liF,-lsh,-n"}
+BENCH_REPEAT=${BENCH_REPEAT:-5}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ]; then
+    echo "rowcost.sh: build ls and bench/mktree first" \
+         "( make bench-rows )" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+dir=$BENCH_DIR/flat-$BENCH_ENTRIES
+if [ ! -f "$dir.done" ]; then
+    rm -rf "$dir"
+    echo "making flat tree of $BENCH_ENTRIES entries in $dir" >&2
+    "$MKTREE" flat "$BENCH_ENTRIES" "$dir" || exit 1
+    touch "$dir.done"
+fi
+
+stats=$BENCH_DIR/rowcost.stats
+
+# print_ns FLAGS RENDERER : the fastest print phase of BENCH_REPEAT runs
+print_ns()
+{
+    best=
+    i=0
+    while [ $i -lt "$BENCH_REPEAT" ]; do
+        # shellcheck disable=SC2086
+        "$LS" $1 --renderer=$2 --threads=1 --stats="$stats" "$dir" \
+            >/dev/null || exit 1
+        ns=$(sed 's/.*"print":{"ns":\([0-9]*\).*/\1/' "$stats")
+        if [ -z "$best" ] || [ "$ns" -lt "$best" ]; then
+            best=$ns
+        fi
+        i=$((i + 1))
+    done
+    echo "$best"
+}
+
+IFS=,
+for flags in $BENCH_FLAGS; do
+    unset IFS
+    generic=$(print_ns "$flags" generic)
+    for renderer in generic auto; do
+        if [ $renderer = generic ]; then
+            ns=$generic
+        else
+            ns=$(print_ns "$flags" auto)
+        fi
+        per_row=$(awk -v n="$BENCH_ENTRIES" -v ns="$ns" \
+                  'BEGIN { printf "%d", ns / n }')
+        speedup=$(awk -v g="$generic" -v ns="$ns" \
+                  'BEGIN { printf "%.2f", ( ns > 0 ? g / ns : 0 ) }')
+
+        line=$(printf '{"commit":"%s","time":%s,"entries":%s,"flags":"%s",' \
+            "$COMMIT" "$NOW" "$BENCH_ENTRIES" "$flags")
+        line=$line$(printf '"renderer":"%s","runs":%s,"print_ns":%s,' \
+            "$renderer" "$BENCH_REPEAT" "$ns")
+        line=$line$(printf '"ns_per_row":%s,"speedup":%s}' \
+            "$per_row" "$speedup")
+
+        echo "$line" >> "$BENCH_OUT"
+        echo "$line"
+    done
+    IFS=,
+done
+unset IFS
+rm -f "$stats"
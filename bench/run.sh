@@ -0,0 +1,158 @@
+#!/bin/sh
+#
+# run.sh
+# Benchmark ls over synthetic trees, for regression tracking
+#
+# Trees are made by mktree under BENCH_DIR ( a tmpfs if there is one )
+# and kept there between runs. Every tree is listed with every flag set
+# BENCH_REPEAT times; the fastest run is kept. One JSON object per tree
+# and flag set is appended to BENCH_OUT:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"tree":"flat","entries":10000,
+#    "flags":"-l","runs":3,"wall_ns":12345678,"entries_per_sec":810000,
+#    "max_rss_kb":2048,"syscalls":20012,"status":0}
+#
+# syscalls is counted in a separate run under strace -c, and is null
+# when strace is not installed. A run killed by BENCH_TIMEOUT has
+# status 124.
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_DIR         where trees are made         ( /dev/shm/ls-bench )
+#   BENCH_SIZES       entries of the flat trees    ( 1000 10000 100000 )
+#   BENCH_TREE_SIZE   entries of the other trees   ( 10000 )
+#   BENCH_TREES       which trees                  ( flat deep mixed
+#                                                    longnames uids )
+#   BENCH_FLAGS       flag sets, ',' separated     ( -1,-l,-lt,-S,-sh,-R,-C )
+#   BENCH_REPEAT      runs per measurement         ( 3 )
+#   BENCH_TIMEOUT     seconds before a run is killed ( 300 )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+if [ -z "$BENCH_DIR" ]; then
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        BENCH_DIR=/dev/shm/ls-bench
+    else
+        BENCH_DIR=${TMPDIR:-/tmp}/ls-bench
+    fi
+fi
+
+BENCH_SIZES=${BENCH_SIZES:-"1000 10000 100000"}
+BENCH_TREE_SIZE=${BENCH_TREE_SIZE:-10000}
+BENCH_TREES=${BENCH_TREES:-"flat deep mixed longnames uids"}
+BENCH_FLAGS=${BENCH_FLAGS:-"-1,-l,-lt,-S,-sh,-R,-C"}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_TIMEOUT=${BENCH_TIMEOUT:-300}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+RUNONE=$BENCH/runone
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+TIMEOUT=
+if command -v timeout >/dev/null 2>&1; then
+    TIMEOUT="timeout $BENCH_TIMEOUT"
+fi
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ] || [ ! -x "$RUNONE" ]; then
+    echo "run.sh: build ls, bench/mktree and bench/runone first" \
+         "( make bench )" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+# make_tree KIND COUNT : print the tree's path, making it if needed
+make_tree()
+{
+    dir=$BENCH_DIR/$1-$2
+    if [ ! -f "$dir.done" ]; then
+        rm -rf "$dir"
+        echo "making $1 tree of $2 entries in $dir" >&2
+        "$MKTREE" "$1" "$2" "$dir" || exit 1
+        touch "$dir.done"
+    fi
+    echo "$dir"
+}
+
+# count_syscalls DIR FLAGS : number of system calls, or null
+count_syscalls()
+{
+    if ! command -v strace >/dev/null 2>&1; then
+        echo null
+        return
+    fi
+    trace=$BENCH_DIR/strace.out
+    # shellcheck disable=SC2086
+    $TIMEOUT strace -f -c -o "$trace" "$LS" $2 "$1" >/dev/null 2>&1
+    awk '$NF == "total" { print $4 }' "$trace"
+    rm -f "$trace"
+}
+
+# measure KIND COUNT DIR FLAGS : append one result line
+measure()
+{
+    best_wall=
+    best_rss=0
+    status=0
+    i=0
+    while [ $i -lt "$BENCH_REPEAT" ]; do
+        # shellcheck disable=SC2086
+        set -- "$1" "$2" "$3" "$4" $($RUNONE $TIMEOUT "$LS" $4 "$3")
+        wall=$5 rss=$6
+        [ "$7" -ne 0 ] && status=$7
+        if [ -z "$best_wall" ] || [ "$wall" -lt "$best_wall" ]; then
+            best_wall=$wall
+        fi
+        [ "$rss" -gt "$best_rss" ] && best_rss=$rss
+        set -- "$1" "$2" "$3" "$4"
+        i=$((i + 1))
+    done
+
+    syscalls=$(count_syscalls "$3" "$4")
+    eps=$(awk -v n="$2" -v ns="$best_wall" \
+          'BEGIN { printf "%d", ( ns > 0 ? n * 1e9 / ns : 0 ) }')
+
+    line=$(printf '{"commit":"%s","time":%s,"tree":"%s","entries":%s,' \
+        "$COMMIT" "$NOW" "$1" "$2")
+    line=$line$(printf '"flags":"%s","runs":%s,"wall_ns":%s,' \
+        "$4" "$BENCH_REPEAT" "$best_wall")
+    line=$line$(printf '"entries_per_sec":%s,"max_rss_kb":%s,' \
+        "$eps" "$best_rss")
+    line=$line$(printf '"syscalls":%s,"status":%s}' \
+        "${syscalls:-null}" "$status")
+
+    echo "$line" >> "$BENCH_OUT"
+    echo "$line"
+}
+
+for kind in $BENCH_TREES; do
+    if [ "$kind" = flat ]; then
+        sizes=$BENCH_SIZES
+    else
+        sizes=$BENCH_TREE_SIZE
+    fi
+
+    for count in $sizes; do
+        dir=$(make_tree "$kind" "$count") || exit 1
+
+        old_ifs=$IFS
+        IFS=,
+        for flags in $BENCH_FLAGS; do
+            IFS=$old_ifs
+            measure "$kind" "$count" "$dir" "$flags"
+        done
+        IFS=$old_ifs
+    done
+done
@@ -0,0 +1,75 @@
+/*
+ * runone.c
+ * Run a command once and report what it cost
+ *
+ * SYNOPSIS
+ * runone command [argument ...]
+ *
+ * The command's standard output goes to /dev/null. On standard output
+ * runone prints one line: wall clock nanoseconds, peak resident set
+ * size in kilobytes and the exit status ( 128 + signal if killed ).
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+int main ( int argc, char ** argv )
+{
+    struct timespec start, end;
+    struct rusage usage;
+    long long wall_ns;
+    pid_t pid;
+    int status;
+    int fd;
+
+    if ( argc < 2 )
+    {
+        fprintf ( stderr, "usage: runone command [argument ...]\n" );
+        exit (1);
+    }
+
+    clock_gettime ( CLOCK_MONOTONIC, &start );
+
+    pid = fork ();
+    if ( pid < 0 )
+    {
+        fprintf ( stderr, "runone: fork() error : %s\n", strerror ( errno ) );
+        exit (1);
+    }
+    if ( pid == 0 )
+    {
+        fd = open ( "/dev/null", O_WRONLY );
+        if ( fd >= 0 )
+            dup2 ( fd, STDOUT_FILENO );
+        execvp ( argv[1], argv + 1 );
+        fprintf ( stderr, "runone: can't run '%s': %s\n", argv[1],
+            strerror ( errno ) );
+        _exit (127);
+    }
+
+    if ( wait4 ( pid, &status, 0, &usage ) < 0 )
+    {
+        fprintf ( stderr, "runone: wait4() error : %s\n", strerror ( errno ) );
+        exit (1);
+    }
+
+    clock_gettime ( CLOCK_MONOTONIC, &end );
+    wall_ns = ( end.tv_sec - start.tv_sec ) * 1000000000LL
+              + ( end.tv_nsec - start.tv_nsec );
+
+    printf ( "%lld %ld %d\n", wall_ns, usage.ru_maxrss,
+        WIFEXITED ( status ) ? WEXITSTATUS ( status )
+                             : 128 + WTERMSIG ( status ) );
+    exit (0);
+}
@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# server.sh
+# Listings per second from ls --server, against running ls each time
+#
+# Starts ls --server on a socket in BENCH_DIR, has bench/reqrate list a
+# small flat tree BENCH_REQUESTS times each way ( fork/exec of ls, of
+# ls --client, and requests sent to the socket directly ) and stops the
+# server. One JSON object per way is appended to BENCH_OUT:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"entries":100,"flags":"-l",
+#    "mode":"socket","requests":1000,"wall_ns":123456789,
+#    "requests_per_sec":8100,"failed":0}
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_DIR         where the tree is made       ( /dev/shm/ls-bench )
+#   BENCH_ENTRIES     entries of the tree          ( 100 )
+#   BENCH_FLAGS       flags of every listing       ( -l )
+#   BENCH_REQUESTS    listings of each way         ( 1000 )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+if [ -z "$BENCH_DIR" ]; then
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        BENCH_DIR=/dev/shm/ls-bench
+    else
+        BENCH_DIR=${TMPDIR:-/tmp}/ls-bench
+    fi
+fi
+
+BENCH_ENTRIES=${BENCH_ENTRIES:-100}
+BENCH_FLAGS=${BENCH_FLAGS:--l}
+BENCH_REQUESTS=${BENCH_REQUESTS:-1000}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+REQRATE=$BENCH/reqrate
+SOCKET=$BENCH_DIR/ls.sock
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ] || [ ! -x "$REQRATE" ]; then
+    echo "server.sh: build ls, bench/mktree and bench/reqrate first" \
+         "( make bench-server )" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+dir=$BENCH_DIR/flat-$BENCH_ENTRIES
+if [ ! -f "$dir.done" ]; then
+    rm -rf "$dir"
+    echo "making flat tree of $BENCH_ENTRIES entries in $dir" >&2
+    "$MKTREE" flat "$BENCH_ENTRIES" "$dir" || exit 1
+    touch "$dir.done"
+fi
+
+"$LS" --server="$SOCKET" &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT INT TERM
+
+# until it answers
+i=0
+until "$LS" --client="$SOCKET" -d / >/dev/null 2>&1 && [ -S "$SOCKET" ]; do
+    i=$((i + 1))
+    if [ $i -gt 50 ]; then
+        echo "server.sh: ls --server didn't start" >&2
+        exit 1
+    fi
+    sleep 0.1
+done
+
+# shellcheck disable=SC2086
+"$REQRATE" "$BENCH_REQUESTS" "$SOCKET" "$LS" $BENCH_FLAGS "$dir" |
+while read -r result; do
+    line=$(printf '{"commit":"%s","time":%s,"entries":%s,"flags":"%s",' \
+        "$COMMIT" "$NOW" "$BENCH_ENTRIES" "$BENCH_FLAGS")
+    line=$line${result#\{}
+    echo "$line" >> "$BENCH_OUT"
+    echo "$line"
+done
@@ -0,0 +1,82 @@
+#!/bin/sh
+#
+# syscalls.sh
+# System calls of -R listings, counted by bench/syscount
+#
+# mktree makes a deep tree of BENCH_ENTRIES entries under BENCH_DIR
+# ( kept between runs ), which is listed with each flag set of
+# BENCH_FLAGS under syscount. The count doesn't change from run to run,
+# so each is listed once. One JSON object per flag set is appended to
+# BENCH_OUT:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"entries":10000,"flags":"-lR",
+#    "syscalls":20012,"stat":10003,"open":321,"getdents":642,"status":0}
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_DIR         where the tree is made       ( /dev/shm/ls-bench )
+#   BENCH_ENTRIES     entries in the tree          ( 10000 )
+#   BENCH_FLAGS       flag sets, ',' separated     ( -R,-lR,-tR,
+#                                                    --logical -R,
+#                                                    --logical -lR )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+if [ -z "$BENCH_DIR" ]; then
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        BENCH_DIR=/dev/shm/ls-bench
+    else
+        BENCH_DIR=${TMPDIR:-/tmp}/ls-bench
+    fi
+fi
+
+BENCH_ENTRIES=${BENCH_ENTRIES:-10000}
+BENCH_FLAGS=${BENCH_FLAGS:-"-R,-lR,-tR,--logical -R,--logical -lR"}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+SYSCOUNT=$BENCH/syscount
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ] || [ ! -x "$SYSCOUNT" ]; then
+    echo "syscalls.sh: build ls, bench/mktree and bench/syscount first" \
+         "( make bench-syscalls )" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+dir=$BENCH_DIR/deep-$BENCH_ENTRIES
+if [ ! -f "$dir.done" ]; then
+    rm -rf "$dir"
+    echo "making deep tree of $BENCH_ENTRIES entries in $dir" >&2
+    "$MKTREE" deep "$BENCH_ENTRIES" "$dir" || exit 1
+    touch "$dir.done"
+fi
+
+IFS=,
+for flags in $BENCH_FLAGS; do
+    unset IFS
+    # shellcheck disable=SC2086
+    counts=$("$SYSCOUNT" "$LS" $flags "$dir")
+
+    line=$(printf '{"commit":"%s","time":%s,"entries":%s,"flags":"%s",' \
+        "$COMMIT" "$NOW" "$BENCH_ENTRIES" "$flags")
+    line=$line${counts#\{}
+
+    echo "$line" >> "$BENCH_OUT"
+    echo "$line"
+    IFS=,
+done
+unset IFS
@@ -0,0 +1,146 @@
+/*
+ * syscount.c
+ * Count the system calls a command makes, as strace -c -f would
+ *
+ * SYNOPSIS
+ * syscount command [argument ...]
+ *
+ * The command runs under ptrace(2), every thread of it, with its
+ * standard output going to /dev/null. On standard output syscount
+ * prints one JSON object, the total and the calls that matter to
+ * listing a tree, then exits with the command's status:
+ *
+ *   {"syscalls":20012,"stat":10003,"open":321,"getdents":642,
+ *    "status":0}
+ *
+ * stat counts stat(), lstat(), fstat(), fstatat() and statx(); open
+ * counts open() and openat(). Needs Linux 5.3 or later, for
+ * PTRACE_GET_SYSCALL_INFO.
+ *
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/ptrace.h>
+#include <sys/syscall.h>
+#include <linux/ptrace.h>
+
+int is_stat( long nr );
+int is_open( long nr );
+
+int is_stat( long nr )
+{
+#ifdef SYS_stat
+    if ( nr == SYS_stat || nr == SYS_lstat )
+        return 1;
+#endif
+#ifdef SYS_newfstatat
+    if ( nr == SYS_newfstatat )
+        return 1;
+#endif
+#ifdef SYS_fstatat64
+    if ( nr == SYS_fstatat64 )
+        return 1;
+#endif
+#ifdef SYS_statx
+    if ( nr == SYS_statx )
+        return 1;
+#endif
+    return nr == SYS_fstat;
+}
+
+int is_open( long nr )
+{
+#ifdef SYS_open
+    if ( nr == SYS_open )
+        return 1;
+#endif
+    return nr == SYS_openat;
+}
+
+int main ( int argc, char ** argv )
+{
+    struct ptrace_syscall_info info;
+    unsigned long long total = 0, stats = 0, opens = 0, getdents = 0;
+    pid_t child, pid;
+    int status, sig, exit_status = -1, null_fd;
+
+    if ( argc < 2 )
+    {
+        fprintf ( stderr, "usage: syscount command [argument ...]\n" );
+        exit (1);
+    }
+
+    child = fork ();
+    if ( child < 0 )
+    {
+        fprintf ( stderr, "syscount: fork() error : %s\n", strerror ( errno ) );
+        exit (1);
+    }
+    if ( child == 0 )
+    {
+        null_fd = open ( "/dev/null", O_WRONLY );
+        if ( null_fd >= 0 )
+            dup2 ( null_fd, STDOUT_FILENO );
+        ptrace ( PTRACE_TRACEME, 0, NULL, NULL );
+        raise ( SIGSTOP );
+        execvp ( argv[1], argv + 1 );
+        _exit (127);
+    }
+
+    /* stopped by its SIGSTOP; follow its threads and children too */
+    if ( waitpid ( child, &status, 0 ) < 0 || ! WIFSTOPPED ( status ) )
+    {
+        fprintf ( stderr, "syscount: can't trace %s\n", argv[1] );
+        exit (1);
+    }
+    ptrace ( PTRACE_SETOPTIONS, child, NULL, PTRACE_O_TRACESYSGOOD |
+             PTRACE_O_TRACECLONE | PTRACE_O_TRACEFORK |
+             PTRACE_O_TRACEVFORK | PTRACE_O_EXITKILL );
+    ptrace ( PTRACE_SYSCALL, child, NULL, NULL );
+
+    while ( ( pid = waitpid ( -1, &status, __WALL ) ) > 0 )
+    {
+        if ( WIFEXITED ( status ) || WIFSIGNALED ( status ) )
+        {
+            if ( pid == child )
+                exit_status = WIFEXITED ( status ) ? WEXITSTATUS ( status ) :
+                    128 + WTERMSIG ( status );
+            continue;
+        }
+
+        sig = 0;
+        if ( WSTOPSIG ( status ) == ( SIGTRAP | 0x80 ) )
+        {
+            /* counted on the way in */
+            if ( ptrace ( PTRACE_GET_SYSCALL_INFO, pid, sizeof(info),
+                          &info ) > 0 && info.op == PTRACE_SYSCALL_INFO_ENTRY )
+            {
+                total++;
+                if ( is_stat ( info.entry.nr ) )
+                    stats++;
+                else if ( is_open ( info.entry.nr ) )
+                    opens++;
+                else if ( info.entry.nr == SYS_getdents64 )
+                    getdents++;
+            }
+        }
+        else if ( status >> 16 == 0 && WSTOPSIG ( status ) != SIGSTOP &&
+                  WSTOPSIG ( status ) != SIGTRAP )
+            sig = WSTOPSIG ( status );    /* a real signal, pass it on */
+
+        ptrace ( PTRACE_SYSCALL, pid, NULL, (void *)(long)sig );
+    }
+
+    printf ( "{\"syscalls\":%llu,\"stat\":%llu,\"open\":%llu,"
+        "\"getdents\":%llu,\"status\":%d}\n", total, stats, opens, getdents,
+        exit_status );
+    exit ( exit_status < 0 ? 1 : exit_status );
+}
@@ -0,0 +1,103 @@
+#!/bin/sh
+#
+# threads.sh
+# How sorting and printing one big directory scales with --threads
+#
+# mktree makes a flat directory of BENCH_ENTRIES files under BENCH_DIR
+# ( kept between runs ), which is listed with BENCH_FLAGS and each
+# --threads of BENCH_THREADS, BENCH_REPEAT times; the fastest run is
+# kept. One JSON object per thread count is appended to BENCH_OUT, with
+# its speedup over the first thread count:
+#
+#   {"commit":"1a2b3c4","time":1700000000,"entries":1000000,"flags":"-lt",
+#    "threads":4,"runs":3,"wall_ns":12345678,"speedup":2.91,
+#    "max_rss_kb":2048000,"status":0}
+#
+# The directory is read and statted by one thread whatever --threads
+# is, so the speedup is that of the whole listing, not of the sort and
+# the printing alone; --stats shows the phases.
+#
+# Environment:
+#   LS                ls binary to measure         ( ./ls )
+#   BENCH_DIR         where the tree is made       ( /dev/shm/ls-bench )
+#   BENCH_ENTRIES     files in the directory       ( 1000000 )
+#   BENCH_FLAGS       flags of every listing       ( -lt )
+#   BENCH_THREADS     thread counts                ( 1 2 4 8 16 )
+#   BENCH_REPEAT      runs per thread count        ( 3 )
+#   BENCH_OUT         results file                 ( bench/results.ndjson )
+#
+
+BENCH=$(cd "$(dirname "$0")" && pwd)
+TOP=$(dirname "$BENCH")
+
+LS=${LS:-$TOP/ls}
+case $LS in
+    /*) ;;
+    *) LS=$(pwd)/$LS ;;
+esac
+
+if [ -z "$BENCH_DIR" ]; then
+    if [ -d /dev/shm ] && [ -w /dev/shm ]; then
+        BENCH_DIR=/dev/shm/ls-bench
+    else
+        BENCH_DIR=${TMPDIR:-/tmp}/ls-bench
+    fi
+fi
+
+BENCH_ENTRIES=${BENCH_ENTRIES:-1000000}
+BENCH_FLAGS=${BENCH_FLAGS:--lt}
+BENCH_THREADS=${BENCH_THREADS:-"1 2 4 8 16"}
+BENCH_REPEAT=${BENCH_REPEAT:-3}
+BENCH_OUT=${BENCH_OUT:-$BENCH/results.ndjson}
+
+MKTREE=$BENCH/mktree
+RUNONE=$BENCH/runone
+
+COMMIT=$(cd "$TOP" && git rev-parse --short HEAD 2>/dev/null || echo unknown)
+NOW=$(date +%s)
+
+if [ ! -x "$LS" ] || [ ! -x "$MKTREE" ] || [ ! -x "$RUNONE" ]; then
+    echo "threads.sh: build ls, bench/mktree and bench/runone first" \
+         "( make bench-threads )" >&2
+    exit 1
+fi
+
+mkdir -p "$BENCH_DIR" || exit 1
+
+dir=$BENCH_DIR/flat-$BENCH_ENTRIES
+if [ ! -f "$dir.done" ]; then
+    rm -rf "$dir"
+    echo "making flat tree of $BENCH_ENTRIES entries in $dir" >&2
+    "$MKTREE" flat "$BENCH_ENTRIES" "$dir" || exit 1
+    touch "$dir.done"
+fi
+
+base_wall=
+for threads in $BENCH_THREADS; do
+    best_wall=
+    best_rss=0
+    status=0
+    i=0
+    while [ $i -lt "$BENCH_REPEAT" ]; do
+        # shellcheck disable=SC2086
+        set -- $($RUNONE "$LS" $BENCH_FLAGS --threads=$threads "$dir")
+        [ "$3" -ne 0 ] && status=$3
+        if [ -z "$best_wall" ] || [ "$1" -lt "$best_wall" ]; then
+            best_wall=$1
+        fi
+        [ "$2" -gt "$best_rss" ] && best_rss=$2
+        i=$((i + 1))
+    done
+    [ -z "$base_wall" ] && base_wall=$best_wall
+    speedup=$(awk -v b="$base_wall" -v w="$best_wall" \
+              'BEGIN { printf "%.2f", ( w > 0 ? b / w : 0 ) }')
+
+    line=$(printf '{"commit":"%s","time":%s,"entries":%s,"flags":"%s",' \
+        "$COMMIT" "$NOW" "$BENCH_ENTRIES" "$BENCH_FLAGS")
+    line=$line$(printf '"threads":%s,"runs":%s,"wall_ns":%s,"speedup":%s,' \
+        "$threads" "$BENCH_REPEAT" "$best_wall" "$speedup")
+    line=$line$(printf '"max_rss_kb":%s,"status":%s}' "$best_rss" "$status")
+
+    echo "$line" >> "$BENCH_OUT"
+    echo "$line"
+done
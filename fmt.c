@@ -0,0 +1,184 @@
+/*
+ * fmt.c
+ * Number formatting for ls
+ *
+ * Decimal conversion two digits at a time, and humanize_number()
+ * without the printf() it calls.
+ *
+ * Author: BoYu (byu1@stevens.edu)
+ *
+ */
+
+#include <string.h>
+
+#include "fmt.h"
+
+/* humanize_number() stops at exa */
+#define HN_MAXSCALE         7
+
+/* "00" "01" ... "99" */
+static const char digit_pairs[201] =
+    "0001020304050607080910111213141516171819"
+    "2021222324252627282930313233343536373839"
+    "4041424344454647484950515253545556575859"
+    "6061626364656667686970717273747576777879"
+    "8081828384858687888990919293949596979899";
+
+size_t fmt_uint( char * buf, unsigned long long n )
+{
+    char tmp [FMT_INT_MAX];
+    char * p = tmp + sizeof(tmp);
+    size_t len;
+
+    /* one division for every two digits, from the right */
+    while ( n >= 100 )
+    {
+        unsigned i = ( n % 100 ) * 2;
+
+        n /= 100;
+        p -= 2;
+        memcpy ( p, digit_pairs + i, 2 );
+    }
+    if ( n >= 10 )
+    {
+        p -= 2;
+        memcpy ( p, digit_pairs + n * 2, 2 );
+    }
+    else
+        *--p = '0' + n;
+
+    len = tmp + sizeof(tmp) - p;
+    memcpy ( buf, p, len );
+    return len;
+}
+
+size_t fmt_int( char * buf, long long n )
+{
+    if ( n < 0 )
+    {
+        buf[0] = '-';
+        return 1 + fmt_uint ( buf + 1, - (unsigned long long) n );
+    }
+    return fmt_uint ( buf, n );
+}
+
+size_t fmt_int_width( char * buf, long long n, int width )
+{
+    char tmp [FMT_INT_MAX];
+    size_t len = fmt_int ( tmp, n );
+    size_t pad = 0;
+
+    if ( width > 0 && len < (size_t)width )
+    {
+        pad = width - len;
+        memset ( buf, ' ', pad );
+    }
+    memcpy ( buf + pad, tmp, len );
+    return pad + len;
+}
+
+/*
+    the same arithmetic as libbsd's humanize_number() : the number is
+    divided keeping the quotient and the remainder of the last division,
+    and the remainder rounds the digit after the point, or the quotient
+*/
+int fmt_humanize( char * buf, size_t len, int64_t bytes,
+                  const char * suffix, int scale, int flags )
+{
+    /* B, K, M, G, T, P, E, with or without the B; k for SI */
+    static const char * const prefix_tables[4] =
+    {
+        "\0\0K\0M\0G\0T\0P\0E", "B\0K\0M\0G\0T\0P\0E",
+        "\0\0k\0M\0G\0T\0P\0E", "B\0k\0M\0G\0T\0P\0E"
+    };
+    const char * prefix;
+    char tmp [FMT_INT_MAX * 2 + 4];
+    size_t baselen, suffix_len = strlen ( suffix ), o, n;
+    int64_t divisor = flags & FMT_HN_DIVISOR_1000 ? 1000 : 1024;
+    /* where x.y rounds up to 10 : ceil ( .95 * divisor ) */
+    int64_t divisordeccut = flags & FMT_HN_DIVISOR_1000 ? 950 : 973;
+    int64_t remainder = 0;
+    int64_t max;
+    int i, s1, s2, sign = 1;
+
+    if ( len > 0 )
+        buf[0] = '\0';
+
+    if ( scale < 0 ||
+         ( scale >= HN_MAXSCALE && ( scale & ~FMT_HN_AUTOSCALE ) != 0 ) )
+        return -1;
+
+    if ( bytes < 0 )
+    {
+        sign = -1;
+        bytes = -bytes;
+        baselen = 3;            /* sign, digit, prefix */
+    }
+    else
+        baselen = 2;            /* digit, prefix */
+    if ( ! ( flags & FMT_HN_NOSPACE ) )
+        baselen++;
+    baselen += suffix_len;
+
+    /* room for "x y" + suffix + '\0' */
+    if ( len < baselen + 1 )
+        return -1;
+
+    if ( scale & FMT_HN_AUTOSCALE )
+    {
+        /* divide until it fits, once more if rounding would overflow */
+        for ( max = 1, i = len - baselen; i-- > 0; )
+            max *= 10;
+        for ( i = 0;
+              ( bytes >= max ||
+                ( bytes == max - 1 && ( remainder >= divisordeccut ||
+                                        remainder >= divisor / 2 ) ) ) &&
+              i < HN_MAXSCALE;
+              i++ )
+        {
+            remainder = bytes % divisor;
+            bytes /= divisor;
+        }
+    }
+    else
+    {
+        for ( i = 0; i < scale && i < HN_MAXSCALE; i++ )
+        {
+            remainder = bytes % divisor;
+            bytes /= divisor;
+        }
+    }
+
+    /* "%d%s%d%s%s%s" or "%lld%s%s%s", with snprintf()'s truncation */
+    if ( ( ( bytes == 9 && remainder < divisordeccut ) || bytes < 9 ) &&
+         i > 0 && ( flags & FMT_HN_DECIMAL ) )
+    {
+        /* x.y, one digit after the point */
+        s1 = (int)bytes + ( remainder * 10 + divisor / 2 ) / divisor / 10;
+        s2 = ( ( remainder * 10 + divisor / 2 ) / divisor ) % 10;
+        o = fmt_int ( tmp, sign * s1 );
+        tmp[o++] = '.';
+        o += fmt_int ( tmp + o, s2 );
+    }
+    else
+        o = fmt_int ( tmp, sign * ( bytes + ( remainder + divisor / 2 )
+                                            / divisor ) );
+
+    if ( ! ( flags & FMT_HN_NOSPACE ) )
+        tmp[o++] = ' ';
+
+    prefix = &prefix_tables [( flags & FMT_HN_DIVISOR_1000 ? 2 : 0 ) +
+                             ( flags & FMT_HN_B ? 1 : 0 )] [i * 2];
+    if ( *prefix != '\0' )
+        tmp[o++] = *prefix;
+
+    /* what fits of it, and of the suffix */
+    n = o < len - 1 ? o : len - 1;
+    memcpy ( buf, tmp, n );
+    memcpy ( buf + n, suffix,
+             n + suffix_len < len - 1 ? suffix_len : len - 1 - n );
+    o += suffix_len;
+    buf[o < len - 1 ? o : len - 1] = '\0';
+
+    return o;
+}
@@ -0,0 +1,49 @@
+/*
+ * fmt.h
+ * Number formatting for ls
+ *
+ * Author: BoYu (byu1@stevens.edu)
+ *
+ */
+
+#ifndef FMT_H
+#define FMT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* longest fmt_int() result : a sign and 20 digits */
+#define FMT_INT_MAX         21
+
+/* fmt_humanize() flags, the same as humanize_number()'s */
+#define FMT_HN_DECIMAL      0x01
+#define FMT_HN_NOSPACE      0x02
+#define FMT_HN_B            0x04
+#define FMT_HN_DIVISOR_1000 0x08
+
+/* fmt_humanize() scale */
+#define FMT_HN_AUTOSCALE    0x20
+
+/*
+    the fmt_*() functions write their digits to buf without a
+    terminating '\0' and return how many they wrote
+*/
+
+size_t fmt_uint( char * buf, unsigned long long n );
+size_t fmt_int( char * buf, long long n );
+
+/* right-aligned in width columns, like "%*lld"; buf holds
+   FMT_INT_MAX or width bytes, whichever is more */
+size_t fmt_int_width( char * buf, long long n, int width );
+
+/*
+    humanize_number() of libutil / libbsd : bytes scaled by 1024
+    ( or 1000 ) until it fits in len - 1 characters with its prefix and
+    suffix, e.g. "1.5K", "977M". buf is '\0' terminated, returns its
+    length or -1 if it can't fit.
+*/
+
+int fmt_humanize( char * buf, size_t len, int64_t bytes,
+                  const char * suffix, int scale, int flags );
+
+#endif
@@ -0,0 +1,927 @@
+/*
+ * libls.c
+ * Directory listings for programs which would otherwise run ls
+ *
+ * The state of a listing, its options, entries, names and the user and
+ * group names it has looked up, is in its struct ls_listing. The only
+ * thing shared is the table of permission strings, built once.
+ * ls_sort() and the -l row are the ones ls itself uses; ls sorts names
+ * by their first byte only, a listing by the whole name.
+ *
+ * Author: BoYu (byu1@stevens.edu)
+ *
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <pwd.h>
+#include <grp.h>
+#include <time.h>
+
+#include "libls.h"
+#include "fmt.h"
+
+/* names are allocated from chunks of this size */
+#define POOL_CHUNK          65536
+
+/* getpwuid_r() and getgrgid_r() start with this much room */
+#define OWNER_BUF_SIZE      1024
+
+/* sort_keys() sorts runs of this many keys by insertion, then merges */
+#define SORT_RUN            32
+
+/* ls_sort() uses no more threads than this */
+#define SORT_THREADS_MAX    64
+
+struct pool_chunk
+{
+    struct pool_chunk * next;
+    size_t used;
+    char data [POOL_CHUNK];
+};
+
+/* a user or group name looked up already */
+struct owner
+{
+    unsigned long id;
+    const char * name;
+};
+
+/* one merge, or one run sorted, by a thread of sort_parallel() */
+struct sort_task
+{
+    int merge;                          /* 0 : sort src[lo, hi) in place */
+    struct ls_sort_key * src;
+    struct ls_sort_key * dst;
+    size_t lo, hi;                      /* src[lo, hi) */
+    size_t lo2, hi2;                    /* merged with src[lo2, hi2) */
+    size_t out;                         /* into dst from here */
+};
+
+struct ls_listing
+{
+    struct ls_options options;
+    struct ls_entry * entries;
+    size_t count, alloc;
+    size_t next;                        /* for ls_next() and ls_each() */
+    struct pool_chunk * pool;
+    struct owner * users, * groups;
+    size_t nusers, ngroups;
+};
+
+static char mode_table[4096][9];
+static pthread_once_t mode_table_once = PTHREAD_ONCE_INIT;
+
+static void mode_table_init( void );
+static char * pool_alloc( struct ls_listing * lp, size_t size );
+static char * pool_strdup( struct ls_listing * lp, const char * str,
+                           size_t len );
+static const char * owner_name( struct ls_listing * lp, int group,
+                                unsigned long id );
+static int name_listed( const struct ls_options * op, const char * name );
+static const struct timespec * entry_time( const struct ls_options * op,
+                                           const struct stat * statp );
+static size_t format_owner( char * buf, const char * name,
+                            unsigned long id );
+static void merge_runs( const struct ls_sort_key * src,
+                        struct ls_sort_key * dst, size_t lo, size_t hi,
+                        size_t lo2, size_t hi2, size_t out );
+static size_t merge_split( const struct ls_sort_key * src, size_t lo,
+                           size_t mid, size_t hi, size_t k );
+static void sort_keys( struct ls_sort_key * keys, struct ls_sort_key * tmp,
+                       size_t count );
+static void * sort_task_run( void * arg );
+static void sort_run_tasks( struct sort_task * tasks, int ntasks );
+static void sort_parallel( struct ls_sort_key * keys,
+                           struct ls_sort_key * tmp, size_t count,
+                           int nthreads );
+static int compare_entry_name( const void * a, const void * b );
+static int compare_entry_name_reverse( const void * a, const void * b );
+static long long entry_key( const struct ls_options * op,
+                            const struct ls_entry * ep );
+static int sort_entries( struct ls_listing * lp );
+static int add_name( struct ls_listing * lp, const struct dirent * dirp );
+static int compare_entry_ino( const void * a, const void * b );
+static int describe_entry( struct ls_listing * lp, int dir_fd,
+                           struct ls_entry * ep );
+static int stat_entries( struct ls_listing * lp, int dir_fd );
+
+/*
+    mode strings, the nine permission letters of every mode in a table
+*/
+
+static void mode_table_init( void )
+{
+    int m;
+    char * p;
+
+    for ( m = 0; m < 4096; m++ )
+    {
+        p = mode_table[m];
+
+        p[0] = m & S_IRUSR ? 'r' : '-';
+        p[1] = m & S_IWUSR ? 'w' : '-';
+        if ( m & S_ISUID )
+            p[2] = m & S_IXUSR ? 's' : 'S';
+        else
+            p[2] = m & S_IXUSR ? 'x' : '-';
+
+        p[3] = m & S_IRGRP ? 'r' : '-';
+        p[4] = m & S_IWGRP ? 'w' : '-';
+        if ( m & S_ISGID )
+            p[5] = m & S_IXGRP ? 's' : 'S';
+        else
+            p[5] = m & S_IXGRP ? 'x' : '-';
+
+        p[6] = m & S_IROTH ? 'r' : '-';
+        p[7] = m & S_IWOTH ? 'w' : '-';
+        if ( m & S_ISVTX )
+            p[8] = m & S_IXOTH ? 't' : 'T';
+        else
+            p[8] = m & S_IXOTH ? 'x' : '-';
+    }
+}
+
+void ls_mode_string( mode_t mode, char * buf )
+{
+    pthread_once ( &mode_table_once, mode_table_init );
+
+    switch ( mode & S_IFMT )
+    {
+        case S_IFDIR:   buf[0] = 'd'; break;
+        case S_IFCHR:   buf[0] = 'c'; break;
+        case S_IFBLK:   buf[0] = 'b'; break;
+        case S_IFREG:   buf[0] = '-'; break;
+        case S_IFLNK:   buf[0] = 'l'; break;
+        case S_IFSOCK:  buf[0] = 's'; break;
+        case S_IFIFO:   buf[0] = 'p'; break;
+#ifdef S_IFWHT
+        case S_IFWHT:   buf[0] = 'w'; break;
+#endif
+        default:        buf[0] = '?'; break;
+    }
+    memcpy ( buf + 1, mode_table[mode & 07777], 9 );
+    buf[10] = ' ';
+    buf[11] = '\0';
+}
+
+/*
+    like BSD ls, an executable is a file with any of the execute bits
+    set, whoever runs ls and whatever the file system is mounted with
+*/
+char ls_type_char( mode_t mode )
+{
+    switch ( mode & S_IFMT )
+    {
+        case S_IFDIR:   return '/';
+        case S_IFLNK:   return '@';
+        case S_IFSOCK:  return '=';
+        case S_IFIFO:   return '|';
+#ifdef S_IFWHT
+        case S_IFWHT:   return '%';
+#endif
+        default:
+            break;
+    }
+
+    if ( mode & ( S_IXUSR | S_IXGRP | S_IXOTH ) )
+        return '*';
+    return ' ';
+}
+
+/*
+    strings of a listing, freed with it
+*/
+
+static char * pool_alloc( struct ls_listing * lp, size_t size )
+{
+    struct pool_chunk * cp = lp->pool;
+
+    if ( size > POOL_CHUNK )
+        return NULL;
+    if ( cp == NULL || cp->used + size > POOL_CHUNK )
+    {
+        cp = malloc ( sizeof(*cp) );
+        if ( cp == NULL )
+            return NULL;
+        cp->next = lp->pool;
+        cp->used = 0;
+        lp->pool = cp;
+    }
+    cp->used += size;
+    return cp->data + cp->used - size;
+}
+
+static char * pool_strdup( struct ls_listing * lp, const char * str,
+                           size_t len )
+{
+    char * p = pool_alloc ( lp, len + 1 );
+
+    if ( p != NULL )
+    {
+        memcpy ( p, str, len );
+        p[len] = '\0';
+    }
+    return p;
+}
+
+/*
+    the name of a user or group, with the reentrant lookups; the number
+    if it has none. A directory seldom has more than a few owners, so
+    they are searched in order.
+*/
+static const char * owner_name( struct ls_listing * lp, int group,
+                                unsigned long id )
+{
+    struct owner ** table = group ? &lp->groups : &lp->users;
+    size_t * count = group ? &lp->ngroups : &lp->nusers;
+    struct owner * op;
+    struct passwd pw, * pwp = NULL;
+    struct group gr, * grp = NULL;
+    char stack_buf [OWNER_BUF_SIZE];
+    char * buf = stack_buf;
+    size_t buf_size = sizeof(stack_buf);
+    const char * name = NULL;
+    char digits [FMT_INT_MAX];
+    size_t i;
+    int err;
+
+    for ( i = 0; i < *count; i++ )
+        if ( (*table)[i].id == id )
+            return (*table)[i].name;
+
+    for ( ;; )
+    {
+        if ( group )
+        {
+            err = getgrgid_r ( id, &gr, buf, buf_size, &grp );
+            if ( err == 0 && grp != NULL )
+                name = grp->gr_name;
+        }
+        else
+        {
+            err = getpwuid_r ( id, &pw, buf, buf_size, &pwp );
+            if ( err == 0 && pwp != NULL )
+                name = pwp->pw_name;
+        }
+        if ( err != ERANGE || buf_size >= 1024 * 1024 )
+            break;
+
+        if ( buf != stack_buf )
+            free ( buf );
+        buf_size *= 2;
+        buf = malloc ( buf_size );
+        if ( buf == NULL )
+            return NULL;
+    }
+
+    if ( name != NULL )
+        name = pool_strdup ( lp, name, strlen ( name ) );
+    else
+        name = pool_strdup ( lp, digits, fmt_uint ( digits, id ) );
+    if ( buf != stack_buf )
+        free ( buf );
+    if ( name == NULL )
+        return NULL;
+
+    op = realloc ( *table, ( *count + 1 ) * sizeof(struct owner) );
+    if ( op == NULL )
+        return NULL;
+    *table = op;
+    op[*count].id = id;
+    op[*count].name = name;
+    (*count)++;
+    return name;
+}
+
+/* hidden files, then the include and exclude globs */
+static int name_listed( const struct ls_options * op, const char * name )
+{
+    const char * const * g;
+
+    if ( name[0] == '.' )
+    {
+        if ( ! ( op->flags & ( LS_ALL | LS_ALMOST_ALL ) ) )
+            return 0;
+        if ( ! ( op->flags & LS_ALL ) &&
+             ( name[1] == '\0' || ( name[1] == '.' && name[2] == '\0' ) ) )
+            return 0;
+    }
+
+    if ( op->include != NULL && op->include[0] != NULL )
+    {
+        for ( g = op->include; *g != NULL; g++ )
+            if ( fnmatch ( *g, name, 0 ) == 0 )
+                break;
+        if ( *g == NULL )
+            return 0;
+    }
+
+    if ( op->exclude != NULL )
+    {
+        for ( g = op->exclude; *g != NULL; g++ )
+            if ( fnmatch ( *g, name, 0 ) == 0 )
+                return 0;
+    }
+    return 1;
+}
+
+static const struct timespec * entry_time( const struct ls_options * op,
+                                           const struct stat * statp )
+{
+    if ( op->time == LS_TIME_CHANGE )
+        return &statp->st_ctim;
+    if ( op->time == LS_TIME_ACCESS )
+        return &statp->st_atim;
+    return &statp->st_mtim;
+}
+
+/*
+    sorting
+
+    the items are put in an array with their keys and merge sorted, which
+    keeps items with the same key in the order they came in. With more
+    than one thread each sorts a part of the array, then pairs of parts
+    are merged until one is left, every merge cut into as many pieces as
+    there are threads for it, so the last one, of the whole array, is
+    done by all of them.
+*/
+
+/* src[lo, hi) and src[lo2, hi2), each sorted, into dst from out */
+static void merge_runs( const struct ls_sort_key * src,
+                        struct ls_sort_key * dst, size_t lo, size_t hi,
+                        size_t lo2, size_t hi2, size_t out )
+{
+    /* on equal keys the left one first, to stay stable */
+    while ( lo < hi && lo2 < hi2 )
+        dst[out++] = src[lo2].key < src[lo].key ? src[lo2++] : src[lo++];
+    while ( lo < hi )
+        dst[out++] = src[lo++];
+    while ( lo2 < hi2 )
+        dst[out++] = src[lo2++];
+}
+
+/*
+    how many of src[lo, mid) are among the first k keys the merge of
+    src[lo, mid) and src[mid, hi) puts out, by binary search : the merge
+    can then be cut anywhere and each piece merged by a thread of its own
+*/
+static size_t merge_split( const struct ls_sort_key * src, size_t lo,
+                           size_t mid, size_t hi, size_t k )
+{
+    size_t i_lo = k > hi - mid ? k - ( hi - mid ) : 0;
+    size_t i_hi = k < mid - lo ? k : mid - lo;
+
+    while ( i_lo < i_hi )
+    {
+        size_t i = i_lo + ( i_hi - i_lo ) / 2;
+        size_t j = k - i;
+
+        /* the left key i goes before the right key j - 1 : take more */
+        if ( j > 0 && src[lo + i].key <= src[mid + j - 1].key )
+            i_lo = i + 1;
+        else
+            i_hi = i;
+    }
+    return i_lo;
+}
+
+/* sort keys, with tmp as big as it to merge through */
+static void sort_keys( struct ls_sort_key * keys, struct ls_sort_key * tmp,
+                       size_t count )
+{
+    struct ls_sort_key * src = keys, * dst = tmp, * swap, key;
+    size_t lo, mid, hi, width, i, j;
+
+    for ( lo = 0; lo < count; lo += SORT_RUN )
+    {
+        for ( i = lo + 1; i < lo + SORT_RUN && i < count; i++ )
+        {
+            key = keys[i];
+            for ( j = i; j > lo && key.key < keys[j - 1].key; j-- )
+                keys[j] = keys[j - 1];
+            keys[j] = key;
+        }
+    }
+
+    for ( width = SORT_RUN; width < count; width *= 2 )
+    {
+        for ( lo = 0; lo < count; lo += 2 * width )
+        {
+            mid = lo + width < count ? lo + width : count;
+            hi = lo + 2 * width < count ? lo + 2 * width : count;
+            merge_runs ( src, dst, lo, mid, mid, hi, lo );
+        }
+        swap = src, src = dst, dst = swap;
+    }
+
+    if ( src != keys )
+        memcpy ( keys, src, count * sizeof(*keys) );
+}
+
+static void * sort_task_run( void * arg )
+{
+    struct sort_task * tp = arg;
+
+    if ( ! tp->merge )
+        sort_keys ( tp->src + tp->lo, tp->dst + tp->lo, tp->hi - tp->lo );
+    else
+        merge_runs ( tp->src, tp->dst, tp->lo, tp->hi, tp->lo2, tp->hi2,
+                     tp->out );
+    return NULL;
+}
+
+/* run the tasks, each by a thread */
+static void sort_run_tasks( struct sort_task * tasks, int ntasks )
+{
+    pthread_t threads [SORT_THREADS_MAX];
+    int started [SORT_THREADS_MAX];
+    int k;
+
+    for ( k = 0; k < ntasks; k++ )
+    {
+        /* without a thread, the task is done here */
+        started[k] = ntasks > 1 && pthread_create ( &threads[k], NULL,
+            sort_task_run, &tasks[k] ) == 0;
+        if ( ! started[k] )
+            sort_task_run ( &tasks[k] );
+    }
+    for ( k = 0; k < ntasks; k++ )
+        if ( started[k] )
+            pthread_join ( threads[k], NULL );
+}
+
+static void sort_parallel( struct ls_sort_key * keys,
+                           struct ls_sort_key * tmp, size_t count,
+                           int nthreads )
+{
+    struct sort_task tasks [SORT_THREADS_MAX];
+    struct ls_sort_key * src = keys, * dst = tmp, * swap;
+    size_t width = ( count + nthreads - 1 ) / nthreads, lo, mid, hi;
+    size_t from, to, pairs, pieces, k;
+    int ntasks;
+
+    /* the parts, each sorted in place */
+    for ( ntasks = 0, lo = 0; lo < count; lo += width, ntasks++ )
+    {
+        tasks[ntasks].merge = 0;
+        tasks[ntasks].src = keys;
+        tasks[ntasks].dst = tmp;
+        tasks[ntasks].lo = lo;
+        tasks[ntasks].hi = lo + width < count ? lo + width : count;
+    }
+    sort_run_tasks ( tasks, ntasks );
+
+    /* then merged two by two, from src to dst, each pair by its share
+       of the threads; a part without a pair is only copied */
+    for ( ; width < count; width *= 2 )
+    {
+        pairs = ( count + 2 * width - 1 ) / ( 2 * width );
+        pieces = nthreads / pairs > 1 ? nthreads / pairs : 1;
+
+        for ( ntasks = 0, lo = 0; lo < count; lo += 2 * width )
+        {
+            mid = lo + width < count ? lo + width : count;
+            hi = lo + 2 * width < count ? lo + 2 * width : count;
+
+            /* piece k puts out dst[from, to) */
+            for ( k = 0; k < pieces; k++, ntasks++ )
+            {
+                struct sort_task * tp = &tasks[ntasks];
+
+                from = lo + ( hi - lo ) * k / pieces;
+                to = lo + ( hi - lo ) * ( k + 1 ) / pieces;
+
+                tp->merge = 1;
+                tp->src = src;
+                tp->dst = dst;
+                tp->lo = lo + merge_split ( src, lo, mid, hi, from - lo );
+                tp->hi = lo + merge_split ( src, lo, mid, hi, to - lo );
+                tp->lo2 = mid + ( from - lo ) - ( tp->lo - lo );
+                tp->hi2 = mid + ( to - lo ) - ( tp->hi - lo );
+                tp->out = from;
+            }
+        }
+        sort_run_tasks ( tasks, ntasks );
+        swap = src, src = dst, dst = swap;
+    }
+
+    if ( src != keys )
+        memcpy ( keys, src, count * sizeof(*keys) );
+}
+
+int ls_sort( struct ls_sort_key * keys, size_t count, int nthreads )
+{
+    struct ls_sort_key * tmp;
+
+    if ( count < 2 )
+        return 0;
+    tmp = malloc ( count * sizeof(*tmp) );
+    if ( tmp == NULL )
+        return -1;
+
+    if ( nthreads < 1 )
+        nthreads = 1;
+    if ( nthreads > SORT_THREADS_MAX )
+        nthreads = SORT_THREADS_MAX;
+    if ( (size_t)nthreads > count )
+        nthreads = count;
+    if ( nthreads > 1 )
+        sort_parallel ( keys, tmp, count, nthreads );
+    else
+        sort_keys ( keys, tmp, count );
+
+    free ( tmp );
+    return 0;
+}
+
+static int compare_entry_name( const void * a, const void * b )
+{
+    return strcoll ( ( (const struct ls_entry *)a )->name,
+                     ( (const struct ls_entry *)b )->name );
+}
+
+static int compare_entry_name_reverse( const void * a, const void * b )
+{
+    return compare_entry_name ( b, a );
+}
+
+/* the newest or the biggest first, and LS_REVERSE turns it around */
+static long long entry_key( const struct ls_options * op,
+                            const struct ls_entry * ep )
+{
+    const struct timespec * tp;
+    long long key;
+
+    if ( op->sort == LS_SORT_TIME )
+    {
+        tp = entry_time ( op, &ep->st );
+        key = (long long)tp->tv_sec * 1000000000LL + tp->tv_nsec;
+    }
+    else
+        key = ep->st.st_size;
+
+    return op->flags & LS_REVERSE ? key : -key;
+}
+
+/*
+    by name, then by time or size with ls_sort(), which keeps the
+    entries with the same key in name order
+*/
+
+static int sort_entries( struct ls_listing * lp )
+{
+    struct ls_sort_key * keys;
+    struct ls_entry * sorted;
+    size_t i;
+
+    if ( lp->options.sort == LS_SORT_NONE || lp->count < 2 )
+        return 0;
+
+    qsort ( lp->entries, lp->count, sizeof(*lp->entries),
+            lp->options.flags & LS_REVERSE ? compare_entry_name_reverse
+                                           : compare_entry_name );
+    if ( lp->options.sort == LS_SORT_NAME )
+        return 0;
+
+    keys = malloc ( lp->count * sizeof(*keys) );
+    sorted = malloc ( lp->count * sizeof(*sorted) );
+    if ( keys == NULL || sorted == NULL )
+    {
+        free ( keys );
+        free ( sorted );
+        return -1;
+    }
+
+    for ( i = 0; i < lp->count; i++ )
+    {
+        keys[i].key = entry_key ( &lp->options, &lp->entries[i] );
+        keys[i].item = &lp->entries[i];
+    }
+    if ( ls_sort ( keys, lp->count, 1 ) < 0 )
+    {
+        free ( keys );
+        free ( sorted );
+        return -1;
+    }
+
+    for ( i = 0; i < lp->count; i++ )
+        sorted[i] = *(struct ls_entry *)keys[i].item;
+    free ( lp->entries );
+    lp->entries = sorted;
+    lp->alloc = lp->count;
+    free ( keys );
+    return 0;
+}
+
+/*
+    reading a directory
+
+    as ls does, the names are read first and lstat()ed in inode number
+    order, which reads the inode table front to back once on a cold
+    cache; the entries stay in the order readdir() returned them
+*/
+
+/* a name read, into the next entry; its inode number in st until
+   stat_entries() */
+static int add_name( struct ls_listing * lp, const struct dirent * dirp )
+{
+    struct ls_entry * ep;
+
+    if ( lp->count == lp->alloc )
+    {
+        size_t alloc = lp->alloc ? lp->alloc * 2 : 64;
+
+        ep = realloc ( lp->entries, alloc * sizeof(*ep) );
+        if ( ep == NULL )
+            return -1;
+        lp->entries = ep;
+        lp->alloc = alloc;
+    }
+    ep = &lp->entries[lp->count];
+    memset ( ep, 0, sizeof(*ep) );
+
+    ep->name = pool_strdup ( lp, dirp->d_name, strlen ( dirp->d_name ) );
+    if ( ep->name == NULL )
+        return -1;
+    ep->st.st_ino = dirp->d_ino;
+
+    lp->count++;
+    return 0;
+}
+
+static int compare_entry_ino( const void * a, const void * b )
+{
+    const struct ls_entry * x = *(const struct ls_entry * const *)a;
+    const struct ls_entry * y = *(const struct ls_entry * const *)b;
+
+    return x->st.st_ino < y->st.st_ino ? -1 : x->st.st_ino > y->st.st_ino;
+}
+
+/* the link target and the owners of a statted entry; -1 and errno if
+   either can't be had */
+static int describe_entry( struct ls_listing * lp, int dir_fd,
+                           struct ls_entry * ep )
+{
+    char target [PATH_MAX];
+    ssize_t len;
+
+    if ( ( lp->options.flags & LS_LINKS ) && S_ISLNK ( ep->st.st_mode ) )
+    {
+        len = readlinkat ( dir_fd, ep->name, target, sizeof(target) - 1 );
+        if ( len < 0 )
+            return -1;
+        ep->link_target = pool_strdup ( lp, target, len );
+        if ( ep->link_target == NULL )
+            return -1;
+    }
+
+    if ( lp->options.flags & LS_OWNERS )
+    {
+        ep->user = owner_name ( lp, 0, ep->st.st_uid );
+        ep->group = owner_name ( lp, 1, ep->st.st_gid );
+        if ( ep->user == NULL || ep->group == NULL )
+            return -1;
+    }
+    return 0;
+}
+
+static int stat_entries( struct ls_listing * lp, int dir_fd )
+{
+    struct ls_entry ** order;
+    size_t i, kept;
+
+    order = malloc ( ( lp->count ? lp->count : 1 ) * sizeof(*order) );
+    if ( order == NULL )
+        return -1;
+    for ( i = 0; i < lp->count; i++ )
+        order[i] = &lp->entries[i];
+    qsort ( order, lp->count, sizeof(*order), compare_entry_ino );
+
+    for ( i = 0; i < lp->count; i++ )
+    {
+        if ( fstatat ( dir_fd, order[i]->name, &order[i]->st,
+                       AT_SYMLINK_NOFOLLOW ) == 0 )
+            continue;
+
+        /* gone since it was read : not listed */
+        if ( errno != ENOENT )
+        {
+            free ( order );
+            return -1;
+        }
+        order[i]->name = NULL;
+    }
+    free ( order );
+
+    for ( i = 0, kept = 0; i < lp->count; i++ )
+    {
+        if ( lp->entries[i].name == NULL )
+            continue;
+        lp->entries[kept] = lp->entries[i];
+        if ( describe_entry ( lp, dir_fd, &lp->entries[kept] ) == 0 )
+            kept++;
+        else if ( errno != ENOENT )
+            return -1;
+    }
+    lp->count = kept;
+    return 0;
+}
+
+struct ls_listing * ls_open( const char * path,
+                             const struct ls_options * options )
+{
+    struct ls_listing * lp;
+    struct dirent * dirp;
+    DIR * dp;
+    int err;
+
+    lp = calloc ( 1, sizeof(*lp) );
+    if ( lp == NULL )
+        return NULL;
+    if ( options != NULL )
+        lp->options = *options;
+
+    dp = opendir ( path );
+    if ( dp == NULL )
+    {
+        err = errno;
+        free ( lp );
+        errno = err;
+        return NULL;
+    }
+
+    /* errno tells the end of the directory from an error */
+    for ( ;; )
+    {
+        errno = 0;
+        dirp = readdir ( dp );
+        if ( dirp == NULL )
+            break;
+        if ( ! name_listed ( &lp->options, dirp->d_name ) )
+            continue;
+        if ( add_name ( lp, dirp ) < 0 )
+            break;
+    }
+
+    err = errno;
+    if ( err == 0 && ( stat_entries ( lp, dirfd ( dp ) ) < 0 ||
+                       sort_entries ( lp ) < 0 ) )
+        err = errno;
+    closedir ( dp );
+    if ( err != 0 )
+    {
+        ls_close ( lp );
+        errno = err;
+        return NULL;
+    }
+    return lp;
+}
+
+const struct ls_entry * ls_next( struct ls_listing * lp )
+{
+    if ( lp->next >= lp->count )
+        return NULL;
+    return &lp->entries[lp->next++];
+}
+
+int ls_each( struct ls_listing * lp, size_t batch, ls_batch_fn fn,
+             void * arg )
+{
+    size_t n;
+    int ret;
+
+    if ( batch == 0 )
+        batch = lp->count;
+
+    while ( lp->next < lp->count )
+    {
+        n = lp->count - lp->next < batch ? lp->count - lp->next : batch;
+        ret = fn ( &lp->entries[lp->next], n, arg );
+        lp->next += n;
+        if ( ret != 0 )
+            return ret;
+    }
+    return 0;
+}
+
+size_t ls_count( const struct ls_listing * lp )
+{
+    return lp->count;
+}
+
+/* an owner's name, or without one its number as -n prints it */
+static size_t format_owner( char * buf, const char * name,
+                            unsigned long id )
+{
+    size_t n;
+
+    if ( name == NULL )
+        return fmt_uint ( buf, id );
+    n = strlen ( name );
+    if ( n > NAME_MAX )
+        n = NAME_MAX;
+    memcpy ( buf, name, n );
+    return n;
+}
+
+/*
+    mode, links, owner, group, size, time and name, spaced as ls prints
+    them; made in a buffer big enough for any of them and copied
+*/
+size_t ls_format_entry( const struct ls_options * options,
+                        const struct ls_entry * ep, char * buf, size_t size )
+{
+    char line [LS_LINE_MAX];
+    const struct timespec * tp = entry_time ( options, &ep->st );
+    struct tm tm;
+    char type = ls_type_char ( ep->st.st_mode );
+    size_t o, n;
+
+    ls_mode_string ( ep->st.st_mode, line );
+    o = 11;
+    line[o++] = ' ';
+    o += fmt_int_width ( line + o, ep->st.st_nlink, 6 );
+    line[o++] = ' ';
+
+    o += format_owner ( line + o, ep->user, ep->st.st_uid );
+    line[o++] = ' ';
+    o += format_owner ( line + o, ep->group, ep->st.st_gid );
+    line[o++] = ' ';
+
+    /* humanize_number() into 5 bytes, as BSD ls does */
+    if ( ! ( options->flags & LS_HUMAN ) ||
+         fmt_humanize ( line + o, 5, ep->st.st_size, "", FMT_HN_AUTOSCALE,
+                        FMT_HN_DECIMAL | FMT_HN_B | FMT_HN_NOSPACE ) < 0 )
+        o += fmt_int_width ( line + o, ep->st.st_size, 10 );
+    else
+        o += strlen ( line + o );
+    line[o++] = ' ';
+
+    localtime_r ( &tp->tv_sec, &tm );
+    o += strftime ( line + o, 32, "%b %d %R", &tm );
+    line[o++] = ' ';
+
+    n = strlen ( ep->name );
+    if ( n > NAME_MAX )
+        n = NAME_MAX;
+    memcpy ( line + o, ep->name, n );
+    o += n;
+
+    if ( ( options->flags & LS_TYPE ) && type != ' ' )
+    {
+        line[o++] = type;
+        line[o++] = ' ';
+    }
+
+    /* right after the name, and a space after the target */
+    if ( ep->link_target != NULL )
+    {
+        memcpy ( line + o, "-> ", 3 );
+        o += 3;
+        n = strlen ( ep->link_target );
+        if ( n > PATH_MAX - 1 )
+            n = PATH_MAX - 1;
+        memcpy ( line + o, ep->link_target, n );
+        o += n;
+        line[o++] = ' ';
+    }
+
+    if ( size > 0 )
+    {
+        n = o < size - 1 ? o : size - 1;
+        memcpy ( buf, line, n );
+        buf[n] = '\0';
+    }
+    return o;
+}
+
+size_t ls_format( const struct ls_listing * lp, const struct ls_entry * ep,
+                  char * buf, size_t size )
+{
+    return ls_format_entry ( &lp->options, ep, buf, size );
+}
+
+void ls_close( struct ls_listing * lp )
+{
+    struct pool_chunk * cp;
+
+    if ( lp == NULL )
+        return;
+    while ( ( cp = lp->pool ) != NULL )
+    {
+        lp->pool = cp->next;
+        free ( cp );
+    }
+    free ( lp->users );
+    free ( lp->groups );
+    free ( lp->entries );
+    free ( lp );
+}
@@ -0,0 +1,136 @@
+/*
+ * libls.h
+ * Directory listings for programs which would otherwise run ls
+ *
+ * A listing reads one directory, stats and sorts its entries and keeps
+ * them until ls_close(). Everything it needs is in the listing, so any
+ * number of them can be open at once, in as many threads. The rows are
+ * ls's own : ls prints its -l and -n rows with ls_format_entry(), and
+ * sorts with ls_sort(), on keys of its own.
+ *
+ *     struct ls_options options = { LS_OWNERS, LS_SORT_TIME };
+ *     struct ls_listing * lp = ls_open ( "/var/spool", &options );
+ *     const struct ls_entry * ep;
+ *
+ *     while ( ( ep = ls_next ( lp ) ) != NULL )
+ *         printf ( "%s %s\n", ep->user, ep->name );
+ *     ls_close ( lp );
+ *
+ * Author: BoYu (byu1@stevens.edu)
+ *
+ */
+
+#ifndef LIBLS_H
+#define LIBLS_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/* ls_options.flags */
+#define LS_ALL          0x01    /* -a : every entry, . and .. too */
+#define LS_ALMOST_ALL   0x02    /* -A : dot files, but not . and .. */
+#define LS_REVERSE      0x04    /* -r */
+#define LS_OWNERS       0x08    /* fill in user and group names */
+#define LS_LINKS        0x10    /* read symbolic link targets */
+#define LS_TYPE         0x20    /* -F : formatted with its -F character */
+#define LS_HUMAN        0x40    /* -h : sizes formatted as 1.5K */
+
+/*
+    ls_options.sort; names are compared with strcoll(), and entries with
+    the same time or size are in name order
+*/
+#define LS_SORT_NAME    0
+#define LS_SORT_TIME    1       /* newest first, like -t, by ls_options.time
+                                   to the nanosecond */
+#define LS_SORT_SIZE    2       /* largest first, like -S */
+#define LS_SORT_NONE    3       /* directory order, like -f; no -r */
+
+/* ls_options.time, the time formatted */
+#define LS_TIME_MODIFY  0
+#define LS_TIME_CHANGE  1       /* -c */
+#define LS_TIME_ACCESS  2       /* -u */
+
+/* room for any line ls_format() makes, its '\0' included */
+#define LS_LINE_MAX     ( 4096 + 3 * 256 + 128 )
+
+struct ls_options
+{
+    int flags;
+    int sort;
+    int time;
+    const char * const * include;   /* globs, NULL terminated, or NULL */
+    const char * const * exclude;
+};
+
+struct ls_entry
+{
+    const char * name;
+    const char * link_target;       /* LS_LINKS, NULL if not a link */
+    const char * user;              /* LS_OWNERS, else NULL */
+    const char * group;
+    struct stat st;
+};
+
+struct ls_listing;
+
+/* what ls_sort() sorts : an item, by its key */
+struct ls_sort_key
+{
+    long long key;
+    void * item;
+};
+
+/* called with up to batch entries at a time, non-zero stops ls_each() */
+typedef int (*ls_batch_fn)( const struct ls_entry * entries, size_t count,
+                            void * arg );
+
+/*
+    read path; NULL and errno if it, an entry or, with LS_LINKS, a link
+    target can't be. Entries removed while they are read are left out.
+    options may be NULL for ls's defaults. The entries and their strings
+    belong to the listing.
+*/
+struct ls_listing * ls_open( const char * path,
+                             const struct ls_options * options );
+
+/* the entries in order, then NULL */
+const struct ls_entry * ls_next( struct ls_listing * lp );
+
+/* the entries ls_next() hasn't returned, batch at a time; returns
+   what fn stopped with, or 0 */
+int ls_each( struct ls_listing * lp, size_t batch, ls_batch_fn fn,
+             void * arg );
+
+size_t ls_count( const struct ls_listing * lp );
+
+/* the ls -l line of ep, as ls_format_entry() makes it with the
+   listing's options */
+size_t ls_format( const struct ls_listing * lp, const struct ls_entry * ep,
+                  char * buf, size_t size );
+
+/*
+    the line ls -l prints for ep, without a newline : ls -n's when
+    ep->user and ep->group are NULL, with options' time, LS_TYPE and
+    LS_HUMAN. Returns its length, and like snprintf() puts as much as
+    fits in buf.
+*/
+size_t ls_format_entry( const struct ls_options * options,
+                        const struct ls_entry * ep, char * buf, size_t size );
+
+/*
+    the keys into increasing order, equal keys staying in the order they
+    are in, with up to nthreads threads; 0, or -1 and errno if there
+    isn't the memory
+*/
+int ls_sort( struct ls_sort_key * keys, size_t count, int nthreads );
+
+void ls_close( struct ls_listing * lp );
+
+/* "drwxr-xr-x ", as strmode() makes it; buf holds 12 bytes */
+void ls_mode_string( mode_t mode, char * buf );
+
+/* the -F character for mode, ' ' for none */
+char ls_type_char( mode_t mode );
+
+#endif
@@ -3,12 +3,26 @@
  * List directory contents
  *
  * SYNOPSIS
- * ls [-AacdFfhiklnqRrSstuw1] [file ...]
+ * ls [-AacdFfhiklnqRrSstuw1] [--format=ndjson|binary] [--cache[=DIR]]
+ *    [--cache-strict] [--index-write=FILE] [--index=FILE] [--watch]
+ *    [--stats[=FILE]] [--latency[=N]] [--du] [--dedup-links]
+ *    [--include=GLOB] [--exclude=GLOB] [--regex=RE] [--newer=FILE]
+ *    [--older-than=AGE] [--min-size=N] [--max-size=N] [--type=TYPES]
+ *    [--uid=USER] [--stat-order=auto|inode|readdir] [--threads=N]
+ *    [--renderer=auto|generic] [--logical] [--max-depth=N]
+ *    [--one-file-system] [--prune=GLOB] [file ...]
+ * ls --count[=types] [-aAR] [--type=TYPES] [name filters] [--max-depth=N]
+ *    [--one-file-system] [--prune=GLOB] [file ...]
+ * ls [-cFhiklnqSstu1] --files-from=FILE [--null]
+ * ls --server=SOCKET
+ * ls --client=SOCKET [argument ...]
  *
  * Author: BoYu (byu1@stevens.edu)
  *
  */
 
+#define _GNU_SOURCE     /* struct ucred, for --server */
+
 #include <unistd.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -23,12 +37,64 @@
 #include <time.h>
 #include <fts.h>
 #include <ctype.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <locale.h>
+#include <wchar.h>
+#include <wctype.h>
+#include <pthread.h>
+#include <fnmatch.h>
+#include <regex.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/syscall.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+    #include <immintrin.h>
+    #define NAME_SCAN_X86   /* SSE2 / AVX2 name scans, chosen at run time */
+#endif
+
+#ifdef __linux__
+    #include <sys/inotify.h>
+    #include <sys/sysmacros.h>  /* major(), minor() */
+#endif
 
 /* print debug info */
 /*
 #define DEBUG
 */
 
+/*
+    static probes ( USDT ), for bpftrace / perf / systemtap on an
+    unmodified binary, e.g.
+
+        bpftrace -e 'usdt:./ls:ls:dir_read { printf("%s %d\n",
+                     str(arg0), arg1); }'
+
+    each probe is a nop instruction until something attaches to it;
+    without <sys/sdt.h> ( systemtap-sdt-dev ) they are compiled out.
+*/
+#if defined(__has_include)
+    #if __has_include(<sys/sdt.h>)
+        #include <sys/sdt.h>
+        #define HAVE_SDT
+    #endif
+#endif
+
+#ifdef HAVE_SDT
+    #define LS_PROBE1(name, a)      DTRACE_PROBE1 ( ls, name, a )
+    #define LS_PROBE2(name, a, b)   DTRACE_PROBE2 ( ls, name, a, b )
+#else
+    #define LS_PROBE1(name, a)      do { } while ( 0 )
+    #define LS_PROBE2(name, a, b)   do { } while ( 0 )
+#endif
+
 #define LINUXLAB
 
 #ifdef LINUXLAB
@@ -37,13 +103,123 @@
 
 #define ENABLE_H_OPTION
 
-#ifdef ENABLE_H_OPTION
-    #include <libutil.h>    /* for humanize_number() */
-#endif
+#include "fmt.h"        /* numbers, and humanize_number() for -h */
+#include "libls.h"      /* the sort, the -l rows, mode strings */
 
 /* if environment variable COLUMNS is not defined or can't find, use this. */
 #define COLUMNS 5
 
+/* names are allocated from chunks of this size, see name_pool_alloc() */
+#define NAME_POOL_CHUNK     65536
+
+/* a directory with this many symbolic links has them read by threads */
+#define LINK_THREAD_MIN     256
+#define LINK_THREADS_MAX    8
+
+/* a listing of this many entries is sorted and printed by threads, up
+   to PARALLEL_THREADS_MAX of them ( --threads ) */
+#define PARALLEL_MIN            16384
+#define PARALLEL_THREADS_MAX    64
+
+/* print_parallel() hands out rows this many at a time, and lets each
+   thread get RENDER_AHEAD chunks ahead of the one being written */
+#define RENDER_CHUNK            4096
+#define RENDER_AHEAD            2
+
+/* values of f_renderer_option ( --renderer ) */
+#define RENDERER_AUTO       0       /* the one made for the options */
+#define RENDERER_GENERIC    1       /* print_with_proper_option() */
+
+/* size of the buffer standard output is collected in before write(2) */
+#define OUT_BUF_SIZE 65536
+
+/* values of f_format_option ( --format ) */
+#define FORMAT_TEXT     0       /* the normal ls output */
+#define FORMAT_NDJSON   1       /* one JSON object per line */
+#define FORMAT_BINARY   2       /* length-prefixed binary records */
+
+/* first bytes of a --format=binary stream */
+#define BINARY_MAGIC "LSBIN001"
+
+/* first bytes of a --cache file */
+#define CACHE_MAGIC "LSCACHE1"
+
+/* directories changed this recently are not cached, their mtime may
+   not move again for changes made in the same clock tick */
+#define CACHE_RACY_SECONDS 2
+
+/* long options which have no single character equivalent */
+#define OPT_FORMAT          256
+#define OPT_CACHE           257
+#define OPT_CACHE_STRICT    258
+#define OPT_INDEX           259
+#define OPT_INDEX_WRITE     260
+#define OPT_WATCH           261
+#define OPT_STATS           262
+#define OPT_LATENCY         263
+#define OPT_DU              264
+#define OPT_DEDUP_LINKS     265
+#define OPT_INCLUDE         266
+#define OPT_EXCLUDE         267
+#define OPT_REGEX           268
+#define OPT_NEWER           269
+#define OPT_OLDER_THAN      270
+#define OPT_MIN_SIZE        271
+#define OPT_MAX_SIZE        272
+#define OPT_TYPE            273
+#define OPT_UID             274
+#define OPT_STAT_ORDER      275
+#define OPT_COUNT           276
+#define OPT_FILES_FROM      277
+#define OPT_NULL            278
+#define OPT_THREADS         279
+#define OPT_RENDERER        280
+#define OPT_LOGICAL         281
+#define OPT_MAX_DEPTH       282
+#define OPT_ONE_FILE_SYSTEM 283
+#define OPT_PRUNE           284
+
+/* values of f_stat_order_option ( --stat-order ) */
+#define STAT_ORDER_AUTO     0       /* inode order for big directories */
+#define STAT_ORDER_INODE    1
+#define STAT_ORDER_READDIR  2
+
+/* --stat-order=auto sorts directories with this many entries */
+#define STAT_INODE_MIN      1000
+
+/* threads walking the tree for --du */
+#define DU_THREADS_MAX      8
+
+/* threads walking the tree for --count -R, and the getdents() buffer
+   each directory being read has */
+#define COUNT_THREADS_MAX   8
+#define COUNT_BUF_SIZE      32768
+
+/* the getdents() buffer of the directory being listed, on Linux */
+#define DENTS_BUF_SIZE      32768
+
+/* d_type is 4 bits */
+#define COUNT_TYPES         16
+
+/* --files-from reads this many paths, stats them and prints them, then
+   reads the next ones */
+#define FILES_BATCH         4096
+#define FILES_THREADS_MAX   8
+
+/* and has no more than this many of their parents open at once */
+#define FILES_DIRS_MAX      256
+
+/* largest --client request, and the descriptors it passes : its
+   current directory, standard input, output and error */
+#define SERVER_MSG_MAX      65536
+#define SERVER_FDS          4
+
+/* --watch waits this long for more events before printing a batch */
+#define WATCH_SETTLE_MS 50
+
+/* first bytes of an --index-write file */
+#define INDEX_MAGIC "LSINDEX1"
+
 /*
     data structures
 */
@@ -55,7 +231,6 @@
 struct file_info
 {
     long inode_number;
-    char type_permission_info[255];
     char file_type;
     int number_of_links;
     struct passwd * password;
@@ -65,11 +240,10 @@ struct file_info
     long group_id;
     char group_name[255];
     int number_of_bytes;
+    long long sort_size;                /* -S, st_size or with --du the
+                                           bytes below a directory */
     char time_buf[255];
     
-    char last_access_time[255];         /* ls -u */
-    char last_modi_time[255];           /* default ls */
-    char last_change_time[255];         /* ls -c */
     time_t a_time;
     time_t m_time;
     time_t c_time;
@@ -78,33 +252,648 @@ struct file_info
 
     unsigned long long number_of_blocks;
 
+    char name_sanitized;                /* path_name had characters
+                                           replaced by '?' */
+    char * raw_name;                    /* then the name as it was read,
+                                           in the name pool */
+
+    struct stat stat_info;              /* raw stat */
+    char * link_target;                 /* symbolic link target, if known,
+                                           in the name pool */
+
     struct file_info * next;            /* link to next node */
 };
 
+/*
+    struct binary_record is the fixed part of one --format=binary record.
+    It is followed by name_len bytes of name, target_len bytes of link
+    target and zero padding up to rec_len, which is a multiple of 8.
+    All fields are in host byte order.
+*/
+
+struct binary_record
+{
+    uint32_t rec_len;                   /* whole record, including this */
+    uint8_t type;                       /* 'D' directory header, 'E' entry */
+    uint8_t reserved;
+    uint16_t name_len;
+    uint32_t target_len;
+    uint32_t mode;
+    uint64_t inode;
+    uint64_t nlink;
+    uint32_t uid;
+    uint32_t gid;
+    int64_t size;
+    int64_t blocks;                     /* 512-byte blocks, as st_blocks */
+    int64_t a_time_ns;
+    int64_t m_time_ns;
+    int64_t c_time_ns;
+};
+
+/*
+    struct raw_entry is the stat of one entry as kept on disk by --cache.
+    Names and link targets live in a heap after the entries.
+*/
+
+struct raw_entry
+{
+    uint64_t inode;
+    uint64_t nlink;
+    uint32_t mode;
+    uint32_t uid;
+    uint32_t gid;
+    uint32_t name_off;                  /* into the name heap */
+    int64_t size;
+    int64_t blocks;
+    int64_t a_time_ns;
+    int64_t m_time_ns;
+    int64_t c_time_ns;
+    uint32_t target_off;                /* into the name heap */
+    uint16_t name_len;
+    uint16_t target_len;                /* 0 if not a symbolic link */
+};
+
+/*
+    struct cache_header starts a --cache file. It is followed by count
+    raw_entry structures in listing order and names_size bytes of names.
+*/
+
+struct cache_header
+{
+    char magic[8];
+    uint64_t dev;                       /* of the directory */
+    uint64_t inode;
+    int64_t m_time_ns;
+    int64_t c_time_ns;
+    uint32_t sort_key;                  /* see cache_sort_key() */
+    uint32_t count;
+    uint64_t names_size;
+};
+
+/*
+    an --index-write file is an index_header, dir_count index_dir
+    structures sorted by path ( see index_path_cmp() ), entry_count
+    raw_entry structures, each directory's sorted by name, and
+    names_size bytes of names, link targets and directory paths.
+*/
+
+struct index_header
+{
+    char magic[8];
+    uint32_t dir_count;
+    uint32_t reserved;
+    uint64_t entry_count;
+    uint64_t names_size;
+};
+
+struct index_dir
+{
+    struct raw_entry self;              /* the directory, named by path */
+    uint64_t first;                     /* its first entry */
+    uint32_t count;                     /* and how many there are */
+    uint32_t reserved;
+};
+
+/*
+    struct ls_stats collects what --stats reports. Times are in
+    nanoseconds of CLOCK_MONOTONIC.
+*/
+
+struct ls_stats
+{
+    long long start_ns;
+
+    long long opendir_ns;
+    long long readdir_ns;
+    long long lstat_ns;
+    long long readlink_ns;
+    long long fts_ns;                   /* fts_children(), -R */
+    long long record_ns;                /* record_stat(), all of it */
+    long long nss_ns;                   /* getpwuid() / getgrgid() */
+    long long sort_ns;
+    long long print_ns;                 /* print_file_info_list(),
+                                           without the writes */
+    long long write_ns;
+
+    long long opendir_calls;
+    long long readdir_calls;
+    long long lstat_calls;
+    long long readlink_calls;
+    long long fts_calls;
+    long long nss_lookups;
+    long long write_calls;
+    long long entries;                  /* nodes recorded */
+    long long directories;              /* lists printed */
+    long long bytes_written;
+    long long node_bytes;               /* malloc()ed for nodes */
+};
+
+/* time a stretch of code into g_stats.phase##_ns, only with --stats */
+#define STATS_START(t)          ( (t) = f_stats_option ? stats_now () : 0 )
+#define STATS_STOP(phase, t)    do { if ( f_stats_option ) \
+                                         g_stats.phase##_ns += \
+                                             stats_now () - (t); \
+                                   } while ( 0 )
+
+/*
+    --latency : the system calls timed into histograms
+*/
+
+#define LAT_OPENDIR             0
+#define LAT_READDIR             1       /* getdents64() on Linux, else
+                                           every readdir() */
+#define LAT_LSTAT               2
+#define LAT_READLINK            3
+#define LAT_FTS                 4       /* fts_children(), -R */
+#define LAT_OPS                 5
+
+/* what LAT_READDIR and the --stats readdir phase are reported as, and
+   whether they are system calls */
+#ifdef __linux__
+#define READDIR_NAME            "getdents"
+#define READDIR_SYSCALLS        1
+#else
+#define READDIR_NAME            "readdir"
+#define READDIR_SYSCALLS        0
+#endif
+
+/*
+    log-bucketed like HdrHistogram : 2^LAT_SUB_BITS buckets for every
+    power of two, so a bucket is at most 1/8 ( 12.5% ) wide, and
+    values below 2^LAT_SUB_BITS ns have a bucket each
+*/
+#define LAT_SUB_BITS            3
+#define LAT_BUCKETS             ( 64 << LAT_SUB_BITS )
+
+#define LAT_DEFAULT_SLOWEST     10      /* directories reported */
+
+/* time a system call, with --stats or --latency */
+#define TIMER_START(t)          ( (t) = f_stats_option || f_latency_option \
+                                        ? stats_now () : 0 )
+#define TIMER_STOP(op, phase, t) \
+    do \
+    { \
+        if ( (t) != 0 ) \
+        { \
+            long long d_ = stats_now () - (t); \
+            g_stats.phase##_ns += d_; \
+            if ( f_latency_option ) \
+                lat_record ( (op), d_ ); \
+        } \
+        g_stats.phase##_calls++; \
+    } while ( 0 )
+
+struct lat_hist
+{
+    uint32_t count[LAT_BUCKETS];
+    long long calls;
+    long long max_ns;
+};
+
+/* the histograms of one top-level operand, or of one device */
+struct lat_group
+{
+    char * name;            /* the operand, NULL for a device */
+    dev_t dev;
+    struct lat_hist hist[LAT_OPS];
+};
+
+/* the symbolic links one thread reads, see link_batch_parallel() */
+struct link_batch
+{
+    int dir_fd;
+    struct file_info ** nodes;
+    size_t count;
+    struct lat_hist hist;               /* its readlinkat()s, --latency */
+    long long ns;
+};
+
+/* a directory and the time its system calls took */
+struct lat_dir
+{
+    char * path;
+    long long ns;
+};
+
+/*
+    --dedup-links : the inodes of hard linked files already counted, a
+    table of inode numbers for each device. Only files with more than
+    one link go in, so an ordinary file costs a comparison of st_nlink.
+*/
+struct ino_set
+{
+    dev_t dev;
+    uint64_t * slots;                   /* inode numbers, 0 is free */
+    size_t size;                        /* a power of two */
+    size_t count;
+    int has_zero;                       /* inode 0, which can't be kept
+                                           in a slot */
+};
+
+struct link_set
+{
+    struct ino_set * devs;
+    int ndevs;
+};
+
+/*
+    --include, --exclude and --regex : a pattern compiled by
+    filters_compile(). Globs without wildcards, and those whose only
+    '*' is at the start, the end or both, are compared as literals;
+    the rest go to fnmatch() or regexec().
+*/
+#define FILTER_EXACT    0
+#define FILTER_PREFIX   1       /* "lit*" */
+#define FILTER_SUFFIX   2       /* "*lit" */
+#define FILTER_CONTAINS 3       /* "*lit*" */
+#define FILTER_GLOB     4
+#define FILTER_REGEX    5
+
+struct name_filter
+{
+    int kind;
+    int exclude;                        /* --exclude */
+    const char * pattern;               /* as given */
+    char * literal;                     /* FILTER_EXACT ... CONTAINS */
+    size_t literal_len;
+    regex_t regex;                      /* FILTER_REGEX */
+};
+
+/*
+    --count : what was counted, for each thread and then for the operand
+*/
+struct count_totals
+{
+    unsigned long long entries;
+    unsigned long long types [COUNT_TYPES];     /* by d_type */
+};
+
+/* a directory being read by --count, one per level of the descent */
+struct count_level
+{
+    int fd;
+#ifdef __linux__
+    char * buf;                         /* getdents64() records */
+    long len, pos;
+#else
+    DIR * dp;
+#endif
+};
+
+/* a directory handed to another thread, with its depth below the
+   operand */
+struct count_job
+{
+    int fd;
+    int level;
+};
+
+#ifdef __linux__
+/* what getdents64() returns, which <dirent.h> has no name for */
+struct count_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name [];
+};
+
+/* the directory timed_readdir() is reading, and its getdents64() records */
+struct dents_reader
+{
+    DIR * dp;
+    char buf [DENTS_BUF_SIZE] __attribute__ ((aligned(8)));
+    long len, pos;
+    struct dirent entry;                /* the one returned last */
+};
+#endif
+
+/*
+    an entry read by read_directory(), waiting for its lstat()
+*/
+struct stat_job
+{
+    ino_t ino;                          /* d_ino */
+    size_t name_off;                    /* in the names buffer */
+    struct stat stat_info;
+};
+
+/* a chunk of rows printed by a thread of print_parallel() */
+struct render_buf
+{
+    char * data;
+    size_t len, alloc;
+    int ready;                          /* rendered, not written yet */
+    const char * error;                 /* what would have exited, for
+                                           print_parallel() to report */
+};
+
+/*
+    the chunks of print_parallel() : chunk c is rendered into
+    bufs[c % window], once chunk c - window has been written from it
+*/
+struct render_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    struct file_info * next;            /* the first row not taken */
+    size_t left;                        /* rows not taken */
+    size_t taken, written;              /* chunks */
+    size_t window;
+    struct render_buf * bufs;
+};
+
+/*
+    a path read by --files-from, waiting for its fstatat()
+*/
+struct files_job
+{
+    char * path;
+    size_t dir_len;                     /* of the parent, 0 if path is
+                                           statted as it is */
+    int dir_fd;                         /* the parent opened, or
+                                           AT_FDCWD */
+    int err;                            /* errno of fstatat(), or 0 */
+    struct stat stat_info;
+    char * link_target;                 /* malloc()ed, -l only */
+};
+
+/* the part of a --files-from batch one thread stats */
+struct files_range
+{
+    struct files_job ** jobs;
+    size_t count;
+};
+
+/*
+    user and group names looked up already, by id; name is NULL for an
+    id with no name
+*/
+struct owner_slot
+{
+    unsigned long id;
+    const char * name;
+    int used;
+};
+
+struct owner_cache
+{
+    struct owner_slot * slots;
+    size_t size;                        /* a power of two */
+    size_t count;
+};
+
+/*
+    a directory walked by --du. blocks, bytes and entries are those of
+    everything below it; of its own entries only, until du_walk() adds
+    up the subdirectories.
+*/
+struct du_dir
+{
+    dev_t dev;
+    ino_t ino;
+    long parent;                        /* index, -1 for the operand */
+    char * path;                        /* until it is read */
+    unsigned long long blocks;          /* st_blocks, 512 bytes */
+    unsigned long long bytes;
+    unsigned long long entries;
+};
+
 /* 
     global variables
 */
 
 struct file_info * file_info_list_head = NULL;  /* list head */
+struct file_info * file_info_list_tail = NULL;  /* list tail, for appending */
+
+int g_list_sorted;  /* the list is already in the order to print it in */
+int g_list_count;   /* nodes in the list */
+unsigned long long g_list_blocks;   /* their blocks, for "total", without
+                                       the ones skip_entry() hides */
+
+struct stat g_cache_dir_stat;   /* directory being listed, for --cache */
 
 int g_print_count;  /* marked how many file_info node have been out put */
 
+char * g_dir_path = ".";    /* directory whose entries are being listed */
+
+char g_out_buf [OUT_BUF_SIZE];  /* pending standard output */
+size_t g_out_len;               /* bytes used in g_out_buf */
+
+/* a thread of print_parallel() : the out_ functions append here */
+__thread struct render_buf * g_render;
+
+int g_threads;      /* --threads=N, 0 for one per processor */
+
+/* prints one row, chosen by select_row_renderer() */
+typedef void (*row_renderer)( struct file_info * node_ptr );
+void print_with_proper_option( struct file_info * node_ptr );
+row_renderer g_print_row = print_with_proper_option;
+int g_row_time;                     /* LS_TIME_ of the -l time column */
+const char * g_row_block_suffix;    /* of -s with -h or -k */
+int f_renderer_option;              /* --renderer=generic|auto */
+
+int f_logical_option;       /* --logical : -R follows symbolic links */
+int g_fts_options;          /* of fts_open(), set by fts_options() */
+struct stat g_no_stat;      /* recorded instead of fts_statp with
+                               FTS_NOSTAT */
+int g_fts_lstat;            /* --stats and --latency : FTS_NOSTAT, and
+                               the entries lstat()ed by ls, timed */
+
+int g_max_depth = -1;       /* --max-depth=N : -R goes N directories
+                               down, -1 without a limit */
+int f_xdev_option;          /* --one-file-system : nor into another
+                               file system */
+dev_t g_root_dev;           /* the operand's, for --one-file-system */
+const char ** g_prunes;     /* --prune=GLOB : nor into these */
+int g_prune_count;
+
 
 /*
     function prototypes
 */
 
 void usage();
-void record_stat( struct stat * statp, char * path_name );
+void out_flush();
+void out_write( const void * data, size_t len );
+void out_putc( char c );
+void out_printf( const char * fmt, ... );
+void record_stat( struct stat * statp, char * path_name,
+                  const char * link_target );
+size_t name_scan_scalar( const char * name, size_t len );
+#ifdef NAME_SCAN_X86
+size_t name_scan_sse2( const char * name, size_t len );
+size_t name_scan_avx2( const char * name, size_t len );
+#endif
+void name_scan_select();
+int copy_name( char * dst, size_t size, const char * name );
+char * name_pool_alloc( size_t size );
+char * name_pool_strdup( const char * str, size_t len );
+int link_targets_wanted();
+int read_link_target( int dir_fd, const char * name,
+                      struct file_info * node );
+void * link_batch_run( void * arg );
+void link_batch_parallel( int dir_fd, struct file_info ** links,
+                          size_t count );
+void resolve_link_targets( int dir_fd, const char * dir_path );
+void record_raw_stat( struct file_info * new_node, struct stat * statp,
+                      char * path_name );
+void append_file_info( struct file_info * new_node );
+void reset_file_info_list();
+int skip_entry( struct file_info * node_ptr );
+void out_uint( unsigned long long n );
+void out_int( long long n );
+void out_int_width( long long n, int width );
+void out_str_width( const char * str, int width );
+void out_human( long long n, const char * suffix, int width );
+void out_long( struct file_info * node_ptr, int numeric, int human,
+               int type );
+size_t utf8_sequence( const unsigned char * str );
+void out_json_string( const char * str );
+void out_base64( const char * str );
+void out_json_name( const char * key, const char * str );
+void out_json_field( const char * key, long long value );
+long long timespec_to_ns( struct timespec * ts );
+void out_binary_record( int type, struct stat * statp, const char * name,
+                        const char * target );
+void print_machine_list();
 int get_file_info_list_length ();
-void print_with_proper_option(struct file_info * node_ptr);
+void select_row_renderer();
 void print_file_info_list();
-struct file_info * sort_by_time_modi_desc ( struct file_info * pList );
-struct file_info * sort_by_time_modi_asce ( struct file_info * pList );
-struct file_info * sort_by_lexi ( struct file_info * pList );
-struct file_info * sort_by_lexi_rev ( struct file_info * pList );
-struct file_info * sort_by_size_desc ( struct file_info * pList );
-struct file_info * sort_by_size_asce ( struct file_info * pList );
+void sort_file_info_list();
+void fill_raw_entry( struct raw_entry * rp, struct stat * statp );
+void ns_to_timespec( int64_t ns, struct timespec * ts );
+void raw_entry_to_stat( const struct raw_entry * rp, struct stat * statp );
+unsigned int cache_sort_key();
+char * cache_file_path( struct stat * dir_statp );
+int cache_load( DIR * dp );
+void cache_store();
+int index_path_cmp( const char * a, size_t a_len, const char * b,
+                    size_t b_len );
+char * index_normalize_path( char * path );
+void * index_grow( void * array, uint64_t * alloc, uint64_t need,
+                   size_t size );
+uint32_t index_add_name( const char * name, size_t len );
+void index_begin_dir( FTSENT * p, struct stat * statp );
+void index_add_entry( FTSENT * cur, struct stat * statp );
+int index_entry_cmp( const void * a, const void * b );
+void index_end_dir();
+int index_dir_cmp( const void * a, const void * b );
+void index_write_finish();
+int index_find_dir( const char * path, size_t len );
+void index_record( const struct raw_entry * rp, const char * name,
+                   size_t name_len );
+void index_list_dir( int dir );
+int list_from_index( int argc, char ** argv );
+const char * watch_name( const struct file_info * node );
+int compare_file_info( const struct file_info * a,
+                       const struct file_info * b );
+int compare_file_name( const struct file_info * a,
+                       const struct file_info * b );
+int watch_qsort_info( const void * a, const void * b );
+int watch_qsort_name( const void * a, const void * b );
+void watch_sort_list();
+size_t watch_search( struct file_info ** rows, size_t count,
+                     const struct file_info * node,
+                     int (*cmp)( const struct file_info *,
+                                 const struct file_info * ),
+                     int * found );
+size_t watch_insert( struct file_info * node );
+size_t watch_remove( struct file_info * node );
+void watch_print_row( char mark, size_t row, struct file_info * node );
+void watch_update( const char * name );
+int watch_qsort_str( const void * a, const void * b );
+void watch_add_name( char *** names, size_t * count, size_t * alloc,
+                     const char * name );
+size_t watch_rescan_names( char *** names, size_t * alloc );
+void watch_directory();
+long long stats_now();
+DIR * timed_opendir( const char * path );
+struct dirent * timed_readdir( DIR * dp );
+int timed_lstat( const char * path, struct stat * statp );
+ssize_t timed_readlinkat( int dir_fd, const char * path, char * buf,
+                          size_t size );
+FTSENT * timed_fts_children( FTS * ftsp );
+int listing_needs_stat();
+int fts_options();
+void prune_add( const char * pattern );
+int prune_match( const char * name );
+int prune_dir( const FTSENT * cur );
+int fts_enter_dir( FTS * ftsp, FTSENT * p );
+struct stat * fts_child_stat( FTSENT * cur, struct stat * buf );
+void list_fts_dir( FTS * ftsp, FTSENT * p, const char * operand );
+void stats_report();
+void report_at_exit();
+int lat_bucket( long long ns );
+long long lat_bucket_high( int bucket );
+int lat_group_find( const char * name, dev_t dev );
+void lat_end_dir();
+void lat_begin_dir( const char * operand, const char * path,
+                    const struct stat * statp );
+void lat_hist_add( struct lat_hist * hp, long long ns );
+void lat_record( int op, long long ns );
+void lat_record_hist( int op, const struct lat_hist * src, long long ns );
+long long lat_percentile( const struct lat_hist * hp, double pct );
+void lat_report();
+unsigned long long display_blocks( unsigned long long st_blocks );
+long du_add_dir( const char * path, const struct stat * statp,
+                 long parent );
+void du_read_dir( long index );
+void * du_worker( void * arg );
+void du_index_build();
+long du_find( dev_t dev, ino_t ino );
+void du_walk( const char * path );
+void du_list_dir( int dir_fd, const struct stat * statp );
+void du_sort_sizes();
+void du_begin_fts_dir( const FTSENT * p );
+void du_count_fts_entry( const FTSENT * p, const struct stat * statp );
+void du_end_fts_dir( const FTSENT * p );
+void du_print_totals( const struct du_dir * dp );
+int link_set_add( struct link_set * lp, dev_t dev, ino_t ino );
+int counted_before( struct link_set * lp, const struct stat * statp );
+void filter_add( const char * pattern, int exclude, int regex );
+void filters_compile();
+int filter_match( const struct name_filter * fp, const char * name );
+int name_wanted( const char * name );
+long long parse_size( const char * option, const char * arg );
+long long parse_age( const char * option, const char * arg );
+void predicate_type( const char * arg );
+void predicate_uid( const char * arg );
+long long entry_time_ns( const struct stat * statp );
+int dirent_wanted( const struct dirent * dirp );
+int stat_wanted( const struct stat * statp );
+int entry_wanted( const char * name, const struct stat * statp );
+struct owner_slot * owner_cache_slot( struct owner_cache * cp,
+                                      unsigned long id );
+void owner_cache_put( struct owner_cache * cp, unsigned long id,
+                      const char * name );
+const char * user_name( uid_t uid );
+const char * group_name( gid_t gid );
+void owner_cache_fill();
+void client_run( const char * path, int argc, char ** argv );
+int compare_stat_job_ino( const void * a, const void * b );
+int count_next( struct count_level * lv, const char ** name,
+                unsigned char * type );
+int count_hand_off( int fd, int level );
+int count_descend( int dir_fd, const char * name, int level );
+void count_dir( int fd, int level, struct count_totals * tp );
+void * count_worker( void * arg );
+void count_operand( const char * path );
+int compare_files_job_dir( const void * a, const void * b );
+void * files_stat_run( void * arg );
+size_t files_open_parents( struct files_job ** order, size_t count );
+void files_stat_jobs( struct files_job ** order, size_t count );
+void files_stat_batch( struct files_job * jobs, size_t count );
+int files_from( const char * file );
+void read_directory( DIR * dp );
+void server_run( const char * path, int * argcp, char *** argvp );
+void server_request( int fd, int * argcp, char *** argvp );
+void server_send_status( int status, void * arg );
+int parallel_threads( size_t count );
+int render_reserve( struct render_buf * rp, size_t len );
+void * render_run( void * arg );
+void print_parallel( int nthreads );
 
 
 /* 
@@ -150,6 +939,16 @@ int f_n_option;     /* the same as -l, except that the owner and
                        group IDs are displayed numerically rather
                        than converting to a owner or group name */
 
+int g_sanitize_names;   /* output to a terminal or -q : non-printable
+                           characters in names are shown as '?' */
+
+/* the chunk names are allocated from */
+char * g_name_pool;
+size_t g_name_pool_left;
+
+/* the fastest name scan this CPU has, see name_scan_select() */
+size_t (*g_name_scan)( const char * name, size_t len );
+
 int f_q_option;     /* force printing of non-printable characters 
                        in file names as the character '?', this is
                        default when output is to a terminal */
@@ -189,32 +988,383 @@ int f_1_option;     /* force output to be one entry per line.
                        This is the default when output is not
                        to a terminal. */
 
+int f_format_option;    /* --format=ndjson|binary : emit the raw stat
+                           fields of every entry for other programs
+                           instead of formatted text */
+
+int f_cache_option;     /* --cache[=DIR] : keep the sorted entries of
+                           every directory listed in DIR, and reuse
+                           them while the directory is unchanged */
+
+int f_cache_strict_option;  /* --cache-strict : with --cache, still
+                               lstat() every cached entry, so sizes
+                               and times are current */
+
+char * g_cache_dir;     /* where --cache files are kept */
+
+int f_index_write_option;   /* --index-write=FILE : with -R, also write
+                               a snapshot index of the traversal */
+
+char * g_index_write_file;
+
+int f_index_option;     /* --index=FILE : list from a snapshot index
+                           written by --index-write, not from the
+                           file system */
+
+char * g_index_file;
+
+int f_watch_option;     /* --watch : after the listing, keep following
+                           the directory and print the rows which
+                           change */
+
+/* --watch, the listing in print order and by name */
+struct file_info ** g_watch_rows;
+struct file_info ** g_watch_names;
+size_t g_watch_count, g_watch_alloc;
+
+int f_stats_option;     /* --stats[=FILE] : time the phases of the
+                           listing and count what they did, report to
+                           standard error or as JSON to FILE at exit */
+
+char * g_stats_file;
+
+struct ls_stats g_stats;
+
+#ifdef __linux__
+struct dents_reader g_dents;
+#endif
+
+int f_latency_option;   /* --latency[=N] : latency histograms of the
+                           system calls, by operand and by device, and
+                           the N slowest directories, at exit */
+
+struct lat_group * g_lat_groups;
+int g_lat_ngroups;
+int g_lat_operand = -1;             /* the groups being recorded into */
+int g_lat_device = -1;
+
+struct lat_dir * g_lat_slowest;     /* slowest first, f_latency_option */
+int g_lat_nslowest;
+char * g_lat_dir_path;              /* the directory being listed */
+long long g_lat_dir_ns;
+
+int f_du_option;        /* --du : totals of each directory's subtree,
+                           -S sorts directories by them */
+
+struct du_dir * g_du_dirs;          /* parents before their children */
+long g_du_count, g_du_alloc;
+long * g_du_queue;                  /* directories waiting to be read */
+long g_du_queued;
+int g_du_busy;                      /* threads reading a directory */
+pthread_mutex_t g_du_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_du_cond = PTHREAD_COND_INITIALIZER;
+long * g_du_slots;                  /* (dev, ino) hash of g_du_dirs */
+long g_du_slot_count;
+long g_du_current = -1;             /* the directory being listed */
+struct du_dir * g_du_levels;        /* -R : the totals of the directories
+                                       fts is in, by fts_level */
+int g_du_level_alloc;
+
+int f_dedup_links_option;   /* --dedup-links : count the blocks of a
+                               hard linked file once, in "total" and
+                               --du, where it is first seen */
+
+struct link_set g_links_listed;     /* for "total" */
+struct link_set g_links_walked;     /* for --du, under g_du_lock */
+struct link_set g_links_fts;        /* for --du as -R goes */
+
+int f_count_option;     /* --count[=types] : only count the entries,
+                           2 to split them by type */
+
+struct count_job * g_count_queue;   /* directories for idle threads */
+int g_count_queued;
+int g_count_busy;                   /* threads reading a directory */
+int g_count_idle;                   /* threads waiting for one */
+pthread_mutex_t g_count_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t g_count_cond = PTHREAD_COND_INITIALIZER;
+struct count_totals g_count_totals; /* of the operand, g_count_lock */
+
+char * g_files_from;        /* --files-from=FILE : the paths to list,
+                               "-" for standard input */
+int f_null_option;          /* --null : they are '\0' terminated */
+
+int f_stat_order_option;    /* --stat-order : lstat() the entries of a
+                               directory in inode order, STAT_ORDER_* */
+
+struct owner_cache g_users;         /* user_name() */
+struct owner_cache g_groups;        /* group_name() */
+
+/* what a --client passes on of its environment; the rest is the
+   server's */
+const char * const g_server_env[] =
+{
+    "COLUMNS", "BLOCKSIZE", "TZ", "LANG", "LC_ALL", "LC_CTYPE",
+    "LC_TIME", "HOME", "XDG_CACHE_HOME", NULL
+};
+
+struct name_filter * g_filters;     /* --include, --exclude, --regex */
+int g_filter_count;
+int g_filter_includes;              /* of them, --include and --regex */
+
+int f_predicate_option;     /* --newer, --older-than, --min-size,
+                               --max-size, --type or --uid : entries
+                               are kept only if their stat passes */
+int g_listing_filtered;     /* name filters or predicates */
+unsigned g_pred_types;              /* --type, bit 1 << DT_xxx */
+long long g_pred_min_size = -1;     /* --min-size, -1 if not given */
+long long g_pred_max_size = -1;     /* --max-size */
+long long g_pred_newer_ns = LLONG_MIN;  /* --newer, time of FILE */
+long long g_pred_older_ns = LLONG_MAX;  /* --older-than, now - AGE */
+long long g_pred_older_age;             /* AGE in seconds, until getopt()
+                                           is done */
+int g_pred_has_uid;
+uid_t g_pred_uid;                   /* --uid */
+const char * g_pred_newer_file;     /* --newer */
+
+/* --index-write, being built */
+struct index_dir * g_ix_dirs;
+uint32_t g_ix_dir_count, g_ix_dir_alloc;
+struct raw_entry * g_ix_entries;
+uint64_t g_ix_entry_count, g_ix_entry_alloc;
+char * g_ix_names;
+uint64_t g_ix_names_size, g_ix_names_alloc;
+
+/* --index, mapped */
+struct index_header * g_ix_header;
+struct index_dir * g_ix_dir_table;
+struct raw_entry * g_ix_entry_table;
+const char * g_ix_heap;
+
 /*
     banner
 */
 
 void usage()
 {
-	printf("usage: ls [-AaCcdFfhiklnqRrSstuwx1] [file ...]\n");
+	printf("usage: ls [-AaCcdFfhiklnqRrSstuwx1] [--format=ndjson|binary] "
+           "[--cache[=DIR]] [--cache-strict]\n"
+           "          [--index-write=FILE] [--index=FILE] [--watch] "
+           "[--stats[=FILE]] [--latency[=N]]\n"
+           "          [--du] [--dedup-links] [--include=GLOB] [--exclude=GLOB]\n"
+           "          [--regex=RE] [--newer=FILE] [--older-than=AGE] "
+           "[--min-size=N] [--max-size=N]\n"
+           "          [--type=TYPES] [--uid=USER] [--stat-order=auto|inode|readdir] "
+           "[--threads=N]\n"
+           "          [--renderer=auto|generic] [--logical] [--max-depth=N]\n"
+           "          [--one-file-system] [--prune=GLOB] [file ...]\n"
+           "       ls --count[=types] [-aAR] [--type=TYPES] "
+           "[--include=GLOB] [--exclude=GLOB]\n"
+           "          [--regex=RE] [--max-depth=N] [--one-file-system] "
+           "[--prune=GLOB] [file ...]\n"
+           "       ls [-cFhiklnqSstu1] --files-from=FILE [--null]\n"
+           "       ls --server=SOCKET\n"
+           "       ls --client=SOCKET [argument ...]\n");
 }
 
 /*
-    add a file with info into the file_info linked list
+    buffered standard output
+
+    everything listed goes through g_out_buf and is handed to the
+    kernel with one write(2) per OUT_BUF_SIZE bytes.
 */
 
-void record_stat( struct stat * statp, char * path_name )
+void out_flush()
+{
+    size_t done = 0;
+    ssize_t ret;
+    long long t;
+
+    LS_PROBE1 ( output_flush, g_out_len );
+
+    while ( done < g_out_len )
+    {
+        STATS_START ( t );
+        ret = write ( STDOUT_FILENO, g_out_buf + done, g_out_len - done );
+        STATS_STOP ( write, t );
+        g_stats.write_calls++;
+        if ( ret < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            fprintf ( stderr, "write() error : %s\n", strerror ( errno ) );
+            g_out_len = 0;
+            _exit (1);
+        }
+        done += ret;
+        g_stats.bytes_written += ret;
+    }
+    g_out_len = 0;
+}
+
+void out_write( const void * data, size_t len )
+{
+    if ( g_render != NULL )
+    {
+        if ( render_reserve ( g_render, len ) < 0 )
+            return;
+        memcpy ( g_render->data + g_render->len, data, len );
+        g_render->len += len;
+        return;
+    }
+
+    if ( g_out_len + len > sizeof(g_out_buf) )
+    {
+        out_flush ();
+        if ( len > sizeof(g_out_buf) )
+        {
+            /* too big to be buffered, write it straight through */
+            while ( len > 0 )
+            {
+                long long t;
+                ssize_t ret;
+
+                STATS_START ( t );
+                ret = write ( STDOUT_FILENO, data, len );
+                STATS_STOP ( write, t );
+                g_stats.write_calls++;
+                if ( ret < 0 )
+                {
+                    if ( errno == EINTR )
+                        continue;
+                    fprintf ( stderr, "write() error : %s\n",
+                        strerror ( errno ) );
+                    _exit (1);
+                }
+                data = (const char *)data + ret;
+                len -= ret;
+                g_stats.bytes_written += ret;
+            }
+            return;
+        }
+    }
+    memcpy ( g_out_buf + g_out_len, data, len );
+    g_out_len += len;
+}
+
+void out_putc( char c )
+{
+    if ( g_render != NULL )
+    {
+        if ( render_reserve ( g_render, 1 ) < 0 )
+            return;
+        g_render->data [g_render->len++] = c;
+        return;
+    }
+
+    if ( g_out_len == sizeof(g_out_buf) )
+        out_flush ();
+    g_out_buf [g_out_len++] = c;
+}
+
+void out_printf( const char * fmt, ... )
+{
+    va_list ap;
+    int len;
+
+    if ( g_render != NULL )
+    {
+        if ( render_reserve ( g_render, 256 ) < 0 )
+            return;
+        va_start ( ap, fmt );
+        len = vsnprintf ( g_render->data + g_render->len,
+                          g_render->alloc - g_render->len, fmt, ap );
+        va_end ( ap );
+        if ( len < 0 )
+            return;
+        if ( (size_t)len >= g_render->alloc - g_render->len )
+        {
+            if ( render_reserve ( g_render, len + 1 ) < 0 )
+                return;
+            va_start ( ap, fmt );
+            vsnprintf ( g_render->data + g_render->len, len + 1, fmt, ap );
+            va_end ( ap );
+        }
+        g_render->len += len;
+        return;
+    }
+
+    va_start ( ap, fmt );
+    len = vsnprintf ( g_out_buf + g_out_len, sizeof(g_out_buf) - g_out_len,
+                      fmt, ap );
+    va_end ( ap );
+
+    if ( len < 0 )
+        return;
+
+    if ( (size_t)len < sizeof(g_out_buf) - g_out_len )
+    {
+        g_out_len += len;
+        return;
+    }
+
+    /* did not fit, make room and format again */
+    out_flush ();
+    if ( (size_t)len < sizeof(g_out_buf) )
+    {
+        va_start ( ap, fmt );
+        vsnprintf ( g_out_buf, sizeof(g_out_buf), fmt, ap );
+        va_end ( ap );
+        g_out_len = len;
+    }
+    else
+    {
+        char * big = malloc ( len + 1 );
+        if ( big == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        va_start ( ap, fmt );
+        vsnprintf ( big, len + 1, fmt, ap );
+        va_end ( ap );
+        out_write ( big, len );
+        free ( big );
+    }
+}
+
+/*
+    add a file with info into the file_info linked list.
+    link_target is the target of a symbolic link if it is already
+    known, or NULL.
+*/
+
+void record_stat( struct stat * statp, char * path_name,
+                  const char * link_target )
 {
-    struct file_info * node_ptr = file_info_list_head;
     struct file_info * new_node = malloc (sizeof(struct file_info));
-    struct passwd * password;
-    struct group * group;
+    const char * name;
+    long long t_record, t;
+
+    LS_PROBE2 ( entry_stat, path_name, statp->st_size );
+    STATS_START ( t_record );
+    g_stats.entries++;
+    g_stats.node_bytes += sizeof(struct file_info);
 
     /* 
         initialize the new node
     */
 
     new_node->file_type = ' ';
+    new_node->name_sanitized = 0;
+    new_node->raw_name = NULL;
+    new_node->stat_info = *statp;
+    new_node->sort_size = statp->st_size;
+    new_node->link_target = link_target ?
+        name_pool_strdup ( link_target, strlen ( link_target ) ) : NULL;
     new_node->next = NULL;
+
+    /*
+        --format only wants the raw fields, skip everything which
+        is formatted for people
+    */
+
+    if ( f_format_option )
+    {
+        record_raw_stat ( new_node, statp, path_name );
+        append_file_info ( new_node );
+        STATS_STOP ( record, t_record );
+        return;
+    }
     
     /* 
        assign file stat info into file_info structure 
@@ -227,29 +1377,10 @@ void record_stat( struct stat * statp, char * path_name )
     new_node->inode_number = statp->st_ino;
 
     /* 
-        get file type and permissons
-    */
-    
-    strmode ( statp->st_mode, new_node->type_permission_info );
-   
-    /* 
-        get file type
+        get file type, -F
     */
     
-    if ( S_ISDIR ( statp->st_mode ) )
-        new_node->file_type = '/';
-    else if ( S_ISLNK ( statp->st_mode ) )
-        new_node->file_type = '@';
-    else if (!access ( path_name, X_OK ))  /* executable file */
-        new_node->file_type = '*';
-#ifdef S_ISWHT
-    else if ( S_ISWHT (statp->st_mode) )
-        new_node->file_type = '%';
-#endif
-    else if ( S_ISSOCK ( statp->st_mode ) )
-        new_node->file_type = '=';
-    else if ( S_ISFIFO ( statp->st_mode ) )
-        new_node->file_type = '|';
+    new_node->file_type = ls_type_char ( statp->st_mode );
 
     /* 
         get file number of links 
@@ -262,16 +1393,26 @@ void record_stat( struct stat * statp, char * path_name )
     */
     
     new_node->user_id = statp->st_uid;
-    password = getpwuid ( statp->st_uid );
-    strcpy ( new_node->owner_name, password->pw_name );
+    STATS_START ( t );
+    name = user_name ( statp->st_uid );
+    if ( name != NULL )
+        strcpy ( new_node->owner_name, name );
+    else    /* no such user, print the number */
+        snprintf ( new_node->owner_name, sizeof(new_node->owner_name),
+            "%ld", new_node->user_id );
 
     /*
         get file group owner 
     */
     
     new_node->group_id = statp->st_gid;
-    group = getgrgid ( statp->st_gid );
-    strcpy ( new_node->group_name, group->gr_name );
+    name = group_name ( statp->st_gid );
+    if ( name != NULL )
+        strcpy ( new_node->group_name, name );
+    else    /* no such group, print the number */
+        snprintf ( new_node->group_name, sizeof(new_node->group_name),
+            "%ld", new_node->group_id );
+    STATS_STOP ( nss, t );
 
     /* 
         get number of bytes 
@@ -280,763 +1421,5363 @@ void record_stat( struct stat * statp, char * path_name )
     new_node->number_of_bytes = statp->st_size;
 
     /*
-        get last access time
+        the times; -l formats them as it prints them
     */
-    
-    strftime ( new_node->last_access_time,
-               sizeof(new_node->last_access_time),
-               "%b %d %R",
-               localtime ( & statp->st_atime ) );
 
     new_node->a_time = statp->st_atime;
+    new_node->m_time = statp->st_mtime;
+    new_node->c_time = statp->st_ctime;
 
     /*
-        get last modified time
+        get file path name
     */
-
-    strftime ( new_node->last_modi_time,
-               sizeof(new_node->last_modi_time),
-               "%b %d %R",
-               localtime ( &statp->st_mtime ) );
-
-    new_node->m_time = statp->st_mtime; 
+   
+    new_node->name_sanitized =
+        copy_name ( new_node->path_name, sizeof(new_node->path_name),
+                    path_name );
+    if ( new_node->name_sanitized )
+        new_node->raw_name = name_pool_strdup ( path_name,
+                                                strlen ( path_name ) );
 
     /*
-        get last change time
+        symbolic links are read by resolve_link_targets() once the whole
+        directory is recorded, by path_name; one which lost its real name
+        to '?' is read now
     */
-    
-    strftime ( new_node->last_change_time,
-               sizeof(new_node->last_change_time),
-               "%b %d %R",
-               localtime ( &statp->st_ctime ) );
-    
-    new_node->c_time = statp->st_ctime;
 
-    /*
-        get file path name
-    */
-   
-    if ( isatty (1) || f_q_option )
+    if ( new_node->name_sanitized && S_ISLNK ( statp->st_mode ) &&
+         new_node->link_target == NULL && link_targets_wanted () )
     {
-        /* output is to a terminal or -q is set, then force 
-           printing of non-printable characters in file name
-           as the character '?'
-        */
+        char full_path [PATH_MAX];
+        char * p = path_name;
 
-        char str [255];
-        char * ptr;
-        strcpy ( str, path_name );
-        ptr = &str[0];
-        while ( *ptr != '\0' )
+        /* -R does not chdir into the directory it is listing */
+        if ( f_R_option )
         {
-            if ( isprint(*ptr) == 0 )
-            {
-                *ptr = '?'; 
-            }
-            ptr ++;
+            snprintf ( full_path, sizeof(full_path), "%s/%s",
+                g_dir_path, path_name );
+            p = full_path;
         }
-        strcpy ( new_node->path_name, str );
+
+        if ( read_link_target ( AT_FDCWD, p, new_node ) < 0 )
+            fprintf ( stderr, "can't read link '%s': %s\n",
+                new_node->path_name, strerror ( errno ) );
     }
-    else
-        strcpy ( new_node->path_name, path_name );
    
     /*
         get number of file system blocks actually used
     */
 
-    char * blocksize_str;
-    char * blocksize_constant = "BLOCKSIZE";
-    unsigned long long blocksize = 0;
-    unsigned long long n = 0;
+    new_node->number_of_blocks = display_blocks ( statp->st_blocks );
 
-    blocksize_str = getenv ( blocksize_constant );
-    
-    if ( NULL == blocksize_str )
-    {
-        /* ENV BLOCKSIZE is not set, so use default value */
-        new_node->number_of_blocks = statp->st_blocks;
-    }
-    else
-    {
-        blocksize = strtoll ( blocksize_str, NULL, 0 );
-        n = blocksize / 512;
-        if ( n == 1 )
-            new_node->number_of_blocks = statp->st_blocks;
-        else
-            new_node->number_of_blocks = statp->st_blocks / n;
-    }
+    append_file_info ( new_node );
+    STATS_STOP ( record, t_record );
+}
 
-    /* 
-        add new node into list 
-    */
+/*
+    names
 
-    if ( node_ptr == NULL )
-        file_info_list_head = new_node;
-    else
+    almost every name is printable ASCII. The scans below find the first
+    byte which is not ( a control character, DEL, or any byte of a
+    multibyte character ), 16 or 32 bytes at a time, and copy_name()
+    only looks at names more closely from there on.
+*/
+
+size_t name_scan_scalar( const char * name, size_t len )
+{
+    size_t i;
+
+    /* as signed, bytes >= 0x80 are below ' ' too */
+    for ( i = 0; i < len; i++ )
+        if ( (signed char)name[i] < ' ' || name[i] == 0x7f )
+            return i;
+    return len;
+}
+
+#ifdef NAME_SCAN_X86
+__attribute__((target("sse2")))
+size_t name_scan_sse2( const char * name, size_t len )
+{
+    const __m128i space = _mm_set1_epi8 ( ' ' );
+    const __m128i del = _mm_set1_epi8 ( 0x7f );
+    size_t i;
+    int mask;
+
+    for ( i = 0; i + 16 <= len; i += 16 )
     {
-        while ( node_ptr->next != NULL )
-        {
-             node_ptr = node_ptr->next;
-        }
-        node_ptr->next = new_node;
+        __m128i v = _mm_loadu_si128 ( (const __m128i *)( name + i ) );
+
+        mask = _mm_movemask_epi8 ( _mm_or_si128 (
+                   _mm_cmplt_epi8 ( v, space ), _mm_cmpeq_epi8 ( v, del ) ) );
+        if ( mask != 0 )
+            return i + __builtin_ctz ( mask );
     }
+    return i + name_scan_scalar ( name + i, len - i );
 }
 
-/*
-    get file_info list length
-*/
-
-int get_file_info_list_length ()
+__attribute__((target("avx2")))
+size_t name_scan_avx2( const char * name, size_t len )
 {
-    int len = 0;
-    struct file_info * ptr = file_info_list_head;
+    const __m256i space = _mm256_set1_epi8 ( ' ' );
+    const __m256i del = _mm256_set1_epi8 ( 0x7f );
+    size_t i;
+    unsigned mask;
 
-    while ( ptr != NULL )
+    for ( i = 0; i + 32 <= len; i += 32 )
     {
-        len++;
-        ptr = ptr->next;
+        __m256i v = _mm256_loadu_si256 ( (const __m256i *)( name + i ) );
+
+        mask = (unsigned)_mm256_movemask_epi8 ( _mm256_or_si256 (
+                   _mm256_cmpgt_epi8 ( space, v ),
+                   _mm256_cmpeq_epi8 ( v, del ) ) );
+        if ( mask != 0 )
+            return i + __builtin_ctz ( mask );
     }
-    return len;
+    return i + name_scan_sse2 ( name + i, len - i );
+}
+#endif
+
+void name_scan_select()
+{
+    g_name_scan = name_scan_scalar;
+#ifdef NAME_SCAN_X86
+    __builtin_cpu_init ();
+    if ( __builtin_cpu_supports ( "avx2" ) )
+        g_name_scan = name_scan_avx2;
+    else if ( __builtin_cpu_supports ( "sse2" ) )
+        g_name_scan = name_scan_sse2;
+#endif
 }
 
 /*
-    put out one file_info node info    
+    copy a name into a node's buffer of size bytes. With g_sanitize_names
+    characters which can't be printed in the locale are replaced by '?',
+    one for each byte; returns 1 if any were.
 */
-
-void print_with_proper_option(struct file_info * node_ptr)
+int copy_name( char * dst, size_t size, const char * name )
 {
-    if ( ! f_d_option )
+    size_t len = strlen ( name );
+    size_t i, o;
+    mbstate_t state;
+    wchar_t wc;
+    size_t n;
+    int replaced = 0;
+
+    if ( len >= size )
+        len = size - 1;
+
+    i = g_sanitize_names ? g_name_scan ( name, len ) : len;
+    memcpy ( dst, name, i );
+    o = i;
+
+    /* the rare name which needs a closer look */
+    memset ( &state, 0, sizeof(state) );
+    while ( i < len )
     {
-        if ( f_A_option )
+        unsigned char c = name[i];
+
+        if ( c >= ' ' && c != 0x7f && c < 0x80 )
         {
-            /* ignore . and .. */
-            if ( ! ( strcmp ( node_ptr->path_name, "." ) &&
-                     strcmp ( node_ptr->path_name, "..") ))
+            dst[o++] = c;
+            i++;
+            continue;
+        }
+
+        if ( c >= 0x80 && MB_CUR_MAX > 1 )
+        {
+            n = mbrtowc ( &wc, name + i, len - i, &state );
+            if ( n != (size_t)-1 && n != (size_t)-2 && n > 0 &&
+                 iswprint ( wc ) )
             {
-                return;
+                memcpy ( dst + o, name + i, n );
+                o += n;
+                i += n;
+                continue;
             }
+            memset ( &state, 0, sizeof(state) );
         }
-        else if ( ! f_a_option )
+        else if ( c >= 0x80 && isprint ( c ) )
         {
-            /* 
-                default output doesn't print file
-                whose names begin with a dot ('.') 
-            */ 
-            if ( node_ptr->path_name[0] == '.' )
-                return;
+            /* a single byte locale, Latin-1 say */
+            dst[o++] = c;
+            i++;
+            continue;
         }
+
+        dst[o++] = '?';
+        i++;
+        replaced = 1;
     }
+    dst[o] = '\0';
 
-    if ( f_i_option )
-        printf ( "%10ld ", node_ptr->inode_number );
+    return replaced;
+}
 
-    if ( f_s_option )
+/*
+    name pool
+
+    strings which live as long as the listing are cut from chunks of
+    NAME_POOL_CHUNK bytes instead of being malloc()ed one by one, and
+    are never freed
+*/
+
+char * name_pool_alloc( size_t size )
+{
+    char * p;
+
+    if ( size > NAME_POOL_CHUNK / 4 )
     {
-#ifdef ENABLE_H_OPTION
-        if ( f_h_option )
-        {
-            char szbuf[5];
-            if ( (humanize_number(szbuf,
-                    sizeof(szbuf), 
-                    (int64_t)node_ptr->number_of_blocks,
-                    "",
-                    HN_AUTOSCALE,
-                    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1 )
-            {
-                fprintf ( stderr, "humanize_number()" );
-                exit(1);
-            }
-            printf ( "%10s ", szbuf );
-        }
-        else if ( f_k_option )
+        p = malloc ( size );
+        if ( p == NULL )
         {
-            char szbuf[5];
-            if ( (humanize_number(szbuf,
-                    sizeof(szbuf), 
-                    (int64_t)node_ptr->number_of_blocks,
-                    "k",
-                    HN_AUTOSCALE,
-                    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1 )
-            {
-                fprintf ( stderr, "humanize_number()" );
-                exit(1);
-            }
-            printf ( "%10s ", szbuf );
-             
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
         }
-        else
-#endif
+        return p;
+    }
+
+    if ( size > g_name_pool_left )
+    {
+        g_name_pool = malloc ( NAME_POOL_CHUNK );
+        if ( g_name_pool == NULL )
         {
-            printf ( "%10lld ", node_ptr->number_of_blocks );
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
         }
+        g_name_pool_left = NAME_POOL_CHUNK;
     }
-   
-    /* long format flag is specified */
 
-    if ( f_l_option || f_n_option )
-    {
+    p = g_name_pool;
+    g_name_pool += size;
+    g_name_pool_left -= size;
+    return p;
+}
 
-        printf ( "%s ", node_ptr->type_permission_info );
-        
-        printf ( "%6d ",node_ptr->number_of_links );
-        
-        if ( f_l_option )
-            printf ( "%s ", node_ptr->owner_name );
-        else
-            printf ( "%ld ", node_ptr->user_id );
+char * name_pool_strdup( const char * str, size_t len )
+{
+    char * p = name_pool_alloc ( len + 1 );
 
-        if ( f_l_option )
-            printf ( "%s ", node_ptr->group_name );
-        else
-            printf ( "%ld ", node_ptr->group_id );
-
-#ifdef ENABLE_H_OPTION       
-        if ( f_h_option )
-        {
-            char szbuf[5];
-            if ( (humanize_number(szbuf,
-                    sizeof(szbuf), 
-                    (int64_t)node_ptr->number_of_bytes,
-                    "",
-                    HN_AUTOSCALE,
-                    (HN_DECIMAL | HN_B | HN_NOSPACE))) == -1 )
-            {
-                fprintf ( stderr, "humanize_number()" );
-                exit(1);
-            }
-            printf ( "%s ", szbuf );
-        }
-        else
-#endif
-            printf ( "%10d ", node_ptr->number_of_bytes );
+    memcpy ( p, str, len );
+    p[len] = '\0';
+    return p;
+}
 
-        if ( f_c_option )
-            printf ( "%s ", node_ptr->last_change_time );
-        else if ( f_u_option )
-            printf ( "%s ", node_ptr->last_access_time );
-        else
-            printf ( "%s ", node_ptr->last_modi_time );
-       
-        /* print path name */
-        printf ( "%s", node_ptr->path_name );
+/*
+    user and group names
 
-        if ( f_F_option )
-        {
-            if ( node_ptr->file_type != ' ' )
-                printf ( "%c ", node_ptr->file_type );
-        }
-       
-        /* if the file is a symbolic link, the pathname of the 
-           linked-to file is preceded by "->" */
-        if ( node_ptr->file_type == '@' )
-        {
-            char link_path [100];
-            
-            int ret = readlink ( node_ptr->path_name, link_path,
-                sizeof(link_path)/sizeof(link_path[0]) );
-            if ( ret == -1 )
-            {
-                fprintf ( stderr, "readlink() error : %s\n",
-                    strerror ( errno ) );
-                exit(1);
-            }
-            printf ( "-> %s ", link_path ); 
-        }
-    
-        /* list one entry per line to standard output */
-        if ( isatty (1) || f_1_option || !isatty (1) )
-            printf ( "\n" );
+    every entry of -l needs two, and most directories have a handful of
+    owners : each id is looked up once, with its answer kept in a table
+    of ids ( a missing name too )
+*/
+
+/* the slot of id, or the free one it would go in */
+struct owner_slot * owner_cache_slot( struct owner_cache * cp,
+                                      unsigned long id )
+{
+    size_t h;
+
+    for ( h = id * 0x9e3779b97f4a7c15ULL;
+          cp->slots[h & ( cp->size - 1 )].used; h++ )
+    {
+        if ( cp->slots[h & ( cp->size - 1 )].id == id )
+            break;
     }
-    /* 
-        short output format
-    */
-    else 
+    return &cp->slots[h & ( cp->size - 1 )];
+}
+
+void owner_cache_put( struct owner_cache * cp, unsigned long id,
+                      const char * name )
+{
+    struct owner_slot * old = cp->slots, * sp;
+    size_t old_size = cp->size, i;
+
+    /* at most half full, doubled and rehashed past that */
+    if ( ( cp->count + 1 ) * 2 > cp->size )
     {
-        printf ( "%s", node_ptr->path_name );
-        if ( f_F_option )
-        {
-            if ( node_ptr->file_type != ' ' )
-                printf ( "%c", node_ptr->file_type );
-        }  
-        
-        /* -x */
-        if ( f_x_option )
-        {
-            char * columns_str = "COLUMNS";
-            char * columns;
-            int col = 0;
-            
-            /* get environment variable COLUMNS */
-            columns = getenv ( columns_str );
-            if ( NULL == columns )
-            {
-                col = COLUMNS;
-            }
-            else
-            {
-                col = atoi ( columns );
-            }
-            
-            if ( (g_print_count-1) % col == 0 )
-            {
-                printf ( "\n" ); 
-            }
-            else
-            {
-                printf ( "\t" );
-            }
-        }
-        else
+        cp->size = old_size ? old_size * 2 : 64;
+        cp->slots = calloc ( cp->size, sizeof(struct owner_slot) );
+        if ( cp->slots == NULL )
         {
-            /* list one entry per line to standard output */
-            if ( isatty (1) || f_1_option || !isatty (1) )
-                printf ( "\n" );
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
         }
+        for ( i = 0; i < old_size; i++ )
+            if ( old[i].used )
+                *owner_cache_slot ( cp, old[i].id ) = old[i];
+        free ( old );
     }
+
+    sp = owner_cache_slot ( cp, id );
+    if ( ! sp->used )
+        cp->count++;
+    sp->id = id;
+    sp->name = name ? name_pool_strdup ( name, strlen ( name ) ) : NULL;
+    sp->used = 1;
 }
 
-/*
-    out put every node of file_info list 
-*/
+const char * user_name( uid_t uid )
+{
+    struct passwd * password;
+    struct owner_slot * sp;
 
-void print_file_info_list()
+    if ( g_users.size )
+    {
+        sp = owner_cache_slot ( &g_users, uid );
+        if ( sp->used )
+            return sp->name;
+    }
+    g_stats.nss_lookups++;
+    password = getpwuid ( uid );
+    owner_cache_put ( &g_users, uid, password ? password->pw_name : NULL );
+    return owner_cache_slot ( &g_users, uid )->name;
+}
+
+const char * group_name( gid_t gid )
 {
-    /* 
-        -w
-    */
-    if ( f_w_option || !isatty(1) )
+    struct group * group;
+    struct owner_slot * sp;
+
+    if ( g_groups.size )
     {
-        /* */
+        sp = owner_cache_slot ( &g_groups, gid );
+        if ( sp->used )
+            return sp->name;
     }
+    g_stats.nss_lookups++;
+    group = getgrgid ( gid );
+    owner_cache_put ( &g_groups, gid, group ? group->gr_name : NULL );
+    return owner_cache_slot ( &g_groups, gid )->name;
+}
 
-    /* 
-        sort the file_info list if needed
-    */
+/* every user and group there is, for --server to start with; the
+   first entry of an id wins, as with getpwuid() */
+void owner_cache_fill()
+{
+    struct passwd * password;
+    struct group * group;
+
+    setpwent ();
+    while ( ( password = getpwent () ) != NULL )
+        if ( ! g_users.size ||
+             ! owner_cache_slot ( &g_users, password->pw_uid )->used )
+            owner_cache_put ( &g_users, password->pw_uid,
+                              password->pw_name );
+    endpwent ();
+
+    setgrent ();
+    while ( ( group = getgrent () ) != NULL )
+        if ( ! g_groups.size ||
+             ! owner_cache_slot ( &g_groups, group->gr_gid )->used )
+            owner_cache_put ( &g_groups, group->gr_gid, group->gr_name );
+    endgrent ();
+}
+
+/*
+    symbolic link targets
+
+    are read in the collection stage, so that printing never waits on
+    the file system : relative to the directory's fd with readlinkat(),
+    into a buffer of exactly the size lstat() reported. Directories
+    full of links have them read by several threads at once.
+*/
+
+/* only -l / -n print link targets; --format and --cache keep them */
+int link_targets_wanted()
+{
+    return f_l_option || f_n_option || f_format_option || f_cache_option;
+}
+
+/* read one link, name relative to dir_fd, returns -1 and errno on error */
+int read_link_target( int dir_fd, const char * name,
+                      struct file_info * node )
+{
+    size_t size = node->stat_info.st_size + 1;
+    char link_path [PATH_MAX];
+    char * buf;
+    ssize_t ret;
 
-    if ( ! f_f_option )
+    if ( size > 1 && size <= sizeof(link_path) )
     {
-        if ( f_t_option )
+        buf = name_pool_alloc ( size );
+        ret = timed_readlinkat ( dir_fd, name, buf, size );
+        if ( ret < 0 )
+            return -1;
+        if ( (size_t)ret < size )
         {
-            if ( ! f_r_option )
-                file_info_list_head = sort_by_time_modi_desc ( file_info_list_head );
-            else
-                file_info_list_head = sort_by_time_modi_asce ( file_info_list_head );
+            buf [ret] = '\0';
+            node->link_target = buf;
+            return 0;
         }
-        else if ( f_S_option )
+    }
+
+    /* st_size was 0 ( /proc ) or the link was replaced since lstat() */
+    ret = timed_readlinkat ( dir_fd, name, link_path, sizeof(link_path) - 1 );
+    if ( ret < 0 )
+        return -1;
+    node->link_target = name_pool_strdup ( link_path, ret );
+    return 0;
+}
+
+/*
+    a thread of link_batch_parallel(). The nodes' link_target already
+    point at their buffers; those which don't fit are set back to NULL
+    and read again afterwards.
+*/
+void * link_batch_run( void * arg )
+{
+    struct link_batch * bp = arg;
+    struct file_info * node;
+    long long t = 0, d;
+    ssize_t ret;
+    size_t i;
+
+    for ( i = 0; i < bp->count; i++ )
+    {
+        node = bp->nodes[i];
+        if ( node->link_target == NULL )
+            continue;
+
+        /* into the batch's own histogram, merged after the join */
+        if ( f_latency_option )
+            t = stats_now ();
+        ret = readlinkat ( bp->dir_fd, node->path_name, node->link_target,
+                           node->stat_info.st_size + 1 );
+        if ( f_latency_option )
         {
-            if ( ! f_r_option )
-                file_info_list_head = sort_by_size_desc ( file_info_list_head );
-            else
-                file_info_list_head = sort_by_size_asce ( file_info_list_head );
+            d = stats_now () - t;
+            lat_hist_add ( &bp->hist, d );
+            bp->ns += d;
         }
+        if ( ret >= 0 && ret <= node->stat_info.st_size )
+            node->link_target [ret] = '\0';
         else
+            node->link_target = NULL;
+    }
+    return NULL;
+}
+
+void link_batch_parallel( int dir_fd, struct file_info ** links,
+                          size_t count )
+{
+    struct link_batch batches [LINK_THREADS_MAX];
+    pthread_t threads [LINK_THREADS_MAX];
+    int started [LINK_THREADS_MAX];
+    long nthreads = sysconf ( _SC_NPROCESSORS_ONLN );
+    size_t total = 0, i, per;
+    long long t;
+    char * buf;
+    int k;
+
+    if ( nthreads > LINK_THREADS_MAX )
+        nthreads = LINK_THREADS_MAX;
+    if ( nthreads < 1 )
+        nthreads = 1;
+
+    /* one buffer for all the targets, cut at their sizes */
+    for ( i = 0; i < count; i++ )
+        if ( links[i]->stat_info.st_size > 0 &&
+             links[i]->stat_info.st_size < PATH_MAX )
+            total += links[i]->stat_info.st_size + 1;
+    buf = name_pool_alloc ( total );
+    for ( i = 0; i < count; i++ )
+    {
+        if ( links[i]->stat_info.st_size > 0 &&
+             links[i]->stat_info.st_size < PATH_MAX )
         {
-            if ( ! f_r_option )
-                file_info_list_head = sort_by_lexi ( file_info_list_head );
-            else
-                file_info_list_head = sort_by_lexi_rev ( file_info_list_head );                          
+            links[i]->link_target = buf;
+            buf += links[i]->stat_info.st_size + 1;
         }
     }
 
-    /*
-        get a total sum for all the file sizes ( blocks )
-        -l -n -s
-    */
+    STATS_START ( t );
+    per = ( count + nthreads - 1 ) / nthreads;
+    memset ( batches, 0, sizeof(batches) );
+    for ( k = 0; k < nthreads; k++ )
+    {
+        batches[k].dir_fd = dir_fd;
+        batches[k].nodes = links + k * per;
+        batches[k].count = k * per >= count ? 0 :
+            ( count - k * per < per ? count - k * per : per );
+
+        /* without a thread, the batch is read here */
+        started[k] = pthread_create ( &threads[k], NULL, link_batch_run,
+                                      &batches[k] ) == 0;
+        if ( ! started[k] )
+            link_batch_run ( &batches[k] );
+    }
+    for ( k = 0; k < nthreads; k++ )
+        if ( started[k] )
+            pthread_join ( threads[k], NULL );
+    STATS_STOP ( readlink, t );
+    g_stats.readlink_calls += count;
+
+    if ( f_latency_option )
+        for ( k = 0; k < nthreads; k++ )
+            lat_record_hist ( LAT_READLINK, &batches[k].hist,
+                              batches[k].ns );
+}
 
-    struct file_info * ptr = file_info_list_head;
-    unsigned long long sum = 0;
-    if ( ! f_d_option )
-    { 
-        if ( f_l_option || f_n_option || ( f_s_option && isatty (1) ) )
+/*
+    read the targets of the symbolic links just recorded, relative to
+    dir_fd ( AT_FDCWD too ), or with dir_fd -1 to dir_path, which is
+    opened if there are any
+*/
+void resolve_link_targets( int dir_fd, const char * dir_path )
+{
+    struct file_info * node_ptr;
+    struct file_info ** links = NULL;
+    size_t count = 0, alloc = 0, i;
+    int opened = -1;
+
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = node_ptr->next )
+    {
+        if ( ! S_ISLNK ( node_ptr->stat_info.st_mode ) ||
+             node_ptr->link_target != NULL || node_ptr->name_sanitized )
+            continue;
+
+        if ( count == alloc )
         {
-            while ( ptr != NULL )
+            alloc = alloc ? alloc * 2 : 64;
+            links = realloc ( links, alloc * sizeof(*links) );
+            if ( links == NULL )
             {
-                if ( f_A_option )
-                {
-                    /* ignore . and .. */
-                    if ( ! ( strcmp ( ptr->path_name, "." ) &&
-                             strcmp ( ptr->path_name, "..") ))
-                    {
-                        sum += 0;
-                        ptr = ptr->next;
-                    }
-                    else
-                    {
-                        sum += ptr->number_of_blocks;  
-                        ptr = ptr->next;
-                    }
-
-                }
-                else if ( ! f_a_option )
-                {
-                    /* 
-                        default output doesn't print file
-                        whose names begin with a dot ('.') 
-                    */ 
-                    if ( ptr->path_name[0] == '.' )
-                    {
-                        sum += 0;
-                        ptr = ptr->next;
-                    }
-                    else
-                    {
-                        sum += ptr->number_of_blocks;  
-                        ptr = ptr->next;
-                    }
-                }
-                else
-                {
-                    sum += ptr->number_of_blocks;  
-                    ptr = ptr->next;
-                }
+                fprintf ( stderr, "malloc() error\n" );
+                exit (1);
             }
-
-            printf ( "total %lld\n", sum );
         }
+        links[count++] = node_ptr;
     }
 
-    /*
-        out put every node
+    if ( count == 0 )
+        return;
+
+    if ( dir_fd < 0 && dir_fd != AT_FDCWD )
+    {
+        opened = open ( dir_path, O_RDONLY | O_DIRECTORY );
+        if ( opened < 0 )
+        {
+            fprintf ( stderr, "can't open '%s': %s\n", dir_path,
+                strerror ( errno ) );
+            free ( links );
+            return;
+        }
+        dir_fd = opened;
+    }
+
+    if ( count >= LINK_THREAD_MIN )
+        link_batch_parallel ( dir_fd, links, count );
+
+    /* all of them, or those the threads could not fit */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( links[i]->link_target == NULL &&
+             read_link_target ( dir_fd, links[i]->path_name, links[i] ) < 0 )
+            fprintf ( stderr, "can't read link '%s': %s\n",
+                links[i]->path_name, strerror ( errno ) );
+    }
+
+    if ( opened >= 0 )
+        close ( opened );
+    free ( links );
+}
+
+/*
+    fill a file_info node with the fields --format puts out, and the
+    ones sorting and hiding dot files look at
+*/
+
+void record_raw_stat( struct file_info * new_node, struct stat * statp,
+                      char * path_name )
+{
+    new_node->inode_number = statp->st_ino;
+    new_node->number_of_bytes = statp->st_size;
+    new_node->number_of_blocks = statp->st_blocks;
+    new_node->a_time = statp->st_atime;
+    new_node->m_time = statp->st_mtime;
+    new_node->c_time = statp->st_ctime;
+    strlcpy ( new_node->path_name, path_name, sizeof(new_node->path_name) );
+}
+
+/*
+    st_blocks ( 512 bytes ) in the units of the environment variable
+    BLOCKSIZE, which is read once
+*/
+
+unsigned long long display_blocks( unsigned long long st_blocks )
+{
+    static unsigned long long n = 0;
+    char * blocksize_str;
+
+    if ( n == 0 )
+    {
+        /* ENV BLOCKSIZE is not set, so use default value */
+        n = 1;
+        blocksize_str = getenv ( "BLOCKSIZE" );
+        if ( blocksize_str != NULL && strtoll ( blocksize_str, NULL, 0 ) >= 512 )
+            n = strtoll ( blocksize_str, NULL, 0 ) / 512;
+    }
+    return st_blocks / n;
+}
+
+/*
+    add new node into list 
+*/
+
+void append_file_info( struct file_info * new_node )
+{
+    if ( file_info_list_head == NULL )
+        file_info_list_head = new_node;
+    else
+        file_info_list_tail->next = new_node;
+    file_info_list_tail = new_node;
+    g_list_count++;
+    if ( ! skip_entry ( new_node ) &&
+         ! counted_before ( &g_links_listed, &new_node->stat_info ) )
+        g_list_blocks += new_node->number_of_blocks;
+}
+
+/*
+    RE-initialize head of file_info linked list 
+*/
+
+void reset_file_info_list()
+{
+    file_info_list_head = NULL;
+    file_info_list_tail = NULL;
+    g_list_sorted = 0;
+    g_list_count = 0;
+    g_list_blocks = 0;
+}
+
+/*
+    get file_info list length
+*/
+
+int get_file_info_list_length ()
+{
+    int len = 0;
+    struct file_info * ptr = file_info_list_head;
+
+    while ( ptr != NULL )
+    {
+        len++;
+        ptr = ptr->next;
+    }
+    return len;
+}
+
+/*
+    whether a node is hidden by -A / -a ( never with -d )
+*/
+
+int skip_entry( struct file_info * node_ptr )
+{
+    if ( f_d_option )
+        return 0;
+
+    if ( f_A_option )
+    {
+        /* ignore . and .. */
+        return ! ( strcmp ( node_ptr->path_name, "." ) &&
+                   strcmp ( node_ptr->path_name, ".." ) );
+    }
+    else if ( ! f_a_option )
+    {
+        /* 
+            default output doesn't print file
+            whose names begin with a dot ('.') 
+        */ 
+        return node_ptr->path_name[0] == '.';
+    }
+    return 0;
+}
+
+/*
+    the columns of the listing, without printf()
+*/
+
+/* "%*lld" */
+void out_int_width( long long n, int width )
+{
+    char buf [FMT_INT_MAX + 32];
+
+    if ( width > 32 )
+        width = 32;
+    out_write ( buf, fmt_int_width ( buf, n, width ) );
+}
+
+/* "%*s" */
+void out_str_width( const char * str, int width )
+{
+    size_t len = strlen ( str );
+
+    for ( ; width > (int)len; width-- )
+        out_putc ( ' ' );
+    out_write ( str, len );
+}
+
+/* -h -k, humanize_number() into 5 bytes as BSD ls does, "%*s" */
+void out_human( long long n, const char * suffix, int width )
+{
+    char szbuf [5];
+
+    if ( fmt_humanize ( szbuf, sizeof(szbuf), (int64_t)n, suffix,
+                        FMT_HN_AUTOSCALE,
+                        FMT_HN_DECIMAL | FMT_HN_B | FMT_HN_NOSPACE ) == -1 )
+    {
+        /* a render thread leaves exiting to print_parallel() */
+        if ( g_render != NULL )
+        {
+            g_render->error = "humanize_number()";
+            return;
+        }
+        fprintf ( stderr, "humanize_number()" );
+        exit(1);
+    }
+    out_str_width ( szbuf, width );
+}
+
+/*
+    the -l and -n columns and the name, as libls makes them for
+    ls_format(), into the output
+*/
+void out_long( struct file_info * node_ptr, int numeric, int human,
+               int type )
+{
+    struct ls_options options = { 0 };
+    struct ls_entry entry;
+    char line [LS_LINE_MAX];
+
+    options.flags = ( human ? LS_HUMAN : 0 ) | ( type ? LS_TYPE : 0 );
+    options.time = g_row_time;
+
+    entry.name = node_ptr->path_name;
+    entry.link_target = node_ptr->file_type == '@' ?
+        node_ptr->link_target : NULL;
+    entry.user = numeric ? NULL : node_ptr->owner_name;
+    entry.group = numeric ? NULL : node_ptr->group_name;
+    entry.st = node_ptr->stat_info;
+
+    out_write ( line, ls_format_entry ( &options, &entry, line,
+                                        sizeof(line) ) );
+}
+
+/*
+    put out one file_info node info    
+*/
+
+void print_with_proper_option(struct file_info * node_ptr)
+{
+    if ( skip_entry ( node_ptr ) )
+        return;
+
+    if ( f_i_option )
+    {
+        out_int_width ( node_ptr->inode_number, 10 );
+        out_putc ( ' ' );
+    }
+
+    if ( f_s_option )
+    {
+#ifdef ENABLE_H_OPTION
+        if ( f_h_option || f_k_option )
+            out_human ( node_ptr->number_of_blocks, f_h_option ? "" : "k",
+                        10 );
+        else
+#endif
+            out_int_width ( node_ptr->number_of_blocks, 10 );
+        out_putc ( ' ' );
+    }
+   
+    /* long format flag is specified */
+
+    if ( f_l_option || f_n_option )
+    {
+        int human = 0;
+
+#ifdef ENABLE_H_OPTION
+        human = f_h_option != 0;
+#endif
+        out_long ( node_ptr, ! f_l_option, human, f_F_option );
+
+        /* list one entry per line to standard output */
+        if ( isatty (1) || f_1_option || !isatty (1) )
+            out_printf ( "\n" );
+    }
+    /* 
+        short output format
     */
+    else 
+    {
+        out_printf ( "%s", node_ptr->path_name );
+        if ( f_F_option )
+        {
+            if ( node_ptr->file_type != ' ' )
+                out_printf ( "%c", node_ptr->file_type );
+        }  
+        
+        /* -x */
+        if ( f_x_option )
+        {
+            char * columns_str = "COLUMNS";
+            char * columns;
+            int col = 0;
+            
+            /* get environment variable COLUMNS */
+            columns = getenv ( columns_str );
+            if ( NULL == columns )
+            {
+                col = COLUMNS;
+            }
+            else
+            {
+                col = atoi ( columns );
+            }
+            
+            if ( (g_print_count-1) % col == 0 )
+            {
+                out_printf ( "\n" ); 
+            }
+            else
+            {
+                out_printf ( "\t" );
+            }
+        }
+        else
+        {
+            /* list one entry per line to standard output */
+            if ( isatty (1) || f_1_option || !isatty (1) )
+                out_printf ( "\n" );
+        }
+    }
+}
+
+/*
+    row renderers
+
+    print_with_proper_option() tests every option for every row.
+    print_row() is the same row with the options as parameters; each
+    combination ROW_RENDERERS lists gets a copy of it with them as
+    constants, so the compiler drops the columns which aren't asked for
+    and the tests with them, and select_row_renderer() picks the copy
+    for the options given, once.
+*/
+
+/* which names a renderer hides, as skip_entry() does */
+#define ROW_HIDE_NONE       0       /* -a, -d */
+#define ROW_HIDE_DOTS       1       /* -A : . and .. */
+#define ROW_HIDE_DOTFILES   2       /* names starting with '.' */
+
+/* the -s column */
+#define ROW_BLOCKS_NONE     0
+#define ROW_BLOCKS          1
+#define ROW_BLOCKS_HUMAN    2       /* -h or -k */
+
+/* the format */
+#define ROW_SHORT           0
+#define ROW_LONG            1       /* -l */
+#define ROW_NUMERIC         2       /* -n */
+
+/*
+    the renderers, each of hide, inode ( -i ), blocks, format, human
+    ( -h for the size ) and type ( -F ); X is called with every
+    combination, in the order ROW_INDEX numbers them
+*/
+#define ROW_FOR_TYPE(X, h, i, b, f, u)  X ( h, i, b, f, u, 0 ) \
+                                        X ( h, i, b, f, u, 1 )
+#define ROW_FOR_HUMAN(X, h, i, b, f)    ROW_FOR_TYPE ( X, h, i, b, f, 0 ) \
+                                        ROW_FOR_TYPE ( X, h, i, b, f, 1 )
+#define ROW_FOR_FORMAT(X, h, i, b)      ROW_FOR_HUMAN ( X, h, i, b, 0 ) \
+                                        ROW_FOR_HUMAN ( X, h, i, b, 1 ) \
+                                        ROW_FOR_HUMAN ( X, h, i, b, 2 )
+#define ROW_FOR_BLOCKS(X, h, i)         ROW_FOR_FORMAT ( X, h, i, 0 ) \
+                                        ROW_FOR_FORMAT ( X, h, i, 1 ) \
+                                        ROW_FOR_FORMAT ( X, h, i, 2 )
+#define ROW_FOR_INODE(X, h)             ROW_FOR_BLOCKS ( X, h, 0 ) \
+                                        ROW_FOR_BLOCKS ( X, h, 1 )
+#define ROW_RENDERERS(X)                ROW_FOR_INODE ( X, 0 ) \
+                                        ROW_FOR_INODE ( X, 1 ) \
+                                        ROW_FOR_INODE ( X, 2 )
+
+#define ROW_INDEX(h, i, b, f, u, t) \
+    ( ( ( ( ( (h) * 2 + (i) ) * 3 + (b) ) * 3 + (f) ) * 2 + (u) ) * 2 + (t) )
+
+/* "%s" */
+#define out_str(str)    out_write ( (str), strlen ( str ) )
+
+inline __attribute__((always_inline))
+void print_row( struct file_info * node_ptr, int hide, int inode, int blocks,
+                int format, int human, int type )
+{
+    if ( hide == ROW_HIDE_DOTS && node_ptr->path_name[0] == '.' &&
+         ( node_ptr->path_name[1] == '\0' || ( node_ptr->path_name[1] == '.'
+           && node_ptr->path_name[2] == '\0' ) ) )
+        return;
+    if ( hide == ROW_HIDE_DOTFILES && node_ptr->path_name[0] == '.' )
+        return;
+
+    if ( inode )
+    {
+        out_int_width ( node_ptr->inode_number, 10 );
+        out_putc ( ' ' );
+    }
+
+    if ( blocks == ROW_BLOCKS_HUMAN )
+    {
+        out_human ( node_ptr->number_of_blocks, g_row_block_suffix, 10 );
+        out_putc ( ' ' );
+    }
+    else if ( blocks == ROW_BLOCKS )
+    {
+        out_int_width ( node_ptr->number_of_blocks, 10 );
+        out_putc ( ' ' );
+    }
+
+    if ( format == ROW_SHORT )
+    {
+        out_str ( node_ptr->path_name );
+        if ( type && node_ptr->file_type != ' ' )
+            out_putc ( node_ptr->file_type );
+        out_putc ( '\n' );
+        return;
+    }
+
+    out_long ( node_ptr, format == ROW_NUMERIC, human, type );
+    out_putc ( '\n' );
+}
+
+#define ROW_DEFINE(h, i, b, f, u, t) \
+    void print_row_##h##i##b##f##u##t( struct file_info * node_ptr ) \
+    { \
+        print_row ( node_ptr, h, i, b, f, u, t ); \
+    }
+#define ROW_ENTRY(h, i, b, f, u, t)     print_row_##h##i##b##f##u##t,
+
+ROW_RENDERERS ( ROW_DEFINE )
+
+row_renderer g_row_renderers [] = { ROW_RENDERERS ( ROW_ENTRY ) };
+
+/* once the options are known, and again if one changes */
+void select_row_renderer()
+{
+    int hide, blocks, format, human = 0;
+
+    if ( f_c_option )
+        g_row_time = LS_TIME_CHANGE;
+    else if ( f_u_option )
+        g_row_time = LS_TIME_ACCESS;
+    else
+        g_row_time = LS_TIME_MODIFY;
+
+    /* -x numbers its rows, --renderer=generic asks for the slow path */
+    if ( f_x_option || f_renderer_option == RENDERER_GENERIC )
+    {
+        g_print_row = print_with_proper_option;
+        return;
+    }
+
+    if ( f_d_option )
+        hide = ROW_HIDE_NONE;
+    else if ( f_A_option )
+        hide = ROW_HIDE_DOTS;
+    else if ( ! f_a_option )
+        hide = ROW_HIDE_DOTFILES;
+    else
+        hide = ROW_HIDE_NONE;
+
+    blocks = f_s_option ? ROW_BLOCKS : ROW_BLOCKS_NONE;
+#ifdef ENABLE_H_OPTION
+    if ( f_s_option && ( f_h_option || f_k_option ) )
+        blocks = ROW_BLOCKS_HUMAN;
+    g_row_block_suffix = f_h_option ? "" : "k";
+    human = f_h_option != 0;
+#endif
+
+    if ( f_l_option )
+        format = ROW_LONG;
+    else if ( f_n_option )
+        format = ROW_NUMERIC;
+    else
+        format = ROW_SHORT;
+
+    g_print_row = g_row_renderers [ROW_INDEX ( hide, f_i_option != 0, blocks,
+        format, format != ROW_SHORT && human, f_F_option != 0 )];
+}
+
+/*
+    the rows of a big listing are printed by threads, RENDER_CHUNK at a
+    time, each chunk into a buffer of its own ( g_render, which the out_
+    functions append to ). This thread writes the chunks out in order as
+    they are done, and a thread only starts a chunk once there is a
+    buffer free for it, so at most window chunks are held at once
+    whatever the size of the listing.
+*/
+
+/* room for len more bytes; -1 and the error kept in rp if there isn't */
+int render_reserve( struct render_buf * rp, size_t len )
+{
+    size_t alloc = rp->alloc ? rp->alloc : OUT_BUF_SIZE;
+    char * data;
+
+    if ( rp->len + len <= rp->alloc )
+        return 0;
+    while ( alloc < rp->len + len )
+        alloc *= 2;
+    data = realloc ( rp->data, alloc );
+    if ( data == NULL )
+    {
+        rp->error = "malloc() error\n";
+        return -1;
+    }
+    rp->data = data;
+    rp->alloc = alloc;
+    return 0;
+}
+
+void * render_run( void * arg )
+{
+    struct render_queue * qp = arg;
+    struct render_buf * rp;
+    struct file_info * node;
+    size_t n;
+
+    pthread_mutex_lock ( &qp->lock );
+    for ( ;; )
+    {
+        while ( qp->left > 0 && qp->taken >= qp->written + qp->window )
+            pthread_cond_wait ( &qp->cond, &qp->lock );
+        if ( qp->left == 0 )
+            break;
+
+        /* take the next chunk of the list */
+        rp = &qp->bufs[qp->taken++ % qp->window];
+        node = qp->next;
+        for ( n = 0; n < RENDER_CHUNK && qp->left > 0; n++, qp->left-- )
+            qp->next = qp->next->next;
+        pthread_mutex_unlock ( &qp->lock );
+
+        g_render = rp;
+        for ( ; n > 0; n--, node = node->next )
+            g_print_row ( node );
+        g_render = NULL;
+
+        pthread_mutex_lock ( &qp->lock );
+        rp->ready = 1;
+        pthread_cond_broadcast ( &qp->cond );
+    }
+    pthread_mutex_unlock ( &qp->lock );
+    return NULL;
+}
+
+void print_parallel( int nthreads )
+{
+    pthread_t threads [PARALLEL_THREADS_MAX];
+    int started [PARALLEL_THREADS_MAX];
+    struct render_queue queue;
+    struct render_buf * rp;
+    struct file_info * node;
+    const char * error = NULL;
+    size_t chunks, c;
+    int k, nstarted = 0;
+
+    memset ( &queue, 0, sizeof(queue) );
+    pthread_mutex_init ( &queue.lock, NULL );
+    pthread_cond_init ( &queue.cond, NULL );
+    queue.next = file_info_list_head;
+    queue.left = g_list_count;
+    queue.window = nthreads * RENDER_AHEAD;
+    queue.bufs = calloc ( queue.window, sizeof(*queue.bufs) );
+    if ( queue.bufs == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    chunks = ( queue.left + RENDER_CHUNK - 1 ) / RENDER_CHUNK;
+
+    for ( k = 0; k < nthreads; k++ )
+    {
+        started[k] = pthread_create ( &threads[k], NULL, render_run,
+                                      &queue ) == 0;
+        nstarted += started[k];
+    }
+
+    /* without a thread, the rows are printed here */
+    if ( nstarted == 0 )
+    {
+        for ( node = file_info_list_head; node != NULL && queue.left > 0;
+              node = node->next, queue.left-- )
+            g_print_row ( node );
+        chunks = 0;
+    }
+
+    for ( c = 0; c < chunks; c++ )
+    {
+        rp = &queue.bufs[c % queue.window];
+
+        pthread_mutex_lock ( &queue.lock );
+        while ( ! rp->ready )
+            pthread_cond_wait ( &queue.cond, &queue.lock );
+
+        /* a thread failed : no more chunks are taken, and once the
+           threads are done this one exits for it */
+        if ( rp->error != NULL )
+        {
+            error = rp->error;
+            queue.left = 0;
+            pthread_cond_broadcast ( &queue.cond );
+            pthread_mutex_unlock ( &queue.lock );
+            break;
+        }
+        pthread_mutex_unlock ( &queue.lock );
+
+        out_write ( rp->data, rp->len );
+
+        pthread_mutex_lock ( &queue.lock );
+        rp->ready = 0;
+        rp->len = 0;
+        queue.written++;
+        pthread_cond_broadcast ( &queue.cond );
+        pthread_mutex_unlock ( &queue.lock );
+    }
+
+    for ( k = 0; k < nthreads; k++ )
+        if ( started[k] )
+            pthread_join ( threads[k], NULL );
+    for ( c = 0; c < queue.window; c++ )
+        free ( queue.bufs[c].data );
+    free ( queue.bufs );
+    pthread_cond_destroy ( &queue.cond );
+    pthread_mutex_destroy ( &queue.lock );
+
+    if ( error != NULL )
+    {
+        fprintf ( stderr, "%s", error );
+        exit (1);
+    }
+}
+
+/*
+    out put every node of file_info list 
+*/
+
+void print_file_info_list()
+{
+    long long t_print, write_ns;
+    int nthreads;
+
+    g_stats.directories++;
+
+    /* 
+        -w
+    */
+    if ( f_w_option || !isatty(1) )
+    {
+        /* */
+    }
+
+    /* 
+        sort the file_info list if needed
+    */
+
+    if ( ! g_list_sorted )
+        sort_file_info_list ();
+
+    /* --stats : printing, less the time spent in write(2) */
+    STATS_START ( t_print );
+    write_ns = g_stats.write_ns;
+
+    /*
+        get a total sum for all the file sizes ( blocks )
+        -l -n -s
+    */
+
+    /* --format puts out raw records, without totals or columns */
+    if ( f_format_option )
+    {
+        print_machine_list ();
+        STATS_STOP ( print, t_print + ( g_stats.write_ns - write_ns ) );
+        return;
+    }
+
+    /* the sum was kept by append_file_info() */
+    if ( ! f_d_option )
+    { 
+        if ( f_l_option || f_n_option || ( f_s_option && isatty (1) ) )
+            out_printf ( "total %lld\n", g_list_blocks );
+        if ( f_du_option && g_du_current >= 0 )
+        {
+            du_print_totals ( &g_du_dirs[g_du_current] );
+            g_du_current = -1;
+        }
+    }
+
+    /*
+        out put every node
+    */
+
+    struct file_info * node_ptr = file_info_list_head;
+    
+    /* --- process -C --- */
+    if ( f_C_option )
+    {
+        /* 1. create a matrix */
+
+        char * columns_str = "COLUMNS"; 
+        char * columns;
+        int col = 0;
+        int row = 0;
+        int file_info_list_len = get_file_info_list_length();
+        columns = getenv ( columns_str );
+        if ( NULL == columns )
+        {
+            col = COLUMNS;
+        }
+        else
+        {
+            col = atoi ( columns );
+        }
+        row = file_info_list_len/col;
+
+        int c = 0, r = 0;
+
+        /* the loops below go up to row and col, both included */
+        struct file_info * matrix [row + 1][col + 1];
+        memset ( matrix, 0, sizeof(matrix) );
+#ifdef DEBUG
+        out_printf ( "\n### row = %d, col = %d\n", row, col );
+#endif       
+        
+        /* 2. fill the matrix */
+
+        int i = 0;
+        for ( c = 0; c <= col; c++ )
+        {
+            for ( r = 0; r <= row; r++ )
+            {
+                i++;
+                if ( (node_ptr != NULL) && (i <= file_info_list_len) )
+                {
+                    matrix [r][c] = node_ptr;
+#ifdef DEBUG
+                    out_printf ( "## %s\n", node_ptr->path_name );
+#endif            
+                    node_ptr = node_ptr->next;
+                }
+            }
+        }
+        
+        /* 3. output matrix column by column */
+        i = 0;
+        for ( r = 0; r <= row; r++ )
+        {
+            for ( c = 0; c <= col; c++ )
+            {
+                i++;
+                if ( i <= file_info_list_len )
+                {
+                    struct file_info * p = matrix [r][c];
+                    out_printf ( "%20s", p != NULL ? p->path_name : "" );
+                }
+            }
+            out_printf ( "\n" );
+        }
+    }
+    /* --- end of -C --- */
+    else
+    {
+        g_print_count = 0;
+        
+        /* -x counts the rows as it goes, so it is printed here */
+        nthreads = f_x_option ? 1 : parallel_threads ( g_list_count );
+        if ( nthreads > 1 )
+            print_parallel ( nthreads );
+
+        while ( nthreads == 1 && node_ptr != NULL )
+        {
+            g_print_row ( node_ptr );
+            node_ptr = node_ptr->next;
+            g_print_count ++;
+        }
+
+        if ( f_x_option )
+        {
+            /* after the last file, print a newline */
+            out_printf ( "\n" );
+        }
+    }
+
+    STATS_STOP ( print, t_print + ( g_stats.write_ns - write_ns ) );
+}
+
+/*
+    --format output
+
+    no printf() here: numbers are converted by hand and names are
+    copied straight into the output buffer.
+*/
+
+void out_uint( unsigned long long n )
+{
+    char buf [FMT_INT_MAX];
+
+    out_write ( buf, fmt_uint ( buf, n ) );
+}
+
+void out_int( long long n )
+{
+    char buf [FMT_INT_MAX];
+
+    out_write ( buf, fmt_int ( buf, n ) );
+}
+
+/*
+    the length of the well-formed UTF-8 sequence str starts with, 0 if
+    it doesn't start one : no overlong forms, surrogates or code points
+    above U+10FFFF
+*/
+
+size_t utf8_sequence( const unsigned char * str )
+{
+    unsigned char lo = 0x80;
+    unsigned char hi = 0xbf;
+    size_t len, i;
+
+    if ( str[0] < 0x80 )
+        return 1;
+    if ( str[0] >= 0xc2 && str[0] <= 0xdf )
+        len = 2;
+    else if ( str[0] >= 0xe0 && str[0] <= 0xef )
+    {
+        len = 3;
+        if ( str[0] == 0xe0 )
+            lo = 0xa0;
+        else if ( str[0] == 0xed )
+            hi = 0x9f;
+    }
+    else if ( str[0] >= 0xf0 && str[0] <= 0xf4 )
+    {
+        len = 4;
+        if ( str[0] == 0xf0 )
+            lo = 0x90;
+        else if ( str[0] == 0xf4 )
+            hi = 0x8f;
+    }
+    else
+        return 0;
+
+    /* the second byte has the narrower range, the others 80..bf */
+    for ( i = 1; i < len; i++ )
+    {
+        if ( str[i] < lo || str[i] > hi )
+            return 0;
+        lo = 0x80;
+        hi = 0xbf;
+    }
+    return len;
+}
+
+/*
+    put out a JSON string, escaping quotes, backslashes and controls.
+    a byte which isn't part of a UTF-8 character is put out as U+FFFD,
+    out_json_name() adds the exact bytes
+*/
+void out_json_string( const char * str )
+{
+    static const char hex[] = "0123456789abcdef";
+    const char * run = str;
+
+    out_putc ( '"' );
+    while ( *str != '\0' )
+    {
+        unsigned char c = *str;
+        size_t len;
+
+        if ( c >= 0x20 && c < 0x80 && c != '"' && c != '\\' )
+        {
+            str++;
+            continue;
+        }
+        if ( c >= 0x80 &&
+             ( len = utf8_sequence ( (const unsigned char *)str ) ) > 0 )
+        {
+            str += len;
+            continue;
+        }
+
+        out_write ( run, str - run );
+        run = ++str;
+
+        out_putc ( '\\' );
+        if ( c == '"' || c == '\\' )
+            out_putc ( c );
+        else if ( c >= 0x80 )
+            out_write ( "ufffd", 5 );
+        else
+        {
+            out_write ( "u00", 3 );
+            out_putc ( hex [c >> 4] );
+            out_putc ( hex [c & 0xf] );
+        }
+    }
+    out_write ( run, str - run );
+    out_putc ( '"' );
+}
+
+/* put out the bytes of str as a base64 JSON string */
+void out_base64( const char * str )
+{
+    static const char digits[] =
+        "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const unsigned char * p = (const unsigned char *)str;
+    size_t len = strlen ( str );
+    char quad [4];
+
+    out_putc ( '"' );
+    for ( ; len >= 3; len -= 3, p += 3 )
+    {
+        quad[0] = digits [p[0] >> 2];
+        quad[1] = digits [( p[0] & 0x03 ) << 4 | p[1] >> 4];
+        quad[2] = digits [( p[1] & 0x0f ) << 2 | p[2] >> 6];
+        quad[3] = digits [p[2] & 0x3f];
+        out_write ( quad, 4 );
+    }
+    if ( len > 0 )
+    {
+        quad[0] = digits [p[0] >> 2];
+        quad[1] = digits [( p[0] & 0x03 ) << 4 | ( len > 1 ? p[1] >> 4 : 0 )];
+        quad[2] = len > 1 ? digits [( p[1] & 0x0f ) << 2] : '=';
+        quad[3] = '=';
+        out_write ( quad, 4 );
+    }
+    out_putc ( '"' );
+}
+
+/*
+    "key":"str", followed by "key_b64":"..." with the bytes of str
+    when it isn't UTF-8 and the first one can't carry them
+*/
+void out_json_name( const char * key, const char * str )
+{
+    const unsigned char * p = (const unsigned char *)str;
+    size_t key_len = strlen ( key );
+    size_t len;
+
+    out_putc ( '"' );
+    out_write ( key, key_len );
+    out_write ( "\":", 2 );
+    out_json_string ( str );
+
+    while ( *p != '\0' && ( len = utf8_sequence ( p ) ) > 0 )
+        p += len;
+    if ( *p != '\0' )
+    {
+        out_write ( ",\"", 2 );
+        out_write ( key, key_len );
+        out_write ( "_b64\":", 6 );
+        out_base64 ( str );
+    }
+}
+
+void out_json_field( const char * key, long long value )
+{
+    out_putc ( ',' );
+    out_putc ( '"' );
+    out_write ( key, strlen ( key ) );
+    out_write ( "\":", 2 );
+    out_int ( value );
+}
+
+long long timespec_to_ns( struct timespec * ts )
+{
+    return (long long)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+void out_binary_record( int type, struct stat * statp, const char * name,
+                        const char * target )
+{
+    static const char zero [8];
+    struct binary_record rec;
+    size_t name_len = strlen ( name );
+    size_t target_len = target ? strlen ( target ) : 0;
+    size_t len = sizeof(rec) + name_len + target_len;
+
+    memset ( &rec, 0, sizeof(rec) );
+    rec.rec_len = ( len + 7 ) & ~(size_t)7;
+    rec.type = type;
+    rec.name_len = name_len;
+    rec.target_len = target_len;
+
+    if ( statp != NULL )
+    {
+        rec.mode = statp->st_mode;
+        rec.inode = statp->st_ino;
+        rec.nlink = statp->st_nlink;
+        rec.uid = statp->st_uid;
+        rec.gid = statp->st_gid;
+        rec.size = statp->st_size;
+        rec.blocks = statp->st_blocks;
+        rec.a_time_ns = timespec_to_ns ( &statp->st_atim );
+        rec.m_time_ns = timespec_to_ns ( &statp->st_mtim );
+        rec.c_time_ns = timespec_to_ns ( &statp->st_ctim );
+    }
+
+    out_write ( &rec, sizeof(rec) );
+    out_write ( name, name_len );
+    out_write ( target, target_len );
+    out_write ( zero, rec.rec_len - len );
+}
+
+/*
+    put out the current list as NDJSON objects or binary records,
+    preceded by a header naming the directory the names are in
+*/
+
+void print_machine_list()
+{
+    struct file_info * node_ptr;
+    static int started;
+
+    if ( f_format_option == FORMAT_BINARY )
+    {
+        if ( ! started )
+            out_write ( BINARY_MAGIC, strlen ( BINARY_MAGIC ) );
+        out_binary_record ( 'D', NULL, g_dir_path, NULL );
+    }
+    else
+    {
+        out_putc ( '{' );
+        out_json_name ( "dir", g_dir_path );
+        out_write ( "}\n", 2 );
+    }
+    started = 1;
+
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = node_ptr->next )
+    {
+        struct stat * statp = &node_ptr->stat_info;
+
+        if ( skip_entry ( node_ptr ) )
+            continue;
+
+        if ( f_format_option == FORMAT_BINARY )
+        {
+            out_binary_record ( 'E', statp, node_ptr->path_name,
+                                node_ptr->link_target );
+            continue;
+        }
+
+        out_write ( "{\"ino\":", 7 );
+        out_uint ( statp->st_ino );
+        out_json_field ( "mode", statp->st_mode );
+        out_json_field ( "nlink", statp->st_nlink );
+        out_json_field ( "uid", statp->st_uid );
+        out_json_field ( "gid", statp->st_gid );
+        out_json_field ( "size", statp->st_size );
+        out_json_field ( "blocks", statp->st_blocks );
+        out_json_field ( "atime", timespec_to_ns ( &statp->st_atim ) );
+        out_json_field ( "mtime", timespec_to_ns ( &statp->st_mtim ) );
+        out_json_field ( "ctime", timespec_to_ns ( &statp->st_ctim ) );
+        out_putc ( ',' );
+        out_json_name ( "name", node_ptr->path_name );
+        if ( node_ptr->link_target != NULL )
+        {
+            out_putc ( ',' );
+            out_json_name ( "target", node_ptr->link_target );
+        }
+        out_write ( "}\n", 2 );
+    }
+}
+
+/*
+    sort the file_info list as the options ask for
+*/
+
+void sort_file_info_list()
+{
+    struct ls_sort_key * keys;
+    struct file_info * node;
+    size_t count, i;
+    int nthreads;
+    long long t;
+
+    LS_PROBE1 ( sort_start, g_list_count );
+    STATS_START ( t );
+    count = get_file_info_list_length ();
+    if ( ! f_f_option && count > 1 )
+    {
+        keys = malloc ( count * sizeof(*keys) );
+        if ( keys == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+
+        /* by the first character of the name, the newest or the biggest
+           first, and -r turns each of them around */
+        for ( node = file_info_list_head, i = 0; node != NULL;
+              node = node->next, i++ )
+        {
+            keys[i].item = node;
+            if ( f_t_option )
+                keys[i].key = node->m_time;
+            else if ( f_S_option )
+                keys[i].key = node->sort_size;
+            else
+                keys[i].key = node->path_name[0];
+            if ( ( f_t_option || f_S_option ) != ( f_r_option != 0 ) )
+                keys[i].key = -keys[i].key;
+        }
+
+        nthreads = parallel_threads ( count );
+        if ( ls_sort ( keys, count, nthreads ) < 0 )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+
+        /* relink the nodes in their new order */
+        for ( i = 0; i + 1 < count; i++ )
+            ( (struct file_info *)keys[i].item )->next = keys[i + 1].item;
+        ( (struct file_info *)keys[count - 1].item )->next = NULL;
+        file_info_list_head = keys[0].item;
+        file_info_list_tail = keys[count - 1].item;
+        free ( keys );
+    }
+
+    g_list_sorted = 1;
+    STATS_STOP ( sort, t );
+    LS_PROBE1 ( sort_end, g_list_count );
+}
+
+/*
+    --cache
+
+    the sorted entries of a directory are kept in a file named after
+    the directory's device, inode and the sort order, and reused while
+    the directory's mtime and ctime are the same as when it was stored.
+    Entries are added and removed under a changed mtime, but a file
+    changed in place is not seen unless --cache-strict is given.
+*/
+
+void fill_raw_entry( struct raw_entry * rp, struct stat * statp )
+{
+    rp->inode = statp->st_ino;
+    rp->nlink = statp->st_nlink;
+    rp->mode = statp->st_mode;
+    rp->uid = statp->st_uid;
+    rp->gid = statp->st_gid;
+    rp->size = statp->st_size;
+    rp->blocks = statp->st_blocks;
+    rp->a_time_ns = timespec_to_ns ( &statp->st_atim );
+    rp->m_time_ns = timespec_to_ns ( &statp->st_mtim );
+    rp->c_time_ns = timespec_to_ns ( &statp->st_ctim );
+}
+
+void ns_to_timespec( int64_t ns, struct timespec * ts )
+{
+    ts->tv_sec = ns / 1000000000LL;
+    ts->tv_nsec = ns % 1000000000LL;
+    if ( ts->tv_nsec < 0 )
+    {
+        ts->tv_sec--;
+        ts->tv_nsec += 1000000000LL;
+    }
+}
+
+void raw_entry_to_stat( const struct raw_entry * rp, struct stat * statp )
+{
+    memset ( statp, 0, sizeof(*statp) );
+    statp->st_ino = rp->inode;
+    statp->st_nlink = rp->nlink;
+    statp->st_mode = rp->mode;
+    statp->st_uid = rp->uid;
+    statp->st_gid = rp->gid;
+    statp->st_size = rp->size;
+    statp->st_blocks = rp->blocks;
+    ns_to_timespec ( rp->a_time_ns, &statp->st_atim );
+    ns_to_timespec ( rp->m_time_ns, &statp->st_mtim );
+    ns_to_timespec ( rp->c_time_ns, &statp->st_ctim );
+}
+
+/* the options which decide the order sort_file_info_list() leaves */
+unsigned int cache_sort_key()
+{
+    if ( f_f_option )
+        return 1;
+    return 2 | ( f_t_option << 2 ) | ( f_S_option << 3 ) | ( f_r_option << 4 );
+}
+
+/* make the cache directory and return the cache file of a directory */
+char * cache_file_path( struct stat * dir_statp )
+{
+    static char path [PATH_MAX];
+    char * p;
+
+    /* mkdir -p, ignoring what already exists */
+    strlcpy ( path, g_cache_dir, sizeof(path) );
+    for ( p = path + 1; *p != '\0'; p++ )
+    {
+        if ( *p != '/' )
+            continue;
+        *p = '\0';
+        mkdir ( path, 0700 );
+        *p = '/';
+    }
+    mkdir ( path, 0700 );
+
+    snprintf ( path, sizeof(path), "%s/%llx-%llx-%x", g_cache_dir,
+        (unsigned long long)dir_statp->st_dev,
+        (unsigned long long)dir_statp->st_ino, cache_sort_key () );
+    return path;
+}
+
+/*
+    fill the file_info list from the cache file of the directory dp
+    is reading, returns 1 if it was up to date
+*/
+
+int cache_load( DIR * dp )
+{
+    struct cache_header * hp;
+    struct raw_entry * rp;
+    struct stat stat_buf;
+    const char * names;
+    size_t size;
+    void * map;
+    uint32_t i;
+    int damaged;
+    int fd;
+
+    if ( fstat ( dirfd ( dp ), &g_cache_dir_stat ) < 0 )
+        return 0;
+
+    fd = open ( cache_file_path ( &g_cache_dir_stat ), O_RDONLY );
+    if ( fd < 0 )
+        return 0;
+    if ( fstat ( fd, &stat_buf ) < 0 ||
+         stat_buf.st_size < (off_t)sizeof(struct cache_header) )
+    {
+        close ( fd );
+        return 0;
+    }
+
+    size = stat_buf.st_size;
+    map = mmap ( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    close ( fd );
+    if ( map == MAP_FAILED )
+        return 0;
+
+    hp = map;
+    rp = (struct raw_entry *)( hp + 1 );
+    names = (const char *)( rp + hp->count );
+
+    if ( memcmp ( hp->magic, CACHE_MAGIC, sizeof(hp->magic) ) != 0 ||
+         hp->dev != (uint64_t)g_cache_dir_stat.st_dev ||
+         hp->inode != (uint64_t)g_cache_dir_stat.st_ino ||
+         hp->m_time_ns != timespec_to_ns ( &g_cache_dir_stat.st_mtim ) ||
+         hp->c_time_ns != timespec_to_ns ( &g_cache_dir_stat.st_ctim ) ||
+         hp->sort_key != cache_sort_key () ||
+         sizeof(*hp) + (uint64_t)hp->count * sizeof(*rp) + hp->names_size
+            != size )
+    {
+        munmap ( map, size );
+        return 0;
+    }
+
+    for ( i = 0; i < hp->count; i++, rp++ )
+    {
+        char name [NAME_MAX + 1];
+        char target [PATH_MAX];
+
+        if ( (uint64_t)rp->name_off + rp->name_len > hp->names_size ||
+             (uint64_t)rp->target_off + rp->target_len > hp->names_size ||
+             rp->name_len > NAME_MAX || rp->target_len >= PATH_MAX )
+            break;
+
+        memcpy ( name, names + rp->name_off, rp->name_len );
+        name [rp->name_len] = '\0';
+        if ( g_filter_count && ! name_wanted ( name ) )
+            continue;
+        memcpy ( target, names + rp->target_off, rp->target_len );
+        target [rp->target_len] = '\0';
+
+        if ( f_cache_strict_option )
+        {
+            /* only the names are trusted, cwd is the directory */
+            if ( lstat ( name, &stat_buf ) < 0 )
+                continue;
+        }
+        else
+        {
+            raw_entry_to_stat ( rp, &stat_buf );
+            stat_buf.st_dev = g_cache_dir_stat.st_dev;
+        }
+
+        if ( f_predicate_option && ! stat_wanted ( &stat_buf ) )
+            continue;
+        record_stat ( &stat_buf, name, rp->target_len ? target : NULL );
+    }
+
+    damaged = i < hp->count;
+    munmap ( map, size );
+
+    if ( damaged )
+    {
+        /* damaged, list the directory the normal way */
+        reset_file_info_list ();
+        return 0;
+    }
+
+    /* sizes and times may have moved, -t and -S sort again */
+    g_list_sorted = ! ( f_cache_strict_option && ( f_t_option || f_S_option ) );
+    return 1;
+}
+
+/*
+    sort the file_info list the way print_file_info_list() will and
+    keep it in the cache file of the directory cache_load() looked at
+*/
+
+void cache_store()
+{
+    struct file_info * node_ptr;
+    struct cache_header * hp;
+    struct raw_entry * rp;
+    char * names;
+    char * path;
+    char tmp_path [PATH_MAX];
+    uint32_t count = 0;
+    uint64_t names_size = 0;
+    size_t size;
+    void * map;
+    int fd;
+
+    sort_file_info_list ();
+
+    /* too young, a change in the same clock tick would go unseen */
+    if ( g_cache_dir_stat.st_mtime >= time ( NULL ) - CACHE_RACY_SECONDS ||
+         g_cache_dir_stat.st_ctime >= time ( NULL ) - CACHE_RACY_SECONDS )
+        return;
+
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = node_ptr->next )
+    {
+        /* the real name is gone, leave it to the next run */
+        if ( node_ptr->name_sanitized )
+            return;
+
+        count++;
+        names_size += strlen ( node_ptr->path_name );
+        if ( node_ptr->link_target != NULL )
+            names_size += strlen ( node_ptr->link_target );
+    }
+
+    size = sizeof(*hp) + count * sizeof(*rp) + names_size;
+
+    path = cache_file_path ( &g_cache_dir_stat );
+    snprintf ( tmp_path, sizeof(tmp_path), "%s.%ld", path, (long)getpid () );
+
+    fd = open ( tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0600 );
+    if ( fd < 0 )
+        return;
+    if ( ftruncate ( fd, size ) < 0 ||
+         ( map = mmap ( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0 ) ) == MAP_FAILED )
+    {
+        close ( fd );
+        unlink ( tmp_path );
+        return;
+    }
+    close ( fd );
+
+    hp = map;
+    memcpy ( hp->magic, CACHE_MAGIC, sizeof(hp->magic) );
+    hp->dev = g_cache_dir_stat.st_dev;
+    hp->inode = g_cache_dir_stat.st_ino;
+    hp->m_time_ns = timespec_to_ns ( &g_cache_dir_stat.st_mtim );
+    hp->c_time_ns = timespec_to_ns ( &g_cache_dir_stat.st_ctim );
+    hp->sort_key = cache_sort_key ();
+    hp->count = count;
+    hp->names_size = names_size;
+
+    rp = (struct raw_entry *)( hp + 1 );
+    names = (char *)( rp + count );
+    names_size = 0;
+
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = node_ptr->next, rp++ )
+    {
+        size_t len = strlen ( node_ptr->path_name );
+
+        memset ( rp, 0, sizeof(*rp) );
+        fill_raw_entry ( rp, &node_ptr->stat_info );
+
+        rp->name_off = names_size;
+        rp->name_len = len;
+        memcpy ( names + names_size, node_ptr->path_name, len );
+        names_size += len;
+
+        if ( node_ptr->link_target != NULL )
+        {
+            len = strlen ( node_ptr->link_target );
+            rp->target_off = names_size;
+            rp->target_len = len;
+            memcpy ( names + names_size, node_ptr->link_target, len );
+            names_size += len;
+        }
+    }
+
+    munmap ( map, size );
+
+    if ( rename ( tmp_path, path ) < 0 )
+        unlink ( tmp_path );
+}
+
+/*
+    --index-write / --index
+
+    the -R traversal is kept in one file which is later mapped and
+    listed from with any of the usual options, on any directory in it,
+    without looking at the file system again.
+*/
+
+/* strcmp() with '/' below every other byte, so a directory's
+   subdirectories sort right after it */
+int index_path_cmp( const char * a, size_t a_len, const char * b,
+                    size_t b_len )
+{
+    size_t i;
+
+    for ( i = 0; i < a_len && i < b_len; i++ )
+    {
+        unsigned char ca = a[i] == '/' ? 0 : (unsigned char)a[i];
+        unsigned char cb = b[i] == '/' ? 0 : (unsigned char)b[i];
+
+        if ( ca != cb )
+            return ca < cb ? -1 : 1;
+    }
+    return a_len < b_len ? -1 : a_len > b_len;
+}
+
+/* drop "./" in front and '/' at the end, in place */
+char * index_normalize_path( char * path )
+{
+    size_t len;
+
+    while ( path[0] == '.' && path[1] == '/' )
+    {
+        path += 2;
+        while ( path[0] == '/' )
+            path++;
+    }
+    if ( path[0] == '\0' )
+        return ".";
+
+    len = strlen ( path );
+    while ( len > 1 && path[len - 1] == '/' )
+        path[--len] = '\0';
+    return path;
+}
+
+void * index_grow( void * array, uint64_t * alloc, uint64_t need,
+                   size_t size )
+{
+    if ( need <= *alloc )
+        return array;
+
+    *alloc = *alloc ? *alloc * 2 : 1024;
+    if ( *alloc < need )
+        *alloc = need;
+    array = realloc ( array, *alloc * size );
+    if ( array == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    return array;
+}
+
+uint32_t index_add_name( const char * name, size_t len )
+{
+    uint64_t off = g_ix_names_size;
+
+    g_ix_names = index_grow ( g_ix_names, &g_ix_names_alloc,
+                              off + len, 1 );
+    memcpy ( g_ix_names + off, name, len );
+    g_ix_names_size += len;
+
+    if ( g_ix_names_size > UINT32_MAX )
+    {
+        fprintf ( stderr, "--index-write: too many names\n" );
+        exit (1);
+    }
+    return off;
+}
+
+void index_begin_dir( FTSENT * p, struct stat * statp )
+{
+    uint64_t alloc = g_ix_dir_alloc;
+    struct index_dir * dp;
+    char path [PATH_MAX];
+    char * norm;
+
+    g_ix_dirs = index_grow ( g_ix_dirs, &alloc, g_ix_dir_count + 1,
+                             sizeof(*g_ix_dirs) );
+    g_ix_dir_alloc = alloc;
+    dp = &g_ix_dirs [g_ix_dir_count++];
+    memset ( dp, 0, sizeof(*dp) );
+
+    strlcpy ( path, p->fts_path, sizeof(path) );
+    norm = index_normalize_path ( path );
+
+    fill_raw_entry ( &dp->self, statp );
+    dp->self.name_len = strlen ( norm );
+    dp->self.name_off = index_add_name ( norm, dp->self.name_len );
+    dp->first = g_ix_entry_count;
+}
+
+void index_add_entry( FTSENT * cur, struct stat * statp )
+{
+    struct raw_entry * rp;
+
+    g_ix_entries = index_grow ( g_ix_entries, &g_ix_entry_alloc,
+                                g_ix_entry_count + 1, sizeof(*g_ix_entries) );
+    rp = &g_ix_entries [g_ix_entry_count++];
+    memset ( rp, 0, sizeof(*rp) );
+
+    fill_raw_entry ( rp, statp );
+    rp->name_len = cur->fts_namelen;
+    rp->name_off = index_add_name ( cur->fts_name, cur->fts_namelen );
+
+    if ( S_ISLNK ( statp->st_mode ) )
+    {
+        char full_path [PATH_MAX];
+        char link_path [PATH_MAX];
+        ssize_t ret;
+
+        snprintf ( full_path, sizeof(full_path), "%s/%s",
+            g_dir_path, cur->fts_name );
+        ret = timed_readlinkat ( AT_FDCWD, full_path, link_path,
+                                 sizeof(link_path) - 1 );
+        if ( ret > 0 )
+        {
+            rp->target_len = ret;
+            rp->target_off = index_add_name ( link_path, ret );
+        }
+    }
+
+    g_ix_dirs [g_ix_dir_count - 1].count++;
+}
+
+int index_entry_cmp( const void * a, const void * b )
+{
+    const struct raw_entry * ra = a;
+    const struct raw_entry * rb = b;
+    size_t len = ra->name_len < rb->name_len ? ra->name_len : rb->name_len;
+    int ret = memcmp ( g_ix_names + ra->name_off,
+                       g_ix_names + rb->name_off, len );
+
+    if ( ret != 0 )
+        return ret;
+    return ( ra->name_len > rb->name_len ) - ( ra->name_len < rb->name_len );
+}
+
+/* sort the entries of the directory index_begin_dir() started */
+void index_end_dir()
+{
+    struct index_dir * dp = &g_ix_dirs [g_ix_dir_count - 1];
+
+    qsort ( g_ix_entries + dp->first, dp->count, sizeof(*g_ix_entries),
+            index_entry_cmp );
+}
+
+int index_dir_cmp( const void * a, const void * b )
+{
+    const struct raw_entry * ra = &((const struct index_dir *)a)->self;
+    const struct raw_entry * rb = &((const struct index_dir *)b)->self;
+
+    return index_path_cmp ( g_ix_names + ra->name_off, ra->name_len,
+                            g_ix_names + rb->name_off, rb->name_len );
+}
+
+void index_write_finish()
+{
+    struct index_header header;
+    char tmp_path [PATH_MAX];
+    size_t size;
+    char * map;
+    int fd;
+
+    qsort ( g_ix_dirs, g_ix_dir_count, sizeof(*g_ix_dirs), index_dir_cmp );
+
+    memset ( &header, 0, sizeof(header) );
+    memcpy ( header.magic, INDEX_MAGIC, sizeof(header.magic) );
+    header.dir_count = g_ix_dir_count;
+    header.entry_count = g_ix_entry_count;
+    header.names_size = g_ix_names_size;
+
+    size = sizeof(header) + g_ix_dir_count * sizeof(*g_ix_dirs)
+           + g_ix_entry_count * sizeof(*g_ix_entries) + g_ix_names_size;
+
+    snprintf ( tmp_path, sizeof(tmp_path), "%s.%ld", g_index_write_file,
+        (long)getpid () );
+    fd = open ( tmp_path, O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd < 0 || ftruncate ( fd, size ) < 0 ||
+         ( map = mmap ( NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0 ) ) == MAP_FAILED )
+    {
+        fprintf ( stderr, "can't write index '%s': %s\n",
+            g_index_write_file, strerror ( errno ) );
+        exit (1);
+    }
+    close ( fd );
+
+    memcpy ( map, &header, sizeof(header) );
+    size = sizeof(header);
+    memcpy ( map + size, g_ix_dirs, g_ix_dir_count * sizeof(*g_ix_dirs) );
+    size += g_ix_dir_count * sizeof(*g_ix_dirs);
+    memcpy ( map + size, g_ix_entries,
+             g_ix_entry_count * sizeof(*g_ix_entries) );
+    size += g_ix_entry_count * sizeof(*g_ix_entries);
+    memcpy ( map + size, g_ix_names, g_ix_names_size );
+    size += g_ix_names_size;
+
+    munmap ( map, size );
+
+    if ( rename ( tmp_path, g_index_write_file ) < 0 )
+    {
+        fprintf ( stderr, "can't write index '%s': %s\n",
+            g_index_write_file, strerror ( errno ) );
+        unlink ( tmp_path );
+        exit (1);
+    }
+}
+
+/* binary search of the directory table, -1 if path is not in it */
+int index_find_dir( const char * path, size_t len )
+{
+    int lo = 0;
+    int hi = (int)g_ix_header->dir_count - 1;
+
+    while ( lo <= hi )
+    {
+        int mid = lo + ( hi - lo ) / 2;
+        const struct raw_entry * rp = &g_ix_dir_table[mid].self;
+        int ret = index_path_cmp ( path, len, g_ix_heap + rp->name_off,
+                                   rp->name_len );
+
+        if ( ret == 0 )
+            return mid;
+        if ( ret < 0 )
+            hi = mid - 1;
+        else
+            lo = mid + 1;
+    }
+    return -1;
+}
+
+/* record a raw_entry of the index as if it had been lstat()ed */
+void index_record( const struct raw_entry * rp, const char * name,
+                   size_t name_len )
+{
+    char name_buf [PATH_MAX];
+    char target [PATH_MAX];
+    struct stat stat_buf;
+
+    if ( name_len >= sizeof(name_buf) )
+        name_len = sizeof(name_buf) - 1;
+    memcpy ( name_buf, name, name_len );
+    name_buf [name_len] = '\0';
+
+    memcpy ( target, g_ix_heap + rp->target_off, rp->target_len );
+    target [rp->target_len] = '\0';
+
+    raw_entry_to_stat ( rp, &stat_buf );
+    record_stat ( &stat_buf, name_buf,
+                  S_ISLNK ( rp->mode ) ? target : NULL );
+}
+
+/* put the entries of one indexed directory in the file_info list */
+void index_list_dir( int dir )
+{
+    const struct index_dir * dp = &g_ix_dir_table[dir];
+    const struct raw_entry * rp = g_ix_entry_table + dp->first;
+    uint32_t i;
+
+    for ( i = 0; i < dp->count; i++, rp++ )
+    {
+        if ( g_filter_count )
+        {
+            /* names in the heap have no '\0' of their own */
+            char name [NAME_MAX + 1];
+            size_t len = rp->name_len < NAME_MAX ? rp->name_len : NAME_MAX;
+
+            memcpy ( name, g_ix_heap + rp->name_off, len );
+            name [len] = '\0';
+            if ( ! name_wanted ( name ) )
+                continue;
+        }
+        if ( f_predicate_option )
+        {
+            struct stat stat_buf;
+
+            raw_entry_to_stat ( rp, &stat_buf );
+            if ( ! stat_wanted ( &stat_buf ) )
+                continue;
+        }
+        index_record ( rp, g_ix_heap + rp->name_off, rp->name_len );
+    }
+}
+
+/*
+    list the operands ( or "." ) from the mapped --index file
+*/
+
+int list_from_index( int argc, char ** argv )
+{
+    char * curr_dir = ".";
+    struct stat stat_buf;
+    size_t size;
+    void * map;
+    int fd;
+    int ret = 0;
+    int operands = argc;
+
+    fd = open ( g_index_file, O_RDONLY );
+    if ( fd < 0 || fstat ( fd, &stat_buf ) < 0 )
+    {
+        fprintf ( stderr, "can't open index '%s': %s\n", g_index_file,
+            strerror ( errno ) );
+        return 1;
+    }
+    size = stat_buf.st_size;
+    map = size >= sizeof(struct index_header)
+          ? mmap ( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 )
+          : MAP_FAILED;
+    close ( fd );
+
+    g_ix_header = map;
+    if ( map == MAP_FAILED ||
+         memcmp ( g_ix_header->magic, INDEX_MAGIC, 8 ) != 0 ||
+         sizeof(*g_ix_header)
+            + (uint64_t)g_ix_header->dir_count * sizeof(*g_ix_dir_table)
+            + g_ix_header->entry_count * sizeof(*g_ix_entry_table)
+            + g_ix_header->names_size != size )
+    {
+        fprintf ( stderr, "'%s' is not an index\n", g_index_file );
+        return 1;
+    }
+    g_ix_dir_table = (struct index_dir *)( g_ix_header + 1 );
+    g_ix_entry_table =
+        (struct raw_entry *)( g_ix_dir_table + g_ix_header->dir_count );
+    g_ix_heap = (const char *)( g_ix_entry_table + g_ix_header->entry_count );
+
+    if ( argc == 0 )
+    {
+        argc = 1;
+        argv = &curr_dir;
+    }
+
+    for ( ; argc > 0; argc--, argv++ )
+    {
+        char path_buf [PATH_MAX];
+        char header_buf [PATH_MAX];
+        char * path;
+        char * slash;
+        size_t len;
+        int dir;
+
+        strlcpy ( path_buf, *argv, sizeof(path_buf) );
+        path = index_normalize_path ( path_buf );
+        len = strlen ( path );
+        dir = index_find_dir ( path, len );
+
+        reset_file_info_list ();
+        g_dir_path = ".";
+
+        /* a directory, or -d : the directory itself */
+        if ( dir >= 0 && f_d_option )
+        {
+            index_record ( &g_ix_dir_table[dir].self, *argv,
+                           strlen ( *argv ) );
+            print_file_info_list ();
+            continue;
+        }
+        else if ( dir >= 0 )
+        {
+            int first = dir;
+            int last = dir;
+            int n;
+
+            /* with -R, its subdirectories follow it in the table. those
+               of "." are the whole table, "-x" and "+x" sort before it */
+            if ( f_R_option && strcmp ( path, "." ) == 0 )
+            {
+                first = 0;
+                last = (int)g_ix_header->dir_count - 1;
+            }
+            else if ( f_R_option )
+            {
+                while ( last + 1 < (int)g_ix_header->dir_count )
+                {
+                    const struct raw_entry * rp =
+                        &g_ix_dir_table[last + 1].self;
+
+                    if ( ! ( rp->name_len > len &&
+                             memcmp ( g_ix_heap + rp->name_off, path,
+                                      len ) == 0 &&
+                             g_ix_heap [rp->name_off + len] == '/' ) )
+                        break;
+                    last++;
+                }
+            }
+
+            /* the operand itself first, then the rest in table order */
+            for ( n = 0; n <= last - first; n++ )
+            {
+                int d = n == 0 ? dir : first + n - 1 + ( first + n - 1 >= dir );
+                const struct raw_entry * rp = &g_ix_dir_table[d].self;
+                const char * sub = g_ix_heap + rp->name_off;
+                size_t skip = len;
+
+                /* spell the path the way -R would from this operand */
+                if ( strcmp ( path, "." ) == 0 && rp->name_len > 1 )
+                    skip = 0;
+                else if ( rp->name_len < skip )
+                    skip = rp->name_len;
+                snprintf ( header_buf, sizeof(header_buf), "%s%s%.*s", *argv,
+                    skip == 0 ? "/" : "", (int)( rp->name_len - skip ),
+                    sub + skip );
+                g_dir_path = header_buf;
+
+                if ( f_R_option && ! f_format_option )
+                    out_printf ( "%s:\n", header_buf );
+
+                reset_file_info_list ();
+                index_list_dir ( d );
+                print_file_info_list ();
+
+                if ( f_R_option && ! f_format_option )
+                    out_printf ( "\n" );
+            }
+        }
+        /* a file : look for its name in the parent directory */
+        else
+        {
+            const struct index_dir * dp;
+            const struct raw_entry * rp;
+            const char * name = path;
+            int lo, hi, found = 0;
+
+            slash = strrchr ( path, '/' );
+            if ( slash != NULL )
+            {
+                *slash = '\0';
+                name = slash + 1;
+                dir = index_find_dir ( slash == path ? "/" : path,
+                                       slash == path ? 1 : slash - path );
+            }
+            else
+                dir = index_find_dir ( ".", 1 );
+
+            if ( dir >= 0 )
+            {
+                dp = &g_ix_dir_table[dir];
+                lo = 0;
+                hi = (int)dp->count - 1;
+                while ( lo <= hi && ! found )
+                {
+                    int mid = lo + ( hi - lo ) / 2;
+                    size_t name_len = strlen ( name );
+                    size_t min_len;
+                    int cmp;
+
+                    rp = g_ix_entry_table + dp->first + mid;
+                    min_len = name_len < rp->name_len ? name_len
+                                                      : rp->name_len;
+                    cmp = memcmp ( name, g_ix_heap + rp->name_off, min_len );
+                    if ( cmp == 0 )
+                        cmp = ( name_len > rp->name_len )
+                              - ( name_len < rp->name_len );
+
+                    if ( cmp == 0 )
+                    {
+                        index_record ( rp, *argv, strlen ( *argv ) );
+                        found = 1;
+                    }
+                    else if ( cmp < 0 )
+                        hi = mid - 1;
+                    else
+                        lo = mid + 1;
+                }
+            }
+
+            if ( ! found )
+            {
+                fprintf ( stderr, "%s: not in index\n", *argv );
+                ret = 1;
+                continue;
+            }
+            print_file_info_list ();
+        }
+
+        if ( operands > 0 && ! f_format_option )
+            out_printf ( "\n" );
+    }
+
+    return ret;
+}
+
+/*
+    --watch
+
+    the listing is kept as two sorted arrays of the file_info nodes, in
+    print order and by name. inotify events are collected for a short
+    while, then every name they mention is lstat()ed once and moved to
+    its new place with a binary search, and only those rows are printed,
+    each with its row number in the listing: '+ N' puts a new row in
+    at N, '- N' takes row N out and '~ N' replaces it. A row which moves
+    is taken out and put in again, so that applying them in turn keeps
+    a copy of the listing as it is now.
+*/
+
+/* a node's name as readdir() returned it, '?'s and all */
+const char * watch_name( const struct file_info * node )
+{
+    return node->raw_name != NULL ? node->raw_name : node->path_name;
+}
+
+/* the order sort_file_info_list() puts nodes in, ties broken by name */
+int compare_file_info( const struct file_info * a,
+                       const struct file_info * b )
+{
+    int ret = 0;
+
+    if ( f_f_option )
+        return 0;
+
+    if ( f_t_option && a->m_time != b->m_time )
+        ret = a->m_time > b->m_time ? -1 : 1;
+    else if ( f_S_option && a->sort_size != b->sort_size )
+        ret = a->sort_size > b->sort_size ? -1 : 1;
+    else
+        ret = strcmp ( watch_name ( a ), watch_name ( b ) );
+
+    return f_r_option ? -ret : ret;
+}
+
+int compare_file_name( const struct file_info * a,
+                       const struct file_info * b )
+{
+    return strcmp ( watch_name ( a ), watch_name ( b ) );
+}
+
+int watch_qsort_info( const void * a, const void * b )
+{
+    return compare_file_info ( *(struct file_info * const *)a,
+                               *(struct file_info * const *)b );
+}
+
+int watch_qsort_name( const void * a, const void * b )
+{
+    return compare_file_name ( *(struct file_info * const *)a,
+                               *(struct file_info * const *)b );
+}
+
+/*
+    the first listing is printed in the order the rows are kept in :
+    the first-letter lexicographical sort leaves ties the binary search
+    can't use, so they are sorted by the whole name here
+*/
+
+void watch_sort_list()
+{
+    struct file_info ** rows;
+    struct file_info * node_ptr;
+    size_t count = get_file_info_list_length ();
+    size_t i;
+
+    if ( f_f_option || count < 2 )
+        return;
+
+    rows = malloc ( count * sizeof(*rows) );
+    if ( rows == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    for ( node_ptr = file_info_list_head, i = 0; node_ptr != NULL;
+          node_ptr = node_ptr->next, i++ )
+        rows[i] = node_ptr;
+    qsort ( rows, count, sizeof(*rows), watch_qsort_info );
+
+    for ( i = 0; i + 1 < count; i++ )
+        rows[i]->next = rows[i + 1];
+    rows[count - 1]->next = NULL;
+    file_info_list_head = rows[0];
+    file_info_list_tail = rows[count - 1];
+    g_list_sorted = 1;
+    free ( rows );
+}
+
+/* where node is or would go in rows */
+size_t watch_search( struct file_info ** rows, size_t count,
+                     const struct file_info * node,
+                     int (*cmp)( const struct file_info *,
+                                 const struct file_info * ),
+                     int * found )
+{
+    size_t lo = 0;
+    size_t hi = count;
+
+    *found = 0;
+    while ( lo < hi )
+    {
+        size_t mid = lo + ( hi - lo ) / 2;
+        int ret = cmp ( node, rows[mid] );
+
+        if ( ret == 0 )
+        {
+            *found = rows[mid] == node || cmp == compare_file_name;
+            if ( *found )
+                return mid;
+        }
+        if ( ret < 0 )
+            hi = mid;
+        else
+            lo = mid + 1;
+    }
+    return lo;
+}
+
+/* put node in both arrays, and return its row */
+size_t watch_insert( struct file_info * node )
+{
+    size_t row, pos;
+    int found;
+
+    if ( g_watch_count == g_watch_alloc )
+    {
+        g_watch_alloc = g_watch_alloc ? g_watch_alloc * 2 : 1024;
+        g_watch_rows = realloc ( g_watch_rows,
+                                 g_watch_alloc * sizeof(*g_watch_rows) );
+        g_watch_names = realloc ( g_watch_names,
+                                  g_watch_alloc * sizeof(*g_watch_names) );
+        if ( g_watch_rows == NULL || g_watch_names == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+    }
+
+    /* -f : unsorted, new entries go last */
+    row = f_f_option ? g_watch_count
+                     : watch_search ( g_watch_rows, g_watch_count, node,
+                                      compare_file_info, &found );
+    memmove ( g_watch_rows + row + 1, g_watch_rows + row,
+              ( g_watch_count - row ) * sizeof(*g_watch_rows) );
+    g_watch_rows[row] = node;
+
+    pos = watch_search ( g_watch_names, g_watch_count, node,
+                         compare_file_name, &found );
+    memmove ( g_watch_names + pos + 1, g_watch_names + pos,
+              ( g_watch_count - pos ) * sizeof(*g_watch_names) );
+    g_watch_names[pos] = node;
+
+    g_watch_count++;
+    return row;
+}
+
+/* take node out of both arrays, and return the row it had */
+size_t watch_remove( struct file_info * node )
+{
+    size_t row, pos;
+    int found;
+
+    if ( f_f_option )
+    {
+        for ( row = 0; g_watch_rows[row] != node; row++ )
+            ;
+    }
+    else
+        row = watch_search ( g_watch_rows, g_watch_count, node,
+                             compare_file_info, &found );
+    memmove ( g_watch_rows + row, g_watch_rows + row + 1,
+              ( g_watch_count - row - 1 ) * sizeof(*g_watch_rows) );
+
+    pos = watch_search ( g_watch_names, g_watch_count, node,
+                         compare_file_name, &found );
+    memmove ( g_watch_names + pos, g_watch_names + pos + 1,
+              ( g_watch_count - pos - 1 ) * sizeof(*g_watch_names) );
+
+    g_watch_count--;
+    return row;
+}
+
+/* rows are numbered from 1, as the listing is read */
+void watch_print_row( char mark, size_t row, struct file_info * node )
+{
+    out_putc ( mark );
+    out_putc ( ' ' );
+    out_uint ( row + 1 );
+    out_putc ( ' ' );
+    g_print_row ( node );
+}
+
+/* bring the row of one name up to date */
+void watch_update( const char * name )
+{
+    struct file_info key;
+    struct file_info * old = NULL;
+    struct file_info * node;
+    struct stat stat_buf;
+    size_t pos, old_row = 0, row;
+    int found;
+
+    if ( g_filter_count && ! name_wanted ( name ) )
+        return;
+
+    /* looked up by the name itself, not the one printed for it */
+    strlcpy ( key.path_name, name, sizeof(key.path_name) );
+    key.raw_name = (char *)name;
+    if ( skip_entry ( &key ) )
+        return;
+
+    pos = watch_search ( g_watch_names, g_watch_count, &key,
+                         compare_file_name, &found );
+    if ( found )
+    {
+        old = g_watch_names[pos];
+        old_row = watch_remove ( old );
+    }
+
+    /* a file which stops passing the predicates goes away too */
+    if ( lstat ( name, &stat_buf ) < 0 ||
+         ( f_predicate_option && ! stat_wanted ( &stat_buf ) ) )
+    {
+        if ( old != NULL )
+            watch_print_row ( '-', old_row, old );
+    }
+    else
+    {
+        /* record_stat() appends to the list, take the node back */
+        reset_file_info_list ();
+        record_stat ( &stat_buf, (char *)name, NULL );
+        if ( link_targets_wanted () )
+            resolve_link_targets ( AT_FDCWD, NULL );
+        node = file_info_list_head;
+        reset_file_info_list ();
+
+        row = watch_insert ( node );
+        if ( old != NULL && row == old_row )
+            watch_print_row ( '~', row, node );
+        else
+        {
+            if ( old != NULL )
+                watch_print_row ( '-', old_row, old );
+            watch_print_row ( '+', row, node );
+        }
+    }
+
+    /* its link target stays in the name pool */
+    if ( old != NULL )
+        free ( old );
+}
+
+int watch_qsort_str( const void * a, const void * b )
+{
+    return strcmp ( *(char * const *)a, *(char * const *)b );
+}
+
+/*
+    after an overflow : every name being shown and every name in the
+    directory, once each. the names are copied first, watch_update()
+    changes g_watch_names as it goes
+*/
+
+void watch_add_name( char *** names, size_t * count, size_t * alloc,
+                     const char * name )
+{
+    if ( *count == *alloc )
+    {
+        *alloc = *alloc ? *alloc * 2 : 64;
+        *names = realloc ( *names, *alloc * sizeof(**names) );
+        if ( *names == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+    }
+    if ( ( (*names)[(*count)++] = strdup ( name ) ) == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+}
+
+size_t watch_rescan_names( char *** names, size_t * alloc )
+{
+    DIR * dp;
+    struct dirent * dirp;
+    size_t count = 0;
+    size_t i, j;
+
+    for ( i = 0; i < g_watch_count; i++ )
+        watch_add_name ( names, &count, alloc, g_watch_names[i]->path_name );
+
+    dp = opendir ( "." );
+    while ( dp != NULL && ( dirp = readdir ( dp ) ) != NULL )
+        watch_add_name ( names, &count, alloc, dirp->d_name );
+    if ( dp != NULL )
+        closedir ( dp );
+
+    /* a name both shown and read is kept once */
+    qsort ( *names, count, sizeof(**names), watch_qsort_str );
+    for ( i = j = 0; i < count; i++ )
+    {
+        if ( j > 0 && strcmp ( (*names)[j - 1], (*names)[i] ) == 0 )
+            free ( (*names)[i] );
+        else
+            (*names)[j++] = (*names)[i];
+    }
+    return j;
+}
+
+/*
+    follow the directory just listed, which is the current directory,
+    until it is removed or the process is killed
+*/
+
+void watch_directory()
+{
+#ifdef __linux__
+    struct file_info * node_ptr, * next_ptr;
+    char buf [65536] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    char ** names = NULL;
+    size_t name_count, name_alloc = 0;
+    struct pollfd pfd;
+    size_t i;
+    int fd;
+
+    /* rows go out one per line, with a mark in front */
+    f_x_option = 0;
+    f_C_option = 0;
+
+    fd = inotify_init1 ( IN_CLOEXEC );
+    if ( fd < 0 || inotify_add_watch ( fd, ".",
+            IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM |
+            IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF | IN_EXCL_UNLINK ) < 0 )
+    {
+        fprintf ( stderr, "inotify error : %s\n", strerror ( errno ) );
+        exit (1);
+    }
+
+    /* the list is in print order already, less the hidden entries */
+    g_watch_alloc = get_file_info_list_length () + 1;
+    g_watch_rows = malloc ( g_watch_alloc * sizeof(*g_watch_rows) );
+    g_watch_names = malloc ( g_watch_alloc * sizeof(*g_watch_names) );
+    if ( g_watch_rows == NULL || g_watch_names == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = next_ptr )
+    {
+        next_ptr = node_ptr->next;
+        if ( skip_entry ( node_ptr ) )
+        {
+            free ( node_ptr );
+            continue;
+        }
+        g_watch_rows[g_watch_count] = node_ptr;
+        g_watch_names[g_watch_count++] = node_ptr;
+    }
+    qsort ( g_watch_names, g_watch_count, sizeof(*g_watch_names),
+            watch_qsort_name );
+    reset_file_info_list ();
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while ( 1 )
+    {
+        int timeout = -1;
+        int overflow = 0;
+
+        out_flush ();
+
+        /* read until the events settle, keeping each name once */
+        name_count = 0;
+        while ( poll ( &pfd, 1, timeout ) > 0 )
+        {
+            ssize_t len = read ( fd, buf, sizeof(buf) );
+            char * ptr;
+
+            if ( len <= 0 )
+            {
+                if ( len < 0 && errno == EINTR )
+                    continue;
+                fprintf ( stderr, "inotify read error : %s\n",
+                    strerror ( errno ) );
+                exit (1);
+            }
+
+            for ( ptr = buf; ptr < buf + len;
+                  ptr += sizeof(struct inotify_event) +
+                         ((struct inotify_event *)ptr)->len )
+            {
+                struct inotify_event * ev = (struct inotify_event *)ptr;
+
+                if ( ev->mask & ( IN_DELETE_SELF | IN_MOVE_SELF ) )
+                    exit (0);
+                if ( ev->mask & IN_Q_OVERFLOW )
+                    overflow = 1;
+                if ( ev->len == 0 )
+                    continue;
+
+                for ( i = 0; i < name_count; i++ )
+                    if ( strcmp ( names[i], ev->name ) == 0 )
+                        break;
+                if ( i == name_count )
+                    watch_add_name ( &names, &name_count, &name_alloc,
+                                     ev->name );
+            }
+            timeout = WATCH_SETTLE_MS;
+        }
+
+        /* events were lost, every name may have changed */
+        if ( overflow )
+        {
+            for ( i = 0; i < name_count; i++ )
+                free ( names[i] );
+            name_count = watch_rescan_names ( &names, &name_alloc );
+        }
+
+        for ( i = 0; i < name_count; i++ )
+        {
+            watch_update ( names[i] );
+            free ( names[i] );
+        }
+    }
+#else
+    fprintf ( stderr, "--watch is not supported on this system\n" );
+    exit (1);
+#endif
+}
+
+/*
+    --stats
+
+    the system calls of the listing go through these, which count them,
+    and time them when --stats or --latency is given
+*/
+
+long long stats_now()
+{
+    struct timespec ts;
+
+    clock_gettime ( CLOCK_MONOTONIC, &ts );
+    return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+DIR * timed_opendir( const char * path )
+{
+    long long t;
+    DIR * dp;
+
+    LS_PROBE1 ( dir_open, path );
+    TIMER_START ( t );
+    dp = opendir ( path );
+    TIMER_STOP ( LAT_OPENDIR, opendir, t );
+    return dp;
+}
+
+/*
+    readdir() with the directory read timed : on Linux the records come
+    from getdents64() on dp's fd, and only it is timed, not the calls
+    which take a name out of the buffer
+*/
+struct dirent * timed_readdir( DIR * dp )
+{
+#ifdef __linux__
+    struct count_dirent64 * rp;
+    long long t;
+
+    if ( dp != g_dents.dp )
+    {
+        g_dents.dp = dp;
+        g_dents.len = g_dents.pos = 0;
+    }
+    if ( g_dents.pos >= g_dents.len )
+    {
+        TIMER_START ( t );
+        g_dents.len = syscall ( SYS_getdents64, dirfd ( dp ), g_dents.buf,
+                                sizeof(g_dents.buf) );
+        TIMER_STOP ( LAT_READDIR, readdir, t );
+        g_dents.pos = 0;
+
+        /* at the end a DIR at the same address is another directory */
+        if ( g_dents.len <= 0 )
+        {
+            g_dents.dp = NULL;
+            return NULL;
+        }
+    }
+
+    rp = (struct count_dirent64 *)( g_dents.buf + g_dents.pos );
+    g_dents.pos += rp->d_reclen;
+    g_dents.entry.d_ino = rp->d_ino;
+    g_dents.entry.d_off = rp->d_off;
+    g_dents.entry.d_reclen = sizeof(g_dents.entry);
+    g_dents.entry.d_type = rp->d_type;
+    strlcpy ( g_dents.entry.d_name, rp->d_name,
+              sizeof(g_dents.entry.d_name) );
+    return &g_dents.entry;
+#else
+    struct dirent * dirp;
+    long long t;
+
+    TIMER_START ( t );
+    dirp = readdir ( dp );
+    TIMER_STOP ( LAT_READDIR, readdir, t );
+    return dirp;
+#endif
+}
+
+int timed_lstat( const char * path, struct stat * statp )
+{
+    long long t;
+    int ret;
+
+    TIMER_START ( t );
+    ret = lstat ( path, statp );
+    TIMER_STOP ( LAT_LSTAT, lstat, t );
+    return ret;
+}
+
+ssize_t timed_readlinkat( int dir_fd, const char * path, char * buf,
+                          size_t size )
+{
+    long long t;
+    ssize_t ret;
+
+    TIMER_START ( t );
+    ret = readlinkat ( dir_fd, path, buf, size );
+    TIMER_STOP ( LAT_READLINK, readlink, t );
+    return ret;
+}
+
+FTSENT * timed_fts_children( FTS * ftsp )
+{
+    FTSENT * chp;
+    long long t;
+
+    /* fts opens the directory, g_dir_path */
+    LS_PROBE1 ( dir_open, g_dir_path );
+    TIMER_START ( t );
+    chp = fts_children ( ftsp, 0 );
+    TIMER_STOP ( LAT_FTS, fts, t );
+    return chp;
+}
+
+void report_at_exit()
+{
+    if ( f_stats_option )
+        stats_report ();
+    if ( f_latency_option )
+        lat_report ();
+}
+
+/* at exit, after the last out_flush() */
+void stats_report()
+{
+    struct rusage usage;
+    long long total_ns = stats_now () - g_stats.start_ns;
+    long long syscalls;
+    const char * uncounted;
+    FILE * fp = stderr;
+    int i;
+
+    struct
+    {
+        const char * name;
+        long long ns;
+        long long calls;
+    } phases[] =
+    {
+        { "opendir", g_stats.opendir_ns, g_stats.opendir_calls },
+        { READDIR_NAME, g_stats.readdir_ns, g_stats.readdir_calls },
+        { "lstat", g_stats.lstat_ns, g_stats.lstat_calls },
+        { "readlink", g_stats.readlink_ns, g_stats.readlink_calls },
+        { "fts_children", g_stats.fts_ns, g_stats.fts_calls },
+        { "record_stat", g_stats.record_ns, g_stats.entries },
+        { "nss", g_stats.nss_ns, g_stats.nss_lookups },
+        { "sort", g_stats.sort_ns, g_stats.directories },
+        { "print", g_stats.print_ns, g_stats.directories },
+        { "write", g_stats.write_ns, g_stats.write_calls },
+    };
+    int nphases = sizeof(phases) / sizeof(phases[0]);
+
+    getrusage ( RUSAGE_SELF, &usage );
+
+    /* fts_children() reads directories with calls of its own */
+    syscalls = g_stats.opendir_calls + g_stats.lstat_calls +
+               g_stats.readlink_calls + g_stats.write_calls;
+    if ( READDIR_SYSCALLS )
+        syscalls += g_stats.readdir_calls;
+    uncounted = ! READDIR_SYSCALLS ? " ( not counting getdents )" :
+                g_stats.fts_calls ? " ( not counting fts_children()'s )" : "";
+
+    if ( g_stats_file != NULL )
+    {
+        fp = fopen ( g_stats_file, "w" );
+        if ( fp == NULL )
+        {
+            fprintf ( stderr, "can't write '%s': %s\n", g_stats_file,
+                strerror ( errno ) );
+            return;
+        }
+
+        fprintf ( fp, "{\"total_ns\":%lld,\"phases\":{", total_ns );
+        for ( i = 0; i < nphases; i++ )
+            fprintf ( fp, "%s\"%s\":{\"ns\":%lld,\"calls\":%lld}",
+                i ? "," : "", phases[i].name, phases[i].ns,
+                phases[i].calls );
+        fprintf ( fp, "},\"entries\":%lld,\"directories\":%lld,"
+            "\"syscalls\":%lld,\"bytes_written\":%lld,"
+            "\"nss_lookups\":%lld,\"node_bytes\":%lld,"
+            "\"peak_rss_kb\":%ld}\n",
+            g_stats.entries, g_stats.directories, syscalls,
+            g_stats.bytes_written, g_stats.nss_lookups, g_stats.node_bytes,
+            usage.ru_maxrss );
+        fclose ( fp );
+        return;
+    }
+
+    fprintf ( fp, "%-14s %14s %12s\n", "phase", "ms", "calls" );
+    for ( i = 0; i < nphases; i++ )
+        fprintf ( fp, "%-14s %14.3f %12lld\n", phases[i].name,
+            phases[i].ns / 1e6, phases[i].calls );
+    fprintf ( fp, "%-14s %14.3f\n", "total", total_ns / 1e6 );
+    fprintf ( fp, "entries %lld, directories %lld, syscalls %lld%s, "
+        "%lld bytes written,\n"
+        "%lld NSS lookups, %lld bytes of nodes, peak RSS %ld KB\n",
+        g_stats.entries, g_stats.directories, syscalls, uncounted,
+        g_stats.bytes_written, g_stats.nss_lookups, g_stats.node_bytes,
+        usage.ru_maxrss );
+}
+
+/*
+    --latency
+*/
+
+/* the histogram bucket of a time */
+int lat_bucket( long long ns )
+{
+    int e;
+
+    if ( ns < ( 1 << LAT_SUB_BITS ) )
+        return ns < 0 ? 0 : (int)ns;
+
+    /* e is the highest set bit, the sub-bucket the LAT_SUB_BITS below it */
+    e = 63 - __builtin_clzll ( (unsigned long long)ns );
+    return ( ( e - LAT_SUB_BITS + 1 ) << LAT_SUB_BITS ) |
+           (int)( ( ns >> ( e - LAT_SUB_BITS ) ) & ( ( 1 << LAT_SUB_BITS ) - 1 ) );
+}
+
+/* the highest time which falls into a bucket */
+long long lat_bucket_high( int bucket )
+{
+    int e, sub;
+
+    if ( bucket < ( 1 << LAT_SUB_BITS ) )
+        return bucket;
+
+    e = ( bucket >> LAT_SUB_BITS ) + LAT_SUB_BITS - 1;
+    sub = bucket & ( ( 1 << LAT_SUB_BITS ) - 1 );
+    return ( ( (long long)( ( 1 << LAT_SUB_BITS ) + sub + 1 ) ) <<
+             ( e - LAT_SUB_BITS ) ) - 1;
+}
+
+/*
+    the index of the group of an operand ( name != NULL ) or of a device,
+    made if new
+*/
+int lat_group_find( const char * name, dev_t dev )
+{
+    struct lat_group * gp;
+    int i;
+
+    for ( i = 0; i < g_lat_ngroups; i++ )
+    {
+        gp = &g_lat_groups[i];
+        if ( name != NULL ? gp->name != NULL && strcmp ( gp->name, name ) == 0
+                          : gp->name == NULL && gp->dev == dev )
+            return i;
+    }
+
+    g_lat_groups = realloc ( g_lat_groups,
+        ( g_lat_ngroups + 1 ) * sizeof(struct lat_group) );
+    if ( g_lat_groups == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+
+    gp = &g_lat_groups[g_lat_ngroups++];
+    memset ( gp, 0, sizeof(*gp) );
+    gp->name = name != NULL ? strdup ( name ) : NULL;
+    gp->dev = dev;
+    return g_lat_ngroups - 1;
+}
+
+/* the directory being listed is done, keep it if among the slowest */
+void lat_end_dir()
+{
+    int i;
+
+    if ( g_lat_dir_path == NULL )
+        return;
+
+    i = g_lat_nslowest;
+    if ( i < f_latency_option )
+        g_lat_nslowest++;
+    else if ( g_lat_slowest[i - 1].ns >= g_lat_dir_ns )
+        i = -1;
+    else
+        free ( g_lat_slowest[--i].path );
+
+    if ( i >= 0 )
+    {
+        /* insert, slowest first */
+        for ( ; i > 0 && g_lat_slowest[i - 1].ns < g_lat_dir_ns; i-- )
+            g_lat_slowest[i] = g_lat_slowest[i - 1];
+        g_lat_slowest[i].path = g_lat_dir_path;
+        g_lat_slowest[i].ns = g_lat_dir_ns;
+    }
+    else
+        free ( g_lat_dir_path );
+
+    g_lat_dir_path = NULL;
+    g_lat_dir_ns = 0;
+}
+
+/*
+    a directory is about to be listed : its calls go to the histograms of
+    the operand and of its device, statp is stat()ed if NULL
+*/
+void lat_begin_dir( const char * operand, const char * path,
+                    const struct stat * statp )
+{
+    struct stat stat_buf;
+    dev_t dev = 0;
+
+    lat_end_dir ();
+
+    if ( statp == NULL && stat ( path, &stat_buf ) == 0 )
+        statp = &stat_buf;
+    if ( statp != NULL )
+        dev = statp->st_dev;
+
+    g_lat_operand = lat_group_find ( operand, 0 );
+    g_lat_device = lat_group_find ( NULL, dev );
+
+    g_lat_dir_path = strdup ( path );
+    g_lat_dir_ns = 0;
+}
+
+void lat_hist_add( struct lat_hist * hp, long long ns )
+{
+    hp->count[lat_bucket ( ns )]++;
+    hp->calls++;
+    if ( ns > hp->max_ns )
+        hp->max_ns = ns;
+}
+
+void lat_record( int op, long long ns )
+{
+    if ( g_lat_operand < 0 )
+        return;
+
+    lat_hist_add ( &g_lat_groups[g_lat_operand].hist[op], ns );
+    lat_hist_add ( &g_lat_groups[g_lat_device].hist[op], ns );
+    g_lat_dir_ns += ns;
+}
+
+/* the calls of a histogram kept by a thread, which took ns in all */
+void lat_record_hist( int op, const struct lat_hist * src, long long ns )
+{
+    struct lat_hist * dst [2];
+    int i, k;
+
+    if ( g_lat_operand < 0 )
+        return;
+
+    dst[0] = &g_lat_groups[g_lat_operand].hist[op];
+    dst[1] = &g_lat_groups[g_lat_device].hist[op];
+    for ( k = 0; k < 2; k++ )
+    {
+        for ( i = 0; i < LAT_BUCKETS; i++ )
+            dst[k]->count[i] += src->count[i];
+        dst[k]->calls += src->calls;
+        if ( src->max_ns > dst[k]->max_ns )
+            dst[k]->max_ns = src->max_ns;
+    }
+    g_lat_dir_ns += ns;
+}
+
+/* the time below which pct percent of the calls took */
+long long lat_percentile( const struct lat_hist * hp, double pct )
+{
+    long long want = (long long)( hp->calls * pct / 100.0 + 0.999999 );
+    long long seen = 0;
+    int i;
+
+    if ( want < 1 )
+        want = 1;
+
+    for ( i = 0; i < LAT_BUCKETS; i++ )
+    {
+        seen += hp->count[i];
+        if ( seen >= want )
+            break;
+    }
+
+    /* the bucket is reported by its top, but never above the maximum */
+    return i < LAT_BUCKETS && lat_bucket_high ( i ) < hp->max_ns ?
+           lat_bucket_high ( i ) : hp->max_ns;
+}
+
+void lat_report()
+{
+    static const char * op_names[LAT_OPS] =
+        { "opendir", READDIR_NAME, "lstat", "readlink", "fts_children" };
+    struct lat_group * gp;
+    struct lat_hist * hp;
+    int i, op, by_dev;
+
+    lat_end_dir ();
+
+    fprintf ( stderr, "%-16s %10s %12s %12s %12s\n",
+        "latency", "calls", "p50 us", "p99 us", "max us" );
+
+    /* the operands first, then the devices */
+    for ( by_dev = 0; by_dev < 2; by_dev++ )
+    {
+        for ( i = 0; i < g_lat_ngroups; i++ )
+        {
+            gp = &g_lat_groups[i];
+            if ( ( gp->name == NULL ) != by_dev )
+                continue;
+
+            if ( by_dev )
+                fprintf ( stderr, "device %u,%u\n",
+                    (unsigned)major ( gp->dev ), (unsigned)minor ( gp->dev ) );
+            else
+                fprintf ( stderr, "operand %s\n", gp->name );
+
+            for ( op = 0; op < LAT_OPS; op++ )
+            {
+                hp = &gp->hist[op];
+                if ( hp->calls == 0 )
+                    continue;
+                fprintf ( stderr, "  %-14s %10lld %12.1f %12.1f %12.1f\n",
+                    op_names[op], hp->calls,
+                    lat_percentile ( hp, 50 ) / 1e3,
+                    lat_percentile ( hp, 99 ) / 1e3, hp->max_ns / 1e3 );
+            }
+        }
+    }
+
+    fprintf ( stderr, "slowest directories ( us, all calls )\n" );
+    for ( i = 0; i < g_lat_nslowest; i++ )
+        fprintf ( stderr, "  %12.1f  %s\n", g_lat_slowest[i].ns / 1e3,
+            g_lat_slowest[i].path );
+}
+
+/*
+    --dedup-links
+*/
+
+/* returns 1 if (dev, ino) was in the set already, else adds it */
+int link_set_add( struct link_set * lp, dev_t dev, ino_t ino )
+{
+    struct ino_set * sp = NULL;
+    uint64_t * old;
+    size_t old_size, i, h;
+    int d;
+
+    for ( d = 0; d < lp->ndevs; d++ )
+    {
+        if ( lp->devs[d].dev == dev )
+        {
+            sp = &lp->devs[d];
+            break;
+        }
+    }
+
+    if ( sp == NULL )
+    {
+        lp->devs = realloc ( lp->devs, ( lp->ndevs + 1 ) * sizeof(*sp) );
+        if ( lp->devs == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        sp = &lp->devs[lp->ndevs++];
+        memset ( sp, 0, sizeof(*sp) );
+        sp->dev = dev;
+    }
+
+    if ( ino == 0 )
+    {
+        if ( sp->has_zero )
+            return 1;
+        sp->has_zero = 1;
+        return 0;
+    }
+
+    /* at most 3/4 full, doubled and rehashed past that */
+    if ( ( sp->count + 1 ) * 4 > sp->size * 3 )
+    {
+        old = sp->slots;
+        old_size = sp->size;
+        sp->size = old_size ? old_size * 2 : 1024;
+        sp->slots = calloc ( sp->size, sizeof(uint64_t) );
+        if ( sp->slots == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        for ( i = 0; i < old_size; i++ )
+        {
+            if ( old[i] == 0 )
+                continue;
+            for ( h = old[i] * 0x9e3779b97f4a7c15ULL;
+                  sp->slots[h & ( sp->size - 1 )] != 0; h++ )
+                ;
+            sp->slots[h & ( sp->size - 1 )] = old[i];
+        }
+        free ( old );
+    }
+
+    for ( h = (uint64_t)ino * 0x9e3779b97f4a7c15ULL;
+          sp->slots[h & ( sp->size - 1 )] != 0; h++ )
+    {
+        if ( sp->slots[h & ( sp->size - 1 )] == (uint64_t)ino )
+            return 1;
+    }
+    sp->slots[h & ( sp->size - 1 )] = ino;
+    sp->count++;
+    return 0;
+}
+
+/* a hard linked file whose blocks were counted already */
+int counted_before( struct link_set * lp, const struct stat * statp )
+{
+    if ( ! f_dedup_links_option || statp->st_nlink < 2 ||
+         S_ISDIR ( statp->st_mode ) )
+        return 0;
+    return link_set_add ( lp, statp->st_dev, statp->st_ino );
+}
+
+/*
+    --include, --exclude and --regex
+
+    the names read from a directory are matched before lstat(), so an
+    entry that is filtered out costs a comparison or two of its name
+*/
+
+/* kept as given until getopt() is done, see filters_compile() */
+void filter_add( const char * pattern, int exclude, int regex )
+{
+    struct name_filter * fp;
+
+    g_filters = realloc ( g_filters,
+        ( g_filter_count + 1 ) * sizeof(struct name_filter) );
+    if ( g_filters == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    fp = &g_filters[g_filter_count++];
+    memset ( fp, 0, sizeof(*fp) );
+    fp->pattern = pattern;
+    fp->exclude = exclude;
+    fp->kind = regex ? FILTER_REGEX : FILTER_GLOB;
+    if ( ! exclude )
+        g_filter_includes++;
+}
+
+void filters_compile()
+{
+    struct name_filter * fp;
+    const char * p;
+    size_t len, stars, wild;
+    char errbuf [256];
+    int i, err;
+
+    for ( i = 0; i < g_filter_count; i++ )
+    {
+        fp = &g_filters[i];
+
+        if ( fp->kind == FILTER_REGEX )
+        {
+            err = regcomp ( &fp->regex, fp->pattern, REG_EXTENDED | REG_NOSUB );
+            if ( err != 0 )
+            {
+                regerror ( err, &fp->regex, errbuf, sizeof(errbuf) );
+                fprintf ( stderr, "--regex '%s': %s\n", fp->pattern, errbuf );
+                exit (1);
+            }
+            continue;
+        }
+
+        /* '*' at either end and no other wildcard : a literal */
+        len = strlen ( fp->pattern );
+        for ( p = fp->pattern, stars = 0, wild = 0; *p; p++ )
+        {
+            if ( *p == '*' )
+                stars++;
+            else if ( *p == '?' || *p == '[' || *p == '\\' )
+                wild++;
+        }
+        if ( wild )
+            continue;
+
+        p = fp->pattern;
+        if ( stars == 0 )
+            fp->kind = FILTER_EXACT;
+        else if ( stars == 1 && p[len - 1] == '*' )
+            fp->kind = FILTER_PREFIX;
+        else if ( stars == 1 && p[0] == '*' )
+            fp->kind = FILTER_SUFFIX;
+        else if ( stars == 2 && len > 2 && p[0] == '*' && p[len - 1] == '*' )
+            fp->kind = FILTER_CONTAINS;
+        else
+            continue;
+
+        if ( fp->kind == FILTER_SUFFIX || fp->kind == FILTER_CONTAINS )
+        {
+            p++;
+            len--;
+        }
+        if ( fp->kind != FILTER_EXACT && p[len - 1] == '*' )
+            len--;
+        fp->literal = strndup ( p, len );
+        if ( fp->literal == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        fp->literal_len = len;
+    }
+
+    /* the times depend on -c and -u, which may come after */
+    if ( g_pred_newer_file != NULL )
+    {
+        struct stat stat_buf;
+
+        if ( stat ( g_pred_newer_file, &stat_buf ) < 0 )
+        {
+            fprintf ( stderr, "--newer: can't stat '%s': %s\n",
+                g_pred_newer_file, strerror ( errno ) );
+            exit (1);
+        }
+        g_pred_newer_ns = entry_time_ns ( &stat_buf );
+    }
+    if ( g_pred_older_age > 0 )
+    {
+        struct timespec now;
+
+        clock_gettime ( CLOCK_REALTIME, &now );
+        g_pred_older_ns = timespec_to_ns ( &now ) -
+            g_pred_older_age * 1000000000LL;
+    }
+
+    g_listing_filtered = g_filter_count || f_predicate_option;
+}
+
+int filter_match( const struct name_filter * fp, const char * name )
+{
+    size_t len;
+
+    switch ( fp->kind )
+    {
+        case FILTER_EXACT:
+            return strcmp ( name, fp->literal ) == 0;
+        case FILTER_PREFIX:
+            return strncmp ( name, fp->literal, fp->literal_len ) == 0;
+        case FILTER_SUFFIX:
+            len = strlen ( name );
+            return len >= fp->literal_len &&
+                memcmp ( name + len - fp->literal_len, fp->literal,
+                         fp->literal_len ) == 0;
+        case FILTER_CONTAINS:
+            return strstr ( name, fp->literal ) != NULL;
+        case FILTER_GLOB:
+            return fnmatch ( fp->pattern, name, 0 ) == 0;
+        default:
+            return regexec ( &fp->regex, name, 0, NULL, 0 ) == 0;
+    }
+}
+
+/*
+    a name is listed if it matches one of the --include and --regex
+    patterns ( when there are any ) and none of the --exclude ones
+*/
+int name_wanted( const char * name )
+{
+    int i, included = g_filter_includes == 0;
+
+    for ( i = 0; i < g_filter_count; i++ )
+    {
+        if ( g_filters[i].exclude )
+        {
+            if ( filter_match ( &g_filters[i], name ) )
+                return 0;
+        }
+        else if ( ! included && filter_match ( &g_filters[i], name ) )
+            included = 1;
+    }
+    return included;
+}
+
+/*
+    --newer, --older-than, --min-size, --max-size, --type and --uid
+
+    --type is decided by d_type when the file system fills it in, with
+    the name filters, before lstat(). The others need the stat and are
+    checked right after it, before a file_info is made for the entry.
+*/
+
+/* a number of bytes, with an optional K, M, G, T or P ( 1024s ) */
+long long parse_size( const char * option, const char * arg )
+{
+    static const char units[] = "KMGTP";
+    const char * u;
+    char * end;
+    long long n;
+
+    errno = 0;
+    n = strtoll ( arg, &end, 10 );
+    if ( end != arg && *end != '\0' && end[1] == '\0' &&
+         ( u = strchr ( units, toupper ( (unsigned char)*end ) ) ) != NULL )
+    {
+        for ( ; u >= units; u-- )
+            n = n > LLONG_MAX / 1024 ? LLONG_MAX : n * 1024;
+        end++;
+    }
+    if ( end == arg || *end != '\0' || n < 0 || errno != 0 )
+    {
+        fprintf ( stderr, "%s: bad size '%s'\n", option, arg );
+        exit (1);
+    }
+    return n;
+}
+
+/* seconds, from a number of s, m, h, d ( the default ) or w */
+long long parse_age( const char * option, const char * arg )
+{
+    char * end;
+    long long n, unit = 86400;
+
+    errno = 0;
+    n = strtoll ( arg, &end, 10 );
+    if ( end != arg && *end != '\0' && end[1] == '\0' )
+    {
+        switch ( *end++ )
+        {
+            case 's': unit = 1; break;
+            case 'm': unit = 60; break;
+            case 'h': unit = 3600; break;
+            case 'd': unit = 86400; break;
+            case 'w': unit = 7 * 86400; break;
+            default: end--; break;
+        }
+    }
+    if ( end == arg || *end != '\0' || n < 0 || errno != 0 ||
+         n > LLONG_MAX / 1000000000LL / unit )
+    {
+        fprintf ( stderr, "%s: bad age '%s'\n", option, arg );
+        exit (1);
+    }
+    return n * unit;
+}
+
+/* --type=TYPES, letters as find -type takes them */
+void predicate_type( const char * arg )
+{
+    static const char letters[] = "fdlpscb";
+    static const unsigned char types[] =
+        { DT_REG, DT_DIR, DT_LNK, DT_FIFO, DT_SOCK, DT_CHR, DT_BLK };
+    const char * l;
+
+    for ( ; *arg != '\0'; arg++ )
+    {
+        if ( *arg == ',' )
+            continue;
+        l = strchr ( letters, *arg );
+        if ( l == NULL )
+        {
+            fprintf ( stderr, "--type: '%c' isn't one of %s\n", *arg,
+                letters );
+            exit (1);
+        }
+        g_pred_types |= 1u << types[l - letters];
+    }
+}
+
+/* --uid=USER, a name or a number */
+void predicate_uid( const char * arg )
+{
+    struct passwd * password = getpwnam ( arg );
+    char * end;
+
+    if ( password != NULL )
+        g_pred_uid = password->pw_uid;
+    else
+    {
+        errno = 0;
+        g_pred_uid = strtoul ( arg, &end, 10 );
+        if ( end == arg || *end != '\0' || errno != 0 )
+        {
+            fprintf ( stderr, "--uid: no user '%s'\n", arg );
+            exit (1);
+        }
+    }
+    g_pred_has_uid = 1;
+}
+
+/* the time -c and -u choose, as it is shown and sorted by */
+long long entry_time_ns( const struct stat * statp )
+{
+    if ( f_c_option )
+        return timespec_to_ns ( (struct timespec *)&statp->st_ctim );
+    if ( f_u_option )
+        return timespec_to_ns ( (struct timespec *)&statp->st_atim );
+    return timespec_to_ns ( (struct timespec *)&statp->st_mtim );
+}
+
+/* what can be told from a directory entry, before its lstat() */
+int dirent_wanted( const struct dirent * dirp )
+{
+    if ( g_pred_types && dirp->d_type != DT_UNKNOWN &&
+         ! ( g_pred_types & ( 1u << dirp->d_type ) ) )
+        return 0;
+    return ! g_filter_count || name_wanted ( dirp->d_name );
+}
+
+/* the rest, cheapest first */
+int stat_wanted( const struct stat * statp )
+{
+    long long t;
+
+    if ( g_pred_types &&
+         ! ( g_pred_types & ( 1u << IFTODT ( statp->st_mode ) ) ) )
+        return 0;
+    if ( g_pred_min_size >= 0 && statp->st_size < g_pred_min_size )
+        return 0;
+    if ( g_pred_max_size >= 0 && statp->st_size > g_pred_max_size )
+        return 0;
+    if ( g_pred_has_uid && statp->st_uid != g_pred_uid )
+        return 0;
+    if ( g_pred_newer_ns != LLONG_MIN || g_pred_older_ns != LLONG_MAX )
+    {
+        t = entry_time_ns ( statp );
+        if ( t <= g_pred_newer_ns || t >= g_pred_older_ns )
+            return 0;
+    }
+    return 1;
+}
+
+/* both, for the entries fts has stat()ed already */
+int entry_wanted( const char * name, const struct stat * statp )
+{
+    if ( g_filter_count && ! name_wanted ( name ) )
+        return 0;
+    return ! f_predicate_option || stat_wanted ( statp );
+}
+
+/*
+    --du
+
+    before a directory is listed without -R ( or with -RS, see
+    du_begin_fts_dir() ), the whole tree under it is read by up to
+    DU_THREADS_MAX threads, each taking the next directory waiting to be
+    read and adding the ones it finds. Every directory comes after
+    its parent in g_du_dirs, so one pass from the end adds each subtree
+    into its parent. The listing then finds a directory's totals by its
+    device and inode. Nothing is followed across symbolic links and
+    every entry is counted, hidden or not.
+*/
+
+/* called with g_du_lock held, or before the threads start */
+long du_add_dir( const char * path, const struct stat * statp,
+                 long parent )
+{
+    struct du_dir * dp;
+
+    if ( g_du_count == g_du_alloc )
+    {
+        g_du_alloc = g_du_alloc ? g_du_alloc * 2 : 256;
+        g_du_dirs = realloc ( g_du_dirs, g_du_alloc * sizeof(*g_du_dirs) );
+        g_du_queue = realloc ( g_du_queue, g_du_alloc * sizeof(*g_du_queue) );
+        if ( g_du_dirs == NULL || g_du_queue == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+    }
+
+    dp = &g_du_dirs[g_du_count];
+    memset ( dp, 0, sizeof(*dp) );
+    dp->dev = statp->st_dev;
+    dp->ino = statp->st_ino;
+    dp->parent = parent;
+    dp->path = strdup ( path );
+    if ( dp->path == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+
+    g_du_queue[g_du_queued++] = g_du_count;
+    return g_du_count++;
+}
+
+/* read one directory, without g_du_lock */
+void du_read_dir( long index )
+{
+    struct du_dir totals;
+    struct dirent * dirp;
+    struct stat stat_buf;
+    char child [PATH_MAX];
+    char * path;
+    DIR * dp;
+
+    pthread_mutex_lock ( &g_du_lock );
+    path = g_du_dirs[index].path;
+    g_du_dirs[index].path = NULL;
+    pthread_mutex_unlock ( &g_du_lock );
+
+    memset ( &totals, 0, sizeof(totals) );
+
+    if ( ( dp = opendir ( path ) ) == NULL )
+    {
+        fprintf ( stderr, "can't open '%s': %s\n", path, strerror ( errno ) );
+        free ( path );
+        return;
+    }
+
+    while ( ( dirp = readdir ( dp ) ) != NULL )
+    {
+        if ( strcmp ( dirp->d_name, "." ) == 0 ||
+             strcmp ( dirp->d_name, ".." ) == 0 )
+            continue;
+
+        if ( fstatat ( dirfd ( dp ), dirp->d_name, &stat_buf,
+                       AT_SYMLINK_NOFOLLOW ) < 0 )
+            continue;
+
+        totals.entries++;
+        if ( f_dedup_links_option && stat_buf.st_nlink > 1 &&
+             ! S_ISDIR ( stat_buf.st_mode ) )
+        {
+            int seen;
+
+            pthread_mutex_lock ( &g_du_lock );
+            seen = counted_before ( &g_links_walked, &stat_buf );
+            pthread_mutex_unlock ( &g_du_lock );
+            if ( seen )
+                continue;
+        }
+        totals.blocks += stat_buf.st_blocks;
+        totals.bytes += stat_buf.st_size;
+
+        if ( S_ISDIR ( stat_buf.st_mode ) )
+        {
+            snprintf ( child, sizeof(child), "%s/%s", path, dirp->d_name );
+            pthread_mutex_lock ( &g_du_lock );
+            du_add_dir ( child, &stat_buf, index );
+            pthread_cond_signal ( &g_du_cond );
+            pthread_mutex_unlock ( &g_du_lock );
+        }
+    }
+    closedir ( dp );
+    free ( path );
+
+    pthread_mutex_lock ( &g_du_lock );
+    g_du_dirs[index].blocks = totals.blocks;
+    g_du_dirs[index].bytes = totals.bytes;
+    g_du_dirs[index].entries = totals.entries;
+    pthread_mutex_unlock ( &g_du_lock );
+}
+
+void * du_worker( void * arg )
+{
+    long index;
+
+    pthread_mutex_lock ( &g_du_lock );
+    for ( ;; )
+    {
+        /* nothing to read, but a busy thread may still find more */
+        while ( g_du_queued == 0 && g_du_busy > 0 )
+            pthread_cond_wait ( &g_du_cond, &g_du_lock );
+        if ( g_du_queued == 0 )
+            break;
+
+        index = g_du_queue[--g_du_queued];
+        g_du_busy++;
+        pthread_mutex_unlock ( &g_du_lock );
+
+        du_read_dir ( index );
+
+        pthread_mutex_lock ( &g_du_lock );
+        g_du_busy--;
+        if ( g_du_busy == 0 && g_du_queued == 0 )
+            pthread_cond_broadcast ( &g_du_cond );
+    }
+    pthread_mutex_unlock ( &g_du_lock );
+    return NULL;
+}
+
+/* open addressing, twice as many slots as directories */
+void du_index_build()
+{
+    unsigned long long h;
+    long i;
+
+    free ( g_du_slots );
+    for ( g_du_slot_count = 64; g_du_slot_count < g_du_count * 2; )
+        g_du_slot_count *= 2;
+    g_du_slots = malloc ( g_du_slot_count * sizeof(*g_du_slots) );
+    if ( g_du_slots == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    memset ( g_du_slots, 0xff, g_du_slot_count * sizeof(*g_du_slots) );
+
+    for ( i = 0; i < g_du_count; i++ )
+    {
+        h = ( g_du_dirs[i].ino * 0x9e3779b97f4a7c15ULL ) ^ g_du_dirs[i].dev;
+        while ( g_du_slots[h & ( g_du_slot_count - 1 )] >= 0 )
+            h++;
+        g_du_slots[h & ( g_du_slot_count - 1 )] = i;
+    }
+}
+
+/* the index of a directory in g_du_dirs, -1 if it wasn't walked */
+long du_find( dev_t dev, ino_t ino )
+{
+    unsigned long long h = ( ino * 0x9e3779b97f4a7c15ULL ) ^ dev;
+    long i;
+
+    if ( g_du_slots == NULL )
+        return -1;
+
+    for ( ; ( i = g_du_slots[h & ( g_du_slot_count - 1 )] ) >= 0; h++ )
+        if ( g_du_dirs[i].ino == ino && g_du_dirs[i].dev == dev )
+            return i;
+    return -1;
+}
+
+/* add up the tree under path, unless an earlier operand had it */
+void du_walk( const char * path )
+{
+    pthread_t threads [DU_THREADS_MAX];
+    int started [DU_THREADS_MAX];
+    long nthreads = sysconf ( _SC_NPROCESSORS_ONLN );
+    struct stat stat_buf;
+    long first = g_du_count, i;
+    int k;
+
+    if ( stat ( path, &stat_buf ) < 0 ||
+         du_find ( stat_buf.st_dev, stat_buf.st_ino ) >= 0 )
+        return;
+
+    if ( nthreads > DU_THREADS_MAX )
+        nthreads = DU_THREADS_MAX;
+    if ( nthreads < 1 )
+        nthreads = 1;
+
+    du_add_dir ( path, &stat_buf, -1 );
+
+    /* if no thread can be made, this one does it all */
+    for ( k = 0; k < nthreads; k++ )
+        started[k] = pthread_create ( &threads[k], NULL, du_worker,
+                                      NULL ) == 0;
+    if ( ! started[0] )
+        du_worker ( NULL );
+    for ( k = 0; k < nthreads; k++ )
+        if ( started[k] )
+            pthread_join ( threads[k], NULL );
+
+    /* bottom-up : children come after their parents */
+    for ( i = g_du_count - 1; i > first; i-- )
+    {
+        struct du_dir * parent = &g_du_dirs[g_du_dirs[i].parent];
+
+        parent->blocks += g_du_dirs[i].blocks;
+        parent->bytes += g_du_dirs[i].bytes;
+        parent->entries += g_du_dirs[i].entries;
+    }
+
+    du_index_build ();
+}
+
+/*
+    the directory recorded in the list is about to be printed : find its
+    totals, and give its subdirectories theirs to be sorted by
+*/
+void du_list_dir( int dir_fd, const struct stat * statp )
+{
+    struct stat stat_buf;
+
+    g_du_current = -1;
+    if ( statp == NULL )
+    {
+        if ( fstat ( dir_fd, &stat_buf ) < 0 )
+            return;
+        statp = &stat_buf;
+    }
+    g_du_current = du_find ( statp->st_dev, statp->st_ino );
+    du_sort_sizes ();
+}
+
+/* -S : the subdirectories in the list sort by the bytes below them */
+void du_sort_sizes()
+{
+    struct file_info * node_ptr;
+    long i;
+
+    for ( node_ptr = file_info_list_head; node_ptr != NULL;
+          node_ptr = node_ptr->next )
+    {
+        if ( ! S_ISDIR ( node_ptr->stat_info.st_mode ) ||
+             strcmp ( node_ptr->path_name, ".." ) == 0 )
+            continue;
+
+        i = du_find ( node_ptr->stat_info.st_dev, node_ptr->stat_info.st_ino );
+        if ( i >= 0 )
+            node_ptr->sort_size = g_du_dirs[i].bytes;
+    }
+}
+
+/*
+    --du with -R
+
+    the totals are added up as fts goes, with no walk of their own : a
+    directory's entries into g_du_levels at its level as it is listed,
+    and the whole into its parent's when fts_read() comes back up from
+    it, FTS_DP, where they are printed. Only what -R goes into is
+    counted. -S needs the totals of subdirectories before fts gets into
+    them, so with -S du_walk() still reads the tree first for the sort.
+*/
+
+void du_begin_fts_dir( const FTSENT * p )
+{
+    if ( p->fts_level >= g_du_level_alloc )
+    {
+        g_du_level_alloc = p->fts_level + 16;
+        g_du_levels = realloc ( g_du_levels,
+            g_du_level_alloc * sizeof(*g_du_levels) );
+        if ( g_du_levels == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+    }
+    memset ( &g_du_levels[p->fts_level], 0, sizeof(*g_du_levels) );
+}
+
+/* an entry of p, listed or not */
+void du_count_fts_entry( const FTSENT * p, const struct stat * statp )
+{
+    struct du_dir * dp = &g_du_levels[p->fts_level];
+
+    dp->entries++;
+    if ( counted_before ( &g_links_fts, statp ) )
+        return;
+    dp->blocks += statp->st_blocks;
+    dp->bytes += statp->st_size;
+}
+
+void du_end_fts_dir( const FTSENT * p )
+{
+    struct du_dir * dp = &g_du_levels[p->fts_level];
+
+    if ( p->fts_level > FTS_ROOTLEVEL )
+    {
+        dp[-1].blocks += dp->blocks;
+        dp[-1].bytes += dp->bytes;
+        dp[-1].entries += dp->entries;
+    }
+
+    if ( ! f_format_option )
+    {
+        out_printf ( "%s: ", p->fts_path );
+        du_print_totals ( dp );
+        out_printf ( "\n" );
+    }
+}
+
+void du_print_totals( const struct du_dir * dp )
+{
+    out_printf ( "subtree %llu blocks, ", display_blocks ( dp->blocks ) );
+#ifdef ENABLE_H_OPTION
+    if ( f_h_option )
+        out_human ( dp->bytes, "", 0 );
+    else
+#endif
+    {
+        out_uint ( dp->bytes );
+        out_printf ( " bytes" );
+    }
+    out_printf ( ", %llu entries\n", dp->entries );
+}
+
+/*
+    sort methods
+
+    the nodes are put in an array with their keys and sorted by libls's
+    ls_sort(), a merge sort, which keeps entries with the same key in the
+    order they were read. With PARALLEL_MIN entries or more it sorts and
+    merges with as many threads as parallel_threads() says.
+*/
 
-    struct file_info * node_ptr = file_info_list_head;
-    
-    /* --- process -C --- */
-    if ( f_C_option )
+/* how many threads to sort and print count entries with */
+int parallel_threads( size_t count )
+{
+    long nthreads = g_threads;
+
+    if ( count < PARALLEL_MIN )
+        return 1;
+    if ( nthreads == 0 )
+        nthreads = sysconf ( _SC_NPROCESSORS_ONLN );
+    if ( nthreads > PARALLEL_THREADS_MAX )
+        nthreads = PARALLEL_THREADS_MAX;
+    if ( nthreads < 1 )
+        nthreads = 1;
+    return nthreads;
+}
+
+
+/*
+    program entry
+*/
+
+/*
+    --count
+
+    the names come straight from getdents64(), into a buffer, and are
+    only looked at : nothing is stat()ed ( unless the file system leaves
+    d_type unknown ), stored or sorted. With -R a thread goes down into
+    each subdirectory as it finds it, keeping the directories above open
+    with their buffers, so it needs memory for the depth of the tree
+    and not its width. A thread with a subdirectory hands it over when
+    another one is idle, up to COUNT_THREADS_MAX of them. Symbolic links
+    aren't followed.
+*/
+
+/* the next name of lv, 0 at its end */
+int count_next( struct count_level * lv, const char ** name,
+                unsigned char * type )
+{
+#ifdef __linux__
+    struct count_dirent64 * dp;
+
+    if ( lv->pos >= lv->len )
     {
-        /* 1. create a matrix */
+        lv->len = syscall ( SYS_getdents64, lv->fd, lv->buf, COUNT_BUF_SIZE );
+        lv->pos = 0;
+        if ( lv->len <= 0 )
+            return 0;
+    }
+    dp = (struct count_dirent64 *)( lv->buf + lv->pos );
+    lv->pos += dp->d_reclen;
+    *name = dp->d_name;
+    *type = dp->d_type;
+    return 1;
+#else
+    struct dirent * dirp;
+
+    if ( lv->dp == NULL )
+        lv->dp = fdopendir ( lv->fd );
+    if ( lv->dp == NULL || ( dirp = readdir ( lv->dp ) ) == NULL )
+        return 0;
+    *name = dirp->d_name;
+    *type = dirp->d_type;
+    return 1;
+#endif
+}
 
-        char * columns_str = "COLUMNS"; 
-        char * columns;
-        int col = 0;
-        int row = 0;
-        int file_info_list_len = get_file_info_list_length();
-        columns = getenv ( columns_str );
-        if ( NULL == columns )
+/* give a directory to an idle thread, 0 if none takes it */
+int count_hand_off( int fd, int level )
+{
+    int taken = 0;
+
+    if ( g_count_idle == 0 )        /* looked at unlocked, a hint */
+        return 0;
+
+    pthread_mutex_lock ( &g_count_lock );
+    if ( g_count_idle > g_count_queued &&
+         g_count_queued < COUNT_THREADS_MAX )
+    {
+        g_count_queue[g_count_queued].fd = fd;
+        g_count_queue[g_count_queued++].level = level;
+        pthread_cond_signal ( &g_count_cond );
+        taken = 1;
+    }
+    pthread_mutex_unlock ( &g_count_lock );
+    return taken;
+}
+
+/* whether -R goes into name, a directory level below the operand */
+int count_descend( int dir_fd, const char * name, int level )
+{
+    struct stat stat_buf;
+
+    if ( g_max_depth >= 0 && level > g_max_depth )
+        return 0;
+    if ( g_prune_count && prune_match ( name ) )
+        return 0;
+    if ( f_xdev_option &&
+         ( fstatat ( dir_fd, name, &stat_buf, AT_SYMLINK_NOFOLLOW ) < 0 ||
+           stat_buf.st_dev != g_root_dev ) )
+        return 0;
+    return 1;
+}
+
+/* count fd's entries, and with -R those below it; fd is level
+   directories below the operand, and is closed */
+void count_dir( int fd, int level, struct count_totals * tp )
+{
+    struct count_level * levels = NULL, * lv;
+    int depth = 0, alloc = 0, child, i;
+    const char * name;
+    unsigned char type;
+    struct stat stat_buf;
+
+    /* the first level, then one for each directory gone down into */
+    for ( ;; )
+    {
+        if ( fd >= 0 )
         {
-            col = COLUMNS;
+            if ( depth == alloc )
+            {
+                alloc = alloc ? alloc * 2 : 16;
+                levels = realloc ( levels, alloc * sizeof(*levels) );
+                if ( levels == NULL )
+                {
+                    fprintf ( stderr, "malloc() error\n" );
+                    exit (1);
+                }
+                memset ( levels + depth, 0,
+                         ( alloc - depth ) * sizeof(*levels) );
+            }
+            lv = &levels[depth++];
+            lv->fd = fd;
+#ifdef __linux__
+            /* kept for the next directory at this depth */
+            if ( lv->buf == NULL && ( lv->buf = malloc ( COUNT_BUF_SIZE ) )
+                 == NULL )
+            {
+                fprintf ( stderr, "malloc() error\n" );
+                exit (1);
+            }
+            lv->len = lv->pos = 0;
+#else
+            lv->dp = NULL;
+#endif
+            fd = -1;
         }
-        else
+        if ( depth == 0 )
+            break;
+
+        lv = &levels[depth - 1];
+        if ( ! count_next ( lv, &name, &type ) )
         {
-            col = atoi ( columns );
+#ifdef __linux__
+            close ( lv->fd );
+#else
+            if ( lv->dp != NULL )
+                closedir ( lv->dp );
+            else
+                close ( lv->fd );
+#endif
+            depth--;
+            continue;
         }
-        row = file_info_list_len/col;
 
-        int c = 0, r = 0;
-        struct file_info * matrix [row][col];
+        /* . and .. are listed with -a, and never gone into */
+        if ( name[0] == '.' && ( name[1] == '\0' ||
+             ( name[1] == '.' && name[2] == '\0' ) ) )
+        {
+            if ( f_a_option )
+                tp->entries++, tp->types[type & ( COUNT_TYPES - 1 )]++;
+            continue;
+        }
+        if ( name[0] == '.' && ! f_a_option && ! f_A_option )
+            continue;
+
+        if ( type == DT_UNKNOWN &&
+             ( f_R_option || g_pred_types || f_count_option == 2 ) &&
+             fstatat ( lv->fd, name, &stat_buf, AT_SYMLINK_NOFOLLOW ) == 0 )
+            type = IFTODT ( stat_buf.st_mode );
+
+        if ( ( ! g_pred_types || ( g_pred_types & ( 1u << type ) ) ) &&
+             ( ! g_filter_count || name_wanted ( name ) ) )
+            tp->entries++, tp->types[type & ( COUNT_TYPES - 1 )]++;
+
+        if ( f_R_option && type == DT_DIR &&
+             count_descend ( lv->fd, name, level + depth ) )
+        {
+            child = openat ( lv->fd, name,
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC );
+            if ( child < 0 )
+                fprintf ( stderr, "can't open '%s': %s\n", name,
+                    strerror ( errno ) );
+            else if ( ! count_hand_off ( child, level + depth ) )
+                fd = child;
+        }
+    }
+
+#ifdef __linux__
+    for ( i = 0; i < alloc; i++ )
+        free ( levels[i].buf );
+#else
+    (void)i;
+#endif
+    free ( levels );
+}
+
+void * count_worker( void * arg )
+{
+    struct count_totals totals;
+    struct count_job job;
+    int i;
+
+    memset ( &totals, 0, sizeof(totals) );
+
+    pthread_mutex_lock ( &g_count_lock );
+    for ( ;; )
+    {
+        /* nothing to read, but a busy thread may still hand some over */
+        g_count_idle++;
+        while ( g_count_queued == 0 && g_count_busy > 0 )
+            pthread_cond_wait ( &g_count_cond, &g_count_lock );
+        g_count_idle--;
+        if ( g_count_queued == 0 )
+            break;
+
+        job = g_count_queue[--g_count_queued];
+        g_count_busy++;
+        pthread_mutex_unlock ( &g_count_lock );
+
+        count_dir ( job.fd, job.level, &totals );
+
+        pthread_mutex_lock ( &g_count_lock );
+        g_count_busy--;
+        if ( g_count_busy == 0 && g_count_queued == 0 )
+            pthread_cond_broadcast ( &g_count_cond );
+    }
+
+    g_count_totals.entries += totals.entries;
+    for ( i = 0; i < COUNT_TYPES; i++ )
+        g_count_totals.types[i] += totals.types[i];
+    pthread_mutex_unlock ( &g_count_lock );
+    return NULL;
+}
+
+/* "count path", and with --count=types the counts of each type */
+void count_operand( const char * path )
+{
+    static const char * const type_names [COUNT_TYPES] =
+    {
+        [DT_UNKNOWN] = "unknown", [DT_FIFO] = "fifo", [DT_CHR] = "char",
+        [DT_DIR] = "dir", [DT_BLK] = "block", [DT_REG] = "file",
+        [DT_LNK] = "link", [DT_SOCK] = "socket", [14] = "whiteout"
+    };
+    pthread_t threads [COUNT_THREADS_MAX];
+    int started [COUNT_THREADS_MAX];
+    long nthreads = sysconf ( _SC_NPROCESSORS_ONLN );
+    struct stat stat_buf;
+    int fd, k;
+
+    memset ( &g_count_totals, 0, sizeof(g_count_totals) );
+
+    if ( stat ( path, &stat_buf ) < 0 )
+    {
+        fprintf ( stderr, "stat error for %s\n", path );
+        return;
+    }
+
+    if ( ! S_ISDIR ( stat_buf.st_mode ) )
+    {
+        g_count_totals.entries = 1;
+        g_count_totals.types[IFTODT ( stat_buf.st_mode )] = 1;
+    }
+    else if ( ( fd = open ( path, O_RDONLY | O_DIRECTORY | O_CLOEXEC ) ) < 0 )
+    {
+        fprintf ( stderr, "can't open '%s': %s\n", path, strerror ( errno ) );
+        return;
+    }
+    else if ( ! f_R_option )
+        count_dir ( fd, 0, &g_count_totals );
+    else
+    {
+        if ( nthreads > COUNT_THREADS_MAX )
+            nthreads = COUNT_THREADS_MAX;
+        if ( nthreads < 1 )
+            nthreads = 1;
+        if ( g_count_queue == NULL &&
+             ( g_count_queue = malloc ( COUNT_THREADS_MAX *
+                                        sizeof(*g_count_queue) ) ) == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        g_root_dev = stat_buf.st_dev;
+        g_count_queue[0].fd = fd;
+        g_count_queue[0].level = 0;
+        g_count_queued = 1;
+
+        /* if no thread can be made, this one does it all */
+        for ( k = 0; k < nthreads; k++ )
+            started[k] = pthread_create ( &threads[k], NULL, count_worker,
+                                          NULL ) == 0;
+        if ( ! started[0] )
+            count_worker ( NULL );
+        for ( k = 0; k < nthreads; k++ )
+            if ( started[k] )
+                pthread_join ( threads[k], NULL );
+    }
+
+    out_uint ( g_count_totals.entries );
+    out_putc ( ' ' );
+    out_write ( path, strlen ( path ) );
+    if ( f_count_option == 2 )
+    {
+        for ( k = 0; k < COUNT_TYPES; k++ )
+        {
+            if ( g_count_totals.types[k] == 0 )
+                continue;
+            out_printf ( " %s=", type_names[k] ? type_names[k] : "other" );
+            out_uint ( g_count_totals.types[k] );
+        }
+    }
+    out_putc ( '\n' );
+}
+
+/*
+    -R
+
+    fts walks the tree physically, the way a listing without -R lstat()s
+    its entries, and doesn't follow a symbolic link unless it is an
+    operand. When nothing printed or sorted comes from stat(), FTS_NOSTAT
+    has fts tell directories from the rest by d_type and stat() only
+    those it goes into; fts_statp is never filled in then, and every
+    entry is recorded with g_no_stat. The children fts_children()
+    returns are the ones fts_read() goes down into, statted once; an
+    empty directory, for which it returns none, is skipped so fts_read()
+    doesn't read it a second time.
+*/
+
+/* whether the options use more of an entry than its name */
+int listing_needs_stat()
+{
+    return f_l_option || f_n_option || f_s_option || f_t_option ||
+        f_S_option || f_i_option || f_F_option || f_format_option ||
+        f_du_option || f_index_write_option || f_dedup_links_option ||
+        f_predicate_option;
+}
+
+/* once the options are known */
+int fts_options()
+{
+    /* --logical : as before, everything stat()ed through the links */
+    if ( f_logical_option )
+        return FTS_LOGICAL;
+
+    /* the paths of g_dir_path are used as they are, so no chdir() */
+    return FTS_PHYSICAL | FTS_COMFOLLOW | FTS_NOCHDIR |
+        ( listing_needs_stat () && ! g_fts_lstat ? 0 : FTS_NOSTAT );
+}
+
+/*
+    --max-depth, --one-file-system and --prune
+
+    a subdirectory is listed in its parent as any entry is, and when
+    fts_read() returns it, it is marked FTS_SKIP if -R isn't to go into
+    it : fts never opens it, and nothing below it costs a system call.
+    Marking it among fts_children()'s would not do, fts_read() goes to
+    the first of them without looking at its instruction. fts_dev is
+    filled in for directories even with FTS_NOSTAT.
+*/
+
+void prune_add( const char * pattern )
+{
+    g_prunes = realloc ( g_prunes, ( g_prune_count + 1 ) * sizeof(char *) );
+    if ( g_prunes == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    g_prunes[g_prune_count++] = pattern;
+}
+
+/* whether a directory's name matches one of the --prune globs */
+int prune_match( const char * name )
+{
+    int i;
+
+    for ( i = 0; i < g_prune_count; i++ )
+        if ( fnmatch ( g_prunes[i], name, FNM_PERIOD ) == 0 )
+            return 1;
+    return 0;
+}
+
+/* whether -R is to stay out of cur, a directory below the operand */
+int prune_dir( const FTSENT * cur )
+{
+    if ( cur->fts_info != FTS_D || cur->fts_level == FTS_ROOTLEVEL )
+        return 0;
+    if ( g_max_depth >= 0 && cur->fts_level > g_max_depth )
+        return 1;
+    if ( f_xdev_option && cur->fts_dev != g_root_dev )
+        return 1;
+    return g_prune_count && prune_match ( cur->fts_name );
+}
+
+/*
+    whether -R goes into p, a directory fts_read() returned; if not it
+    is marked FTS_SKIP, and fts_number tells its FTS_DP it was left out
+*/
+int fts_enter_dir( FTS * ftsp, FTSENT * p )
+{
+    if ( ! prune_dir ( p ) )
+        return 1;
+
+    fts_set ( ftsp, p, FTS_SKIP );
+    p->fts_number = 1;
+    free ( p->fts_pointer );
+    p->fts_pointer = NULL;
+    return 0;
+}
+
+/*
+    the stat of one of fts_children()'s. With g_fts_lstat, fts only
+    stat()s directories, for itself, and keeps nothing : the entries
+    are lstat()ed here, one timed call each as without -R, and a
+    directory's is kept in its fts_pointer for when fts_read() gets to
+    it. NULL if it is gone.
+*/
+struct stat * fts_child_stat( FTSENT * cur, struct stat * buf )
+{
+    char path [PATH_MAX];
+
+    if ( ! g_fts_lstat )
+        return g_fts_options & FTS_NOSTAT ? &g_no_stat : cur->fts_statp;
+
+    snprintf ( path, sizeof(path), "%s/%s", g_dir_path, cur->fts_name );
+    if ( timed_lstat ( path, buf ) < 0 )
+        return NULL;
+
+    if ( cur->fts_info == FTS_D && ! prune_dir ( cur ) )
+    {
+        cur->fts_pointer = malloc ( sizeof(*buf) );
+        if ( cur->fts_pointer == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        memcpy ( cur->fts_pointer, buf, sizeof(*buf) );
+    }
+    return buf;
+}
+
+/*
+    list p, a directory fts_read() returned for operand
+*/
+void list_fts_dir( FTS * ftsp, FTSENT * p, const char * operand )
+{
+    FTSENT * chp;
+    FTSENT * cur;
+    struct stat dir_stat;
+    struct stat stat_buf;
+    struct stat * statp = p->fts_statp;
+
+    /* --one-file-system stays on the operand's */
+    if ( p->fts_level == FTS_ROOTLEVEL )
+        g_root_dev = p->fts_dev;
+
+    /* the operand's was never lstat()ed as a child, FTS_COMFOLLOW
+       follows it */
+    if ( g_fts_lstat && p->fts_pointer != NULL )
+        statp = p->fts_pointer;
+    else if ( g_fts_lstat )
+    {
+        long long t;
+
+        TIMER_START ( t );
+        if ( stat ( p->fts_path, &dir_stat ) < 0 )
+            memset ( &dir_stat, 0, sizeof(dir_stat) );
+        TIMER_STOP ( LAT_LSTAT, lstat, t );
+        statp = &dir_stat;
+    }
+
+    /* print directory path */
+    g_dir_path = p->fts_path;
+    if ( ! f_format_option )
+        out_printf ( "%s:\n", p->fts_path );
+
+    if ( f_index_write_option )
+        index_begin_dir ( p, statp );
+    if ( f_latency_option )
+        lat_begin_dir ( operand, p->fts_path,
+            g_fts_options & FTS_NOSTAT && ! g_fts_lstat ? NULL : statp );
+
+    if ( f_du_option )
+        du_begin_fts_dir ( p );
+
+    // get files contained in a directory
+    chp = timed_fts_children ( ftsp );
+
+    /* empty: fts_read() would read it again */
+    if ( chp == NULL )
+        fts_set ( ftsp, p, FTS_SKIP );
+
+    // loop directory's files
+    for ( cur = chp; cur; cur = cur->fts_link )
+    {
+        struct stat * cur_statp = fts_child_stat ( cur, &stat_buf );
+
 #ifdef DEBUG
-        printf ( "\n### row = %d, col = %d\n", row, col );
-#endif       
-        
-        /* 2. fill the matrix */
+        out_printf ( "\t@@ %s\n", cur->fts_name );
+#endif
+        if ( cur_statp == NULL )
+            continue;
+        if ( f_du_option )
+            du_count_fts_entry ( p, cur_statp );
+        if ( ! g_listing_filtered ||
+             entry_wanted ( cur->fts_name, cur_statp ) )
+            record_stat ( cur_statp, cur->fts_name, NULL );
+        if ( f_index_write_option )
+            index_add_entry ( cur, cur_statp );
+    }
 
-        int i = 0;
-        for ( c = 0; c <= col; c++ )
+    if ( link_targets_wanted () )
+        resolve_link_targets ( -1, g_dir_path );
+    LS_PROBE2 ( dir_read, g_dir_path, g_list_count );
+    if ( f_du_option && f_S_option )
+        du_sort_sizes ();
+    if ( f_index_write_option )
+        index_end_dir ();
+
+    print_file_info_list();
+
+    if ( ! f_format_option )
+        out_printf ( "\n" );
+
+    /* RE-initialize head of file_info linked list */
+    reset_file_info_list ();
+
+    free ( p->fts_pointer );
+    p->fts_pointer = NULL;
+}
+
+/*
+    reading a directory
+
+    the entries are lstat()ed in inode number order rather than the
+    order readdir() returns them in, a hash order on ext4 and XFS : the
+    inode table is then read front to back, once, instead of a block
+    here and there for every entry, which is what a cold cache on a
+    spinning disk can't afford. The entries are still recorded in
+    readdir() order, -f shows no difference.
+*/
+
+int compare_stat_job_ino( const void * a, const void * b )
+{
+    const struct stat_job * x = *(const struct stat_job * const *)a;
+    const struct stat_job * y = *(const struct stat_job * const *)b;
+
+    return x->ino < y->ino ? -1 : x->ino > y->ino;
+}
+
+/* record the entries of dp, which is the current directory */
+void read_directory( DIR * dp )
+{
+    struct stat_job * jobs = NULL, ** order;
+    struct dirent * dirp;
+    struct stat stat_buf;
+    char * names = NULL;
+    size_t count = 0, alloc = 0, names_len = 0, names_alloc = 0, len, i;
+
+    if ( f_stat_order_option == STAT_ORDER_READDIR )
+    {
+        while ( ( dirp = timed_readdir ( dp ) ) != NULL )
         {
-            for ( r = 0; r <= row; r++ )
+            if ( g_listing_filtered && ! dirent_wanted ( dirp ) )
+                continue;
+            if ( timed_lstat ( dirp->d_name, &stat_buf ) < 0 )
             {
-                i++;
-                if ( (node_ptr != NULL) && (i <= file_info_list_len) )
-                {
-                    matrix [r][c] = node_ptr;
-#ifdef DEBUG
-                    printf ( "## %s\n", node_ptr->path_name );
-#endif            
-                    node_ptr = node_ptr->next;
-                }
+                fprintf ( stderr, "lstat() error" );
+                exit (1);
             }
+
+            if ( f_predicate_option && ! stat_wanted ( &stat_buf ) )
+                continue;
+
+            record_stat ( &stat_buf, dirp->d_name, NULL );
         }
-        
-        /* 3. output matrix column by column */
-        i = 0;
-        for ( r = 0; r <= row; r++ )
+        return;
+    }
+
+    /* the names first */
+    while ( ( dirp = timed_readdir ( dp ) ) != NULL )
+    {
+        if ( g_listing_filtered && ! dirent_wanted ( dirp ) )
+            continue;
+
+        len = strlen ( dirp->d_name ) + 1;
+        if ( count == alloc )
         {
-            for ( c = 0; c <= col; c++ )
-            {
-                i++;
-                if ( i <= file_info_list_len )
-                {
-                    struct file_info * p = matrix [r][c];
-                    printf ( "%20s", p->path_name );
-                }
-            }
-            printf ( "\n" );
+            alloc = alloc ? alloc * 2 : 256;
+            jobs = realloc ( jobs, alloc * sizeof(struct stat_job) );
+        }
+        if ( names_len + len > names_alloc )
+        {
+            names_alloc = names_alloc ? names_alloc * 2 : 8192;
+            names = realloc ( names, names_alloc );
         }
+        if ( jobs == NULL || names == NULL )
+        {
+            fprintf ( stderr, "malloc() error\n" );
+            exit (1);
+        }
+        jobs[count].ino = dirp->d_ino;
+        jobs[count].name_off = names_len;
+        memcpy ( names + names_len, dirp->d_name, len );
+        names_len += len;
+        count++;
     }
-    /* --- end of -C --- */
-    else
+
+    /* then their lstat()s, by inode */
+    order = malloc ( ( count ? count : 1 ) * sizeof(struct stat_job *) );
+    if ( order == NULL )
     {
-        g_print_count = 0;
-        
-        while ( node_ptr != NULL )
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    for ( i = 0; i < count; i++ )
+        order[i] = &jobs[i];
+    if ( f_stat_order_option == STAT_ORDER_INODE || count >= STAT_INODE_MIN )
+        qsort ( order, count, sizeof(struct stat_job *),
+                compare_stat_job_ino );
+
+    for ( i = 0; i < count; i++ )
+    {
+        if ( timed_lstat ( names + order[i]->name_off,
+                           &order[i]->stat_info ) < 0 )
         {
-            print_with_proper_option ( node_ptr );
-            node_ptr = node_ptr->next;
-            g_print_count ++;
+            fprintf ( stderr, "lstat() error" );
+            exit (1);
         }
+    }
 
-        if ( f_x_option )
+    /* and recorded as they were read */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( f_predicate_option && ! stat_wanted ( &jobs[i].stat_info ) )
+            continue;
+        record_stat ( &jobs[i].stat_info, names + jobs[i].name_off, NULL );
+    }
+
+    free ( order );
+    free ( jobs );
+    free ( names );
+}
+
+/*
+    --files-from
+
+    the paths are read FILES_BATCH at a time. A batch is sorted by parent
+    directory, each parent is opened once and its entries are fstatat()ed
+    by the same thread, FILES_DIRS_MAX parents at a time so as not to
+    run out of descriptors; a parent which can't be opened for want of
+    one has its entries statted by their whole path. They are then
+    recorded in the order they were
+    read and, unless -t, -S or -r asks for a sort, printed before the
+    next batch is read, so the paths can be any number. Every path is
+    listed as itself, a directory too, as with -d.
+*/
+
+int compare_files_job_dir( const void * a, const void * b )
+{
+    const struct files_job * x = *(struct files_job * const *)a;
+    const struct files_job * y = *(struct files_job * const *)b;
+    int ret;
+
+    ret = memcmp ( x->path, y->path,
+                   x->dir_len < y->dir_len ? x->dir_len : y->dir_len );
+    if ( ret != 0 )
+        return ret;
+    return x->dir_len < y->dir_len ? -1 : x->dir_len > y->dir_len;
+}
+
+void * files_stat_run( void * arg )
+{
+    struct files_range * rp = arg;
+    struct files_job * jp;
+    const char * base;
+    char link_path [PATH_MAX];
+    ssize_t ret;
+    size_t i;
+
+    for ( i = 0; i < rp->count; i++ )
+    {
+        jp = rp->jobs[i];
+        if ( jp->err != 0 )             /* its parent couldn't be opened */
+            continue;
+
+        base = jp->dir_fd == AT_FDCWD ? jp->path :
+            jp->path + jp->dir_len + 1;
+        if ( fstatat ( jp->dir_fd, base, &jp->stat_info,
+                       AT_SYMLINK_NOFOLLOW ) < 0 )
+        {
+            jp->err = errno;
+            continue;
+        }
+
+        if ( S_ISLNK ( jp->stat_info.st_mode ) && link_targets_wanted () &&
+             ( ret = readlinkat ( jp->dir_fd, base, link_path,
+                                  sizeof(link_path) - 1 ) ) >= 0 &&
+             ( jp->link_target = malloc ( ret + 1 ) ) != NULL )
         {
-            /* after the last file, print a newline */
-            printf ( "\n" );
+            memcpy ( jp->link_target, link_path, ret );
+            jp->link_target[ret] = '\0';
         }
     }
+    return NULL;
 }
 
 /*
-    sort methods
+    open the parents of the sorted jobs, up to FILES_DIRS_MAX of them;
+    returns how many jobs they are the parents of
 */
-
-struct file_info * sort_by_time_modi_desc ( struct file_info * pList )
+size_t files_open_parents( struct files_job ** order, size_t count )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
+    struct files_job * prev = NULL;
+    char * slash;
+    size_t i;
+    int opened = 0;
 
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    for ( i = 0; i < count; i++ )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
-
-        /* pop head off list */
-        pList = pList->next;
-
-        /* splice head into sorted list at proper place */
-        while (1)
+        if ( order[i]->dir_len == 0 )
+            continue;
+        if ( prev != NULL && compare_files_job_dir ( &prev, &order[i] ) == 0 )
         {
-            /* does head belong here? */
-            if ( *ppTrail == NULL || pHead->m_time > (*ppTrail)->m_time )
-            {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
-                break;
-            }
-            else
-            {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
-            }
+            order[i]->dir_fd = prev->dir_fd;
+            order[i]->err = prev->err;
+            continue;
         }
+        if ( opened == FILES_DIRS_MAX )
+            break;
+
+        slash = order[i]->path + order[i]->dir_len;
+        *slash = '\0';
+        order[i]->dir_fd = open ( order[i]->path, O_RDONLY | O_DIRECTORY |
+                                  O_CLOEXEC );
+        *slash = '/';
+        if ( order[i]->dir_fd >= 0 )
+            opened++;
+        else if ( errno != EMFILE && errno != ENFILE )
+            order[i]->err = errno;
+        else
+            order[i]->dir_fd = AT_FDCWD;
+        prev = order[i];
     }
+    return i;
+}
 
-    return pSorted;
+/* stat the jobs, with threads for many, then close their parents */
+void files_stat_jobs( struct files_job ** order, size_t count )
+{
+    struct files_range ranges [FILES_THREADS_MAX];
+    pthread_t threads [FILES_THREADS_MAX];
+    int started [FILES_THREADS_MAX];
+    long nthreads = sysconf ( _SC_NPROCESSORS_ONLN );
+    struct files_job * prev = NULL;
+    size_t i, per;
+    long long t;
+    int k;
+
+    if ( nthreads > FILES_THREADS_MAX )
+        nthreads = FILES_THREADS_MAX;
+    if ( nthreads < 1 || count < LINK_THREAD_MIN )
+        nthreads = 1;
+
+    /* each thread takes a run of the sorted jobs, whole parents mostly */
+    STATS_START ( t );
+    per = ( count + nthreads - 1 ) / nthreads;
+    for ( k = 0; k < nthreads; k++ )
+    {
+        ranges[k].jobs = order + k * per;
+        ranges[k].count = k * per >= count ? 0 :
+            ( count - k * per < per ? count - k * per : per );
+
+        /* without a thread, the range is statted here */
+        started[k] = nthreads > 1 && pthread_create ( &threads[k], NULL,
+            files_stat_run, &ranges[k] ) == 0;
+        if ( ! started[k] )
+            files_stat_run ( &ranges[k] );
+    }
+    for ( k = 0; k < nthreads; k++ )
+        if ( started[k] )
+            pthread_join ( threads[k], NULL );
+    STATS_STOP ( lstat, t );
+    g_stats.lstat_calls += count;
+
+    /* each parent once, where it was opened */
+    for ( i = 0; i < count; i++ )
+    {
+        if ( order[i]->dir_fd >= 0 &&
+             ( prev == NULL || order[i]->dir_fd != prev->dir_fd ) )
+            close ( order[i]->dir_fd );
+        prev = order[i];
+    }
 }
 
-struct file_info * sort_by_time_modi_asce ( struct file_info * pList )
+/* fill in stat_info or err of each job */
+void files_stat_batch( struct files_job * jobs, size_t count )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
+    struct files_job ** order;
+    char * slash;
+    size_t i, n;
 
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    order = malloc ( ( count ? count : 1 ) * sizeof(*order) );
+    if ( order == NULL )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
-
-        /* pop head off list */
-        pList = pList->next;
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
 
-        /* splice head into sorted list at proper place */
-        while (1)
-        {
-            /* does head belong here? */
-            if ( *ppTrail == NULL || pHead->m_time < (*ppTrail)->m_time )
-            {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
-                break;
-            }
-            else
-            {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
-            }
-        }
+    /* "a/b/c" is c in a/b; "c", "/c" and "c/" are statted as they are */
+    for ( i = 0; i < count; i++ )
+    {
+        slash = strrchr ( jobs[i].path, '/' );
+        jobs[i].dir_len = slash == NULL || slash == jobs[i].path ||
+            slash[1] == '\0' ? 0 : (size_t)( slash - jobs[i].path );
+        jobs[i].dir_fd = AT_FDCWD;
+        jobs[i].err = 0;
+        jobs[i].link_target = NULL;
+        order[i] = &jobs[i];
     }
+    qsort ( order, count, sizeof(*order), compare_files_job_dir );
 
-    return pSorted;
+    for ( i = 0; i < count; i += n )
+    {
+        n = files_open_parents ( order + i, count - i );
+        files_stat_jobs ( order + i, n );
+    }
+    free ( order );
 }
 
-struct file_info * sort_by_lexi ( struct file_info * pList )
+/* returns the exit status, 1 if a path couldn't be listed */
+int files_from( const char * file )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
+    struct files_job * jobs;
+    struct file_info * node, * next;
+    FILE * fp;
+    char * line = NULL;
+    size_t cap = 0, count, i;
+    ssize_t len;
+    int sorted = f_t_option || f_S_option || f_r_option;
+    int status = 0, done = 0;
+    int delim = f_null_option ? '\0' : '\n';
+
+    if ( strcmp ( file, "-" ) == 0 )
+        fp = stdin;
+    else if ( ( fp = fopen ( file, "r" ) ) == NULL )
+    {
+        fprintf ( stderr, "can't open '%s': %s\n", file, strerror ( errno ) );
+        return 1;
+    }
 
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    jobs = malloc ( FILES_BATCH * sizeof(*jobs) );
+    if ( jobs == NULL )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
 
-        /* pop head off list */
-        pList = pList->next;
+    f_d_option = 1;
+    select_row_renderer ();
+    g_dir_path = ".";
+    reset_file_info_list ();
 
-        /* splice head into sorted list at proper place */
-        while (1)
-        {   
-            /* does head belong here? */
-            if ( *ppTrail == NULL ||
-                 ( ((pHead->path_name[0])-' ') <
-                   ((*ppTrail)->path_name[0]-' ') ) )
+    while ( ! done )
+    {
+        for ( count = 0; count < FILES_BATCH; )
+        {
+            if ( ( len = getdelim ( &line, &cap, delim, fp ) ) < 0 )
             {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
+                done = 1;
                 break;
             }
-            else
+            if ( len > 0 && line[len - 1] == delim )
+                line[--len] = '\0';
+            if ( len == 0 )
+                continue;
+            if ( ( jobs[count].path = strdup ( line ) ) == NULL )
+            {
+                fprintf ( stderr, "malloc() error\n" );
+                exit (1);
+            }
+            count++;
+        }
+        if ( count == 0 )
+            break;
+
+        files_stat_batch ( jobs, count );
+
+        for ( i = 0; i < count; i++ )
+        {
+            if ( jobs[i].err != 0 )
             {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
+                fprintf ( stderr, "stat error for %s: %s\n", jobs[i].path,
+                    strerror ( jobs[i].err ) );
+                status = 1;
             }
+            else if ( ! g_listing_filtered ||
+                      entry_wanted ( jobs[i].path + ( jobs[i].dir_len ?
+                          jobs[i].dir_len + 1 : 0 ), &jobs[i].stat_info ) )
+                record_stat ( &jobs[i].stat_info, jobs[i].path,
+                              jobs[i].link_target );
+            free ( jobs[i].link_target );
+            free ( jobs[i].path );
+        }
+
+        if ( sorted )
+            continue;
+
+        /* in input order, g_list_sorted keeps print_file_info_list()
+           from sorting the batch */
+        g_list_sorted = 1;
+        print_file_info_list ();
+        for ( node = file_info_list_head; node != NULL; node = next )
+        {
+            next = node->next;
+            free ( node );
         }
+        reset_file_info_list ();
     }
 
-    return pSorted;
+    if ( sorted )
+        print_file_info_list ();
+
+    if ( ferror ( fp ) )
+    {
+        fprintf ( stderr, "can't read '%s': %s\n", file, strerror ( errno ) );
+        status = 1;
+    }
+    if ( fp != stdin )
+        fclose ( fp );
+    free ( line );
+    free ( jobs );
+    return status;
 }
 
-struct file_info * sort_by_lexi_rev ( struct file_info * pList )
+/*
+    --server and --client
+
+    the server answers requests on a Unix socket by forking, so each
+    listing starts with what the server has loaded and looked up
+    already ( the time zone, the user and group names ) and runs as if
+    its arguments had been given on the command line. A request is one
+    SOCK_SEQPACKET message : the client's current directory, standard
+    input, output and error as SCM_RIGHTS, and '\0' terminated strings,
+    those variables of g_server_env which are set, an empty one, then
+    the arguments. The listing is written straight to the client's
+    descriptors; the answer is its exit status, an int.
+*/
+
+/* returns only if there is no server to ask */
+void client_run( const char * path, int argc, char ** argv )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
+    struct sockaddr_un addr;
+    union
+    {
+        struct cmsghdr align;
+        char buf [CMSG_SPACE ( sizeof(int) * SERVER_FDS )];
+    } control;
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr * cp;
+    int fds [SERVER_FDS] = { -1, STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char * msg;
+    const char * value;
+    size_t len = 0, n;
+    int fd, i, status;
+
+    memset ( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    if ( strlen ( path ) >= sizeof(addr.sun_path) )
+    {
+        fprintf ( stderr, "--client: socket path too long\n" );
+        exit (1);
+    }
+    strcpy ( addr.sun_path, path );
 
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    fd = socket ( AF_UNIX, SOCK_SEQPACKET, 0 );
+    if ( fd < 0 )
+        return;
+    if ( connect ( fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
+        close ( fd );
+        return;
+    }
 
-        /* pop head off list */
-        pList = pList->next;
+    msg = malloc ( SERVER_MSG_MAX );
+    if ( msg == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
 
-        /* splice head into sorted list at proper place */
-        while (1)
-        {   
-            /* does head belong here? */
-            if ( *ppTrail == NULL ||
-                 ( ((pHead->path_name[0])-' ') >
-                   ((*ppTrail)->path_name[0]-' ') ) )
-            {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
-                break;
-            }
-            else
-            {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
-            }
+    for ( i = 0; g_server_env[i] != NULL; i++ )
+    {
+        value = getenv ( g_server_env[i] );
+        if ( value == NULL )
+            continue;
+        n = strlen ( g_server_env[i] ) + 1 + strlen ( value ) + 1;
+        if ( len + n > SERVER_MSG_MAX )
+            break;
+        len += sprintf ( msg + len, "%s=%s", g_server_env[i], value ) + 1;
+    }
+    msg[len++] = '\0';
+
+    for ( i = 0; i < argc; i++ )
+    {
+        n = strlen ( argv[i] ) + 1;
+        if ( len + n > SERVER_MSG_MAX )
+        {
+            fprintf ( stderr, "--client: arguments too long\n" );
+            exit (1);
         }
+        memcpy ( msg + len, argv[i], n );
+        len += n;
+    }
+
+    fds[0] = open ( ".", O_RDONLY | O_DIRECTORY );
+    if ( fds[0] < 0 )
+    {
+        fprintf ( stderr, "can't open '.': %s\n", strerror ( errno ) );
+        exit (1);
     }
 
-    return pSorted;
+    iov.iov_base = msg;
+    iov.iov_len = len;
+    memset ( &mh, 0, sizeof(mh) );
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+    cp = CMSG_FIRSTHDR ( &mh );
+    cp->cmsg_level = SOL_SOCKET;
+    cp->cmsg_type = SCM_RIGHTS;
+    cp->cmsg_len = CMSG_LEN ( sizeof(fds) );
+    memcpy ( CMSG_DATA ( cp ), fds, sizeof(fds) );
+
+    if ( sendmsg ( fd, &mh, MSG_NOSIGNAL ) < 0 )
+    {
+        fprintf ( stderr, "--client: sendmsg() error : %s\n",
+            strerror ( errno ) );
+        exit (1);
+    }
+
+    if ( recv ( fd, &status, sizeof(status), 0 ) != sizeof(status) )
+    {
+        fprintf ( stderr, "--client: no answer from the server\n" );
+        exit (1);
+    }
+    exit ( status );
 }
 
-struct file_info * sort_by_size_desc ( struct file_info * pList )
+/*
+    never returns in the server; returns in a child forked for a
+    request, with the request's arguments for main() to go on with
+*/
+void server_run( const char * path, int * argcp, char *** argvp )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
+#ifdef __linux__
+    struct sockaddr_un addr;
+    time_t now;
+    struct tm tm;
+    mode_t mask;
+    pid_t pid;
+    int listen_fd, fd;
+
+    memset ( &addr, 0, sizeof(addr) );
+    addr.sun_family = AF_UNIX;
+    if ( strlen ( path ) >= sizeof(addr.sun_path) )
+    {
+        fprintf ( stderr, "--server: socket path too long\n" );
+        exit (1);
+    }
+    strcpy ( addr.sun_path, path );
 
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    listen_fd = socket ( AF_UNIX, SOCK_SEQPACKET, 0 );
+    if ( listen_fd < 0 )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
+        fprintf ( stderr, "--server: socket() error : %s\n",
+            strerror ( errno ) );
+        exit (1);
+    }
 
-        /* pop head off list */
-        pList = pList->next;
+    /* a socket nobody answers on is left from a server which is gone */
+    if ( connect ( listen_fd, (struct sockaddr *)&addr, sizeof(addr) ) == 0 )
+    {
+        fprintf ( stderr, "--server: a server is running on '%s'\n", path );
+        exit (1);
+    }
+    if ( errno == ECONNREFUSED )
+        unlink ( path );
 
-        /* splice head into sorted list at proper place */
-        while (1)
-        {   
-            /* does head belong here? */
-            if ( *ppTrail == NULL ||
-                 ( (pHead->number_of_bytes) > 
-                   ((*ppTrail)->number_of_bytes) ) )
-            {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
-                break;
-            }
-            else
-            {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
-            }
-        }
+    /* only its owner can connect, and is let in, see server_request() */
+    mask = umask ( 077 );
+    if ( bind ( listen_fd, (struct sockaddr *)&addr, sizeof(addr) ) < 0 ||
+         listen ( listen_fd, SOMAXCONN ) < 0 )
+    {
+        fprintf ( stderr, "--server: can't listen on '%s': %s\n", path,
+            strerror ( errno ) );
+        exit (1);
     }
+    umask ( mask );
 
-    return pSorted;
+    /* 0, 1 and 2 taken, so the descriptors of a request aren't */
+    while ( ( fd = open ( "/dev/null", O_RDWR ) ) >= 0 && fd <= 2 )
+        ;
+    if ( fd > 2 )
+        close ( fd );
+
+    /* what every listing would otherwise load for itself */
+    tzset ();
+    now = time ( NULL );
+    localtime_r ( &now, &tm );
+    owner_cache_fill ();
+
+    signal ( SIGCHLD, SIG_IGN );    /* no zombies */
+
+    for ( ;; )
+    {
+        fd = accept ( listen_fd, NULL, NULL );
+        if ( fd < 0 )
+        {
+            if ( errno == EINTR || errno == ECONNABORTED )
+                continue;
+            fprintf ( stderr, "--server: accept() error : %s\n",
+                strerror ( errno ) );
+            exit (1);
+        }
+
+        pid = fork ();
+        if ( pid == 0 )
+        {
+            close ( listen_fd );
+            signal ( SIGCHLD, SIG_DFL );
+            server_request ( fd, argcp, argvp );
+            return;
+        }
+        if ( pid < 0 )
+            fprintf ( stderr, "--server: fork() error : %s\n",
+                strerror ( errno ) );
+        close ( fd );
+    }
+#else
+    fprintf ( stderr, "--server is not supported on this system\n" );
+    exit (1);
+#endif
 }
 
-struct file_info * sort_by_size_asce ( struct file_info * pList )
+#ifdef __linux__
+/* take over the client's descriptors, directory and environment */
+void server_request( int fd, int * argcp, char *** argvp )
 {
-    /* build up the sorted array from the empty list */
-    struct file_info * pSorted = NULL;
-
-    /* take items off the input list one by one until empty */
-    while ( pList != NULL )
+    union
+    {
+        struct cmsghdr align;
+        char buf [CMSG_SPACE ( sizeof(int) * SERVER_FDS )];
+    } control;
+    struct ucred cred;
+    socklen_t cred_len = sizeof(cred);
+    struct msghdr mh;
+    struct iovec iov;
+    struct cmsghdr * cp;
+    int fds [SERVER_FDS];
+    char * msg, * p, * end;
+    char ** args;
+    ssize_t len;
+    int i, count;
+
+    if ( getsockopt ( fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len ) < 0 ||
+         cred.uid != geteuid () )
+        _exit (1);
+
+    msg = malloc ( SERVER_MSG_MAX );
+    if ( msg == NULL )
+        _exit (1);
+
+    iov.iov_base = msg;
+    iov.iov_len = SERVER_MSG_MAX;
+    memset ( &mh, 0, sizeof(mh) );
+    mh.msg_iov = &iov;
+    mh.msg_iovlen = 1;
+    mh.msg_control = control.buf;
+    mh.msg_controllen = sizeof(control.buf);
+
+    len = recvmsg ( fd, &mh, MSG_CMSG_CLOEXEC );
+    cp = CMSG_FIRSTHDR ( &mh );
+    if ( len <= 0 || msg[len - 1] != '\0' ||
+         ( mh.msg_flags & ( MSG_TRUNC | MSG_CTRUNC ) ) || cp == NULL ||
+         cp->cmsg_level != SOL_SOCKET || cp->cmsg_type != SCM_RIGHTS ||
+         cp->cmsg_len != CMSG_LEN ( sizeof(fds) ) )
+        _exit (1);
+    memcpy ( fds, CMSG_DATA ( cp ), sizeof(fds) );
+
+    /* after out_flush(), which was registered later, runs */
+    on_exit ( server_send_status, (void *)(intptr_t)fd );
+
+    for ( i = 1; i < SERVER_FDS; i++ )
+    {
+        dup2 ( fds[i], i - 1 );
+        close ( fds[i] );
+    }
+    if ( fchdir ( fds[0] ) < 0 )
     {
-        /* remember the head */
-        struct file_info * pHead = pList;
-        /* trailing pointer for efficient splice */
-        struct file_info ** ppTrail = &pSorted;
+        fprintf ( stderr, "can't chdir to the client's directory: %s\n",
+            strerror ( errno ) );
+        exit (1);
+    }
+    close ( fds[0] );
 
-        /* pop head off list */
-        pList = pList->next;
+    for ( i = 0; g_server_env[i] != NULL; i++ )
+        unsetenv ( g_server_env[i] );
+    end = msg + len;
+    for ( p = msg; p < end && *p != '\0'; p += strlen ( p ) + 1 )
+    {
+        for ( i = 0; g_server_env[i] != NULL; i++ )
+        {
+            size_t n = strlen ( g_server_env[i] );
 
-        /* splice head into sorted list at proper place */
-        while (1)
-        {   
-            /* does head belong here? */
-            if ( *ppTrail == NULL ||
-                 ( (pHead->number_of_bytes) < 
-                   ((*ppTrail)->number_of_bytes) ) )
-            {
-                /* yes */
-                pHead->next = *ppTrail;
-                *ppTrail = pHead;
-                break;
-            }
-            else
-            {
-                /* no - continue down the list */
-                ppTrail = & (*ppTrail)->next;
-            }
+            if ( strncmp ( p, g_server_env[i], n ) == 0 && p[n] == '=' )
+                putenv ( p );
         }
     }
+    p++;
+
+    for ( count = 0, end = p; end < msg + len; end += strlen ( end ) + 1 )
+        count++;
+    args = malloc ( ( count + 2 ) * sizeof(char *) );
+    if ( args == NULL )
+    {
+        fprintf ( stderr, "malloc() error\n" );
+        exit (1);
+    }
+    args[0] = "ls";
+    for ( i = 1; i <= count; i++, p += strlen ( p ) + 1 )
+        args[i] = p;
+    args[i] = NULL;
 
-    return pSorted;
+    *argcp = count + 1;
+    *argvp = args;
 }
 
-/*
-    program entry
-*/
+/* on_exit() : the listing is out, tell the client how it went */
+void server_send_status( int status, void * arg )
+{
+    fflush ( stdout );
+    send ( (int)(intptr_t)arg, &status, sizeof(status), MSG_NOSIGNAL );
+}
+#endif
 
 int main ( int argc, char ** argv )
 {
 	int ch;
     FTS * ftsp;
-    FTSENT *p, *chp, *cur;
+    FTSENT *p;
     char * curr_dir = ".";
     int stat_ret;
     struct stat stat_buf;
     DIR * dp;
-	struct dirent * dirp;
+
+    static struct option long_options[] =
+    {
+        { "format", required_argument, NULL, OPT_FORMAT },
+        { "cache", optional_argument, NULL, OPT_CACHE },
+        { "cache-strict", no_argument, NULL, OPT_CACHE_STRICT },
+        { "index", required_argument, NULL, OPT_INDEX },
+        { "index-write", required_argument, NULL, OPT_INDEX_WRITE },
+        { "watch", no_argument, NULL, OPT_WATCH },
+        { "stats", optional_argument, NULL, OPT_STATS },
+        { "latency", optional_argument, NULL, OPT_LATENCY },
+        { "du", no_argument, NULL, OPT_DU },
+        { "dedup-links", no_argument, NULL, OPT_DEDUP_LINKS },
+        { "include", required_argument, NULL, OPT_INCLUDE },
+        { "exclude", required_argument, NULL, OPT_EXCLUDE },
+        { "regex", required_argument, NULL, OPT_REGEX },
+        { "newer", required_argument, NULL, OPT_NEWER },
+        { "older-than", required_argument, NULL, OPT_OLDER_THAN },
+        { "min-size", required_argument, NULL, OPT_MIN_SIZE },
+        { "max-size", required_argument, NULL, OPT_MAX_SIZE },
+        { "type", required_argument, NULL, OPT_TYPE },
+        { "uid", required_argument, NULL, OPT_UID },
+        { "stat-order", required_argument, NULL, OPT_STAT_ORDER },
+        { "count", optional_argument, NULL, OPT_COUNT },
+        { "files-from", required_argument, NULL, OPT_FILES_FROM },
+        { "null", no_argument, NULL, OPT_NULL },
+        { "threads", required_argument, NULL, OPT_THREADS },
+        { "renderer", required_argument, NULL, OPT_RENDERER },
+        { "logical", no_argument, NULL, OPT_LOGICAL },
+        { "max-depth", required_argument, NULL, OPT_MAX_DEPTH },
+        { "one-file-system", no_argument, NULL, OPT_ONE_FILE_SYSTEM },
+        { "prune", required_argument, NULL, OPT_PRUNE },
+        { NULL, 0, NULL, 0 }
+    };
+
+    /*
+        --server and --client must come first : the server goes on
+        from here in a child for each request, with its arguments, and
+        the client lists here itself when there is no server
+    */
+    if ( argc > 1 && strncmp ( argv[1], "--server=", 9 ) == 0 )
+    {
+        if ( argc > 2 )
+        {
+            fprintf ( stderr, "--server takes no other arguments\n" );
+            exit (1);
+        }
+        server_run ( argv[1] + 9, &argc, &argv );
+    }
+    else if ( argc > 1 && strncmp ( argv[1], "--client=", 9 ) == 0 )
+    {
+        client_run ( argv[1] + 9, argc - 2, argv + 2 );
+        argv[1] = argv[0];
+        argc--;
+        argv++;
+    }
+
+    /* whatever is still buffered goes out when exit() is called,
+       and then --stats and --latency are reported ( the last registered runs first ) */
+    atexit ( report_at_exit );
+    atexit ( out_flush );
+    g_stats.start_ns = stats_now ();
 
     /*
         -A is always set for the super user
@@ -1056,7 +6797,8 @@ int main ( int argc, char ** argv )
         parse options
     */
 
-	while ( ( ch = getopt(argc, argv, "AaCcdFfhiklnqRrSstuwx1") ) != -1 )
+	while ( ( ch = getopt_long(argc, argv, "AaCcdFfhiklnqRrSstuwx1",
+                               long_options, NULL) ) != -1 )
 	{
 		switch (ch)
 		{
@@ -1144,6 +6886,169 @@ int main ( int argc, char ** argv )
                 f_1_option = 1;
                 f_l_option = 0;
                 break;
+            case OPT_FORMAT:
+                if ( strcmp ( optarg, "ndjson" ) == 0 )
+                    f_format_option = FORMAT_NDJSON;
+                else if ( strcmp ( optarg, "binary" ) == 0 )
+                    f_format_option = FORMAT_BINARY;
+                else if ( strcmp ( optarg, "text" ) == 0 )
+                    f_format_option = FORMAT_TEXT;
+                else
+                {
+                    fprintf ( stderr, "unknown format '%s'\n", optarg );
+                    usage();
+                    exit(1);
+                }
+                break;
+            case OPT_CACHE:
+                f_cache_option = 1;
+                g_cache_dir = optarg;
+                break;
+            case OPT_CACHE_STRICT:
+                f_cache_strict_option = 1;
+                break;
+            case OPT_INDEX:
+                f_index_option = 1;
+                g_index_file = optarg;
+                break;
+            case OPT_INDEX_WRITE:
+                f_index_write_option = 1;
+                g_index_write_file = optarg;
+                break;
+            case OPT_WATCH:
+                f_watch_option = 1;
+                break;
+            case OPT_STATS:
+                f_stats_option = 1;
+                g_stats_file = optarg;
+                break;
+            case OPT_DU:
+                f_du_option = 1;
+                break;
+            case OPT_DEDUP_LINKS:
+                f_dedup_links_option = 1;
+                break;
+            case OPT_INCLUDE:
+                filter_add ( optarg, 0, 0 );
+                break;
+            case OPT_EXCLUDE:
+                filter_add ( optarg, 1, 0 );
+                break;
+            case OPT_REGEX:
+                filter_add ( optarg, 0, 1 );
+                break;
+            case OPT_NEWER:
+                f_predicate_option = 1;
+                g_pred_newer_file = optarg;
+                break;
+            case OPT_OLDER_THAN:
+                f_predicate_option = 1;
+                g_pred_older_age = parse_age ( "--older-than", optarg );
+                break;
+            case OPT_MIN_SIZE:
+                f_predicate_option = 1;
+                g_pred_min_size = parse_size ( "--min-size", optarg );
+                break;
+            case OPT_MAX_SIZE:
+                f_predicate_option = 1;
+                g_pred_max_size = parse_size ( "--max-size", optarg );
+                break;
+            case OPT_TYPE:
+                f_predicate_option = 1;
+                predicate_type ( optarg );
+                break;
+            case OPT_UID:
+                f_predicate_option = 1;
+                predicate_uid ( optarg );
+                break;
+            case OPT_COUNT:
+                f_count_option = 1;
+                if ( optarg != NULL && strcmp ( optarg, "types" ) == 0 )
+                    f_count_option = 2;
+                else if ( optarg != NULL )
+                {
+                    fprintf ( stderr, "--count takes =types or nothing\n" );
+                    exit (1);
+                }
+                break;
+            case OPT_FILES_FROM:
+                g_files_from = optarg;
+                break;
+            case OPT_NULL:
+                f_null_option = 1;
+                break;
+            case OPT_LOGICAL:
+                f_logical_option = 1;
+                break;
+            case OPT_MAX_DEPTH:
+                g_max_depth = atoi ( optarg );
+                if ( g_max_depth < 0 || ! isdigit ( (unsigned char)optarg[0] ) )
+                {
+                    fprintf ( stderr, "--max-depth takes a number of "
+                        "directories, 0 or more\n" );
+                    exit (1);
+                }
+                break;
+            case OPT_ONE_FILE_SYSTEM:
+                f_xdev_option = 1;
+                break;
+            case OPT_PRUNE:
+                prune_add ( optarg );
+                break;
+            case OPT_RENDERER:
+                if ( strcmp ( optarg, "auto" ) == 0 )
+                    f_renderer_option = RENDERER_AUTO;
+                else if ( strcmp ( optarg, "generic" ) == 0 )
+                    f_renderer_option = RENDERER_GENERIC;
+                else
+                {
+                    fprintf ( stderr, "--renderer is auto or generic\n" );
+                    exit (1);
+                }
+                break;
+            case OPT_THREADS:
+                g_threads = atoi ( optarg );
+                if ( g_threads < 1 || g_threads > PARALLEL_THREADS_MAX )
+                {
+                    fprintf ( stderr, "--threads is 1 to %d\n",
+                        PARALLEL_THREADS_MAX );
+                    exit (1);
+                }
+                break;
+            case OPT_STAT_ORDER:
+                if ( strcmp ( optarg, "auto" ) == 0 )
+                    f_stat_order_option = STAT_ORDER_AUTO;
+                else if ( strcmp ( optarg, "inode" ) == 0 )
+                    f_stat_order_option = STAT_ORDER_INODE;
+                else if ( strcmp ( optarg, "readdir" ) == 0 )
+                    f_stat_order_option = STAT_ORDER_READDIR;
+                else
+                {
+                    fprintf ( stderr, "--stat-order is auto, inode or "
+                        "readdir\n" );
+                    exit (1);
+                }
+                break;
+            case OPT_LATENCY:
+                f_latency_option = LAT_DEFAULT_SLOWEST;
+                if ( optarg != NULL )
+                {
+                    f_latency_option = atoi ( optarg );
+                    if ( f_latency_option < 1 )
+                    {
+                        fprintf ( stderr, "--latency needs a count of "
+                            "directories > 0\n" );
+                        exit (1);
+                    }
+                }
+                g_lat_slowest = calloc ( f_latency_option,
+                    sizeof(struct lat_dir) );
+                if ( g_lat_slowest == NULL )
+                {
+                    fprintf ( stderr, "malloc() error\n" );
+                    exit (1);
+                }
+                break;
             default:
 				usage();
                 exit(1);
@@ -1153,6 +7058,103 @@ int main ( int argc, char ** argv )
 	argc -= optind;
 	argv += optind;
 
+    if ( f_index_write_option && ! f_R_option )
+    {
+        fprintf ( stderr, "--index-write needs -R\n" );
+        exit (1);
+    }
+
+    if ( f_watch_option &&
+         ( f_R_option || f_d_option || f_format_option || f_index_option ||
+           argc > 1 ) )
+    {
+        fprintf ( stderr, "--watch follows one directory, without -R, -d, "
+            "--format or --index\n" );
+        exit (1);
+    }
+
+    /*
+        names are shown as they are unless they go to a terminal or
+        -q is given; then the locale's character set says which of
+        their characters can be printed
+    */
+    g_sanitize_names = isatty ( 1 ) || f_q_option;
+    if ( g_sanitize_names )
+        setlocale ( LC_CTYPE, "" );
+    name_scan_select ();
+
+    /* once, rather than for every name read, or every row printed */
+    filters_compile ();
+    select_row_renderer ();
+    g_fts_lstat = ( f_stats_option || f_latency_option ) &&
+        listing_needs_stat () && ! f_logical_option;
+    g_fts_options = fts_options ();
+
+    /* --index : nothing below is needed, the index has it all */
+    if ( f_index_option )
+        exit ( list_from_index ( argc, argv ) );
+
+    /* --count : nor for this, which never stat()s an entry */
+    if ( f_count_option )
+    {
+        if ( g_pred_min_size >= 0 || g_pred_max_size >= 0 ||
+             g_pred_has_uid || g_pred_newer_file != NULL ||
+             g_pred_older_age > 0 || f_format_option || f_cache_option ||
+             f_watch_option || f_du_option )
+        {
+            fprintf ( stderr, "--count takes only -R, -a, -A, --type and "
+                "the name filters\n" );
+            exit (1);
+        }
+        if ( argc == 0 )
+            count_operand ( "." );
+        for ( ; argc > 0; argc--, argv++ )
+            count_operand ( *argv );
+        exit (0);
+    }
+
+    /* --files-from : the paths come from there, not from argv */
+    if ( g_files_from != NULL )
+    {
+        if ( argc > 0 || f_R_option || f_cache_option || f_watch_option ||
+             f_du_option || f_index_write_option )
+        {
+            fprintf ( stderr, "--files-from takes no file operands, -R, "
+                "--cache, --watch, --du or --index-write\n" );
+            exit (1);
+        }
+        exit ( files_from ( g_files_from ) );
+    }
+
+    /* 
+        default --cache directory, made absolute since the directories
+        listed are chdir()ed into
+    */
+
+    if ( f_cache_option )
+    {
+        static char cache_dir [PATH_MAX];
+        char * base = getenv ( "XDG_CACHE_HOME" );
+        char * home = getenv ( "HOME" );
+
+        if ( g_cache_dir != NULL && g_cache_dir[0] != '/' )
+        {
+            if ( getcwd ( cache_dir, sizeof(cache_dir) ) == NULL )
+                cache_dir[0] = '\0';
+            strlcat ( cache_dir, "/", sizeof(cache_dir) );
+            strlcat ( cache_dir, g_cache_dir, sizeof(cache_dir) );
+        }
+        else if ( g_cache_dir != NULL )
+            strlcpy ( cache_dir, g_cache_dir, sizeof(cache_dir) );
+        else if ( base != NULL && base[0] == '/' )
+            snprintf ( cache_dir, sizeof(cache_dir), "%s/ls", base );
+        else if ( home != NULL )
+            snprintf ( cache_dir, sizeof(cache_dir), "%s/.cache/ls", home );
+        else
+            f_cache_option = 0;
+        g_cache_dir = cache_dir;
+    }
+
 	/* 
         parse file argument(s)
     */
@@ -1174,16 +7176,23 @@ int main ( int argc, char ** argv )
                 exit (1);
             }
 
-            record_stat ( &stat_buf, curr_dir );
+            record_stat ( &stat_buf, curr_dir, NULL );
             print_file_info_list ();
             exit (0);    
         }
+
+        /* -R adds the totals up as it goes, but -S sorts by them */
+        if ( f_du_option && ( ! f_R_option || f_S_option ) )
+            du_walk ( curr_dir );
         
         /* non-recursive */
         if ( ! f_R_option )
         {
+            if ( f_latency_option )
+                lat_begin_dir ( curr_dir, curr_dir, NULL );
+
             /* read directory NAME, and list the files in it */	
-            if ( ( dp = opendir(curr_dir) ) == NULL )
+            if ( ( dp = timed_opendir ( curr_dir ) ) == NULL )
             {
                 fprintf ( stderr, "can't open '%s'\n", curr_dir );
                 exit(1);
@@ -1197,16 +7206,18 @@ int main ( int argc, char ** argv )
                 exit (1);
             }
 
-            while ( ( dirp = readdir(dp) ) != NULL )
+            if ( ! f_cache_option || ! cache_load ( dp ) )
             {
-                if ( lstat ( dirp->d_name, &stat_buf ) < 0 )
-                {
-                    fprintf ( stderr, "lstat() error" );
-                    exit (1);
-                }
-                
-                record_stat ( &stat_buf, dirp->d_name );
+                read_directory ( dp );
+
+                if ( link_targets_wanted () )
+                    resolve_link_targets ( dirfd ( dp ), NULL );
+                if ( f_cache_option && ! g_listing_filtered )
+                    cache_store ();
             }
+            LS_PROBE2 ( dir_read, g_dir_path, g_list_count );
+            if ( f_du_option )
+                du_list_dir ( dirfd ( dp ), NULL );
 
             if ( closedir(dp) < 0 )
             {
@@ -1214,7 +7225,12 @@ int main ( int argc, char ** argv )
                 exit(1);
             }
 
+            if ( f_watch_option )
+                watch_sort_list ();
             print_file_info_list();
+
+            if ( f_watch_option )
+                watch_directory ();
             
             exit (0);
         }
@@ -1222,7 +7238,7 @@ int main ( int argc, char ** argv )
         else
         {
             if ( ( ftsp =
-                 fts_open ( &curr_dir, FTS_LOGICAL, NULL ) ) == NULL )
+                 fts_open ( &curr_dir, g_fts_options, NULL ) ) == NULL )
             {
                 fprintf ( stderr, "fts_open() error" );
                 fts_close ( ftsp );
@@ -1236,30 +7252,16 @@ int main ( int argc, char ** argv )
                     /* directory */ 
                     case FTS_D:
 #ifdef DEBUG
-                        printf ( "^^%s\n", p->fts_name );
+                        out_printf ( "^^%s\n", p->fts_name );
 #endif
-                        /* print directory path */                        
-                        printf ( "%s:\n", p->fts_path ); 
-
-                        // get files contained in a directory
-                        chp = fts_children ( ftsp, 0 );
-                        
-                        // loop directory's files
-                        for ( cur = chp; cur; cur = cur->fts_link )
-                        {
-#ifdef DEBUG
-                            printf ( "\t@@ %s\n", cur->fts_name );
-#endif            
-                            record_stat ( cur->fts_statp, cur->fts_name );
-                        }
-                        
-                        print_file_info_list();
-                        
-                        printf ( "\n" );
-
-                        /* RE-initialize head of file_info linked list */
-                        file_info_list_head = NULL;
+                        if ( fts_enter_dir ( ftsp, p ) )
+                            list_fts_dir ( ftsp, p, curr_dir );
+                        break;
 
+                    /* back from under it, or from skipping it */
+                    case FTS_DP:
+                        if ( f_du_option && ! p->fts_number )
+                            du_end_fts_dir ( p );
                         break;
 
                     default:
@@ -1273,6 +7275,9 @@ int main ( int argc, char ** argv )
                 exit (1);
             }
 
+            if ( f_index_write_option )
+                index_write_finish ();
+
             exit (0);
         }
     }
@@ -1288,7 +7293,7 @@ int main ( int argc, char ** argv )
 	while (argc-- > 0)
 	{
 #ifdef DEBUG
-        printf ( "\n## processing argv : %s\n", *argv );
+        out_printf ( "\n## processing argv : %s\n", *argv );
 #endif
         
         /* enter original working directory */
@@ -1300,7 +7305,8 @@ int main ( int argc, char ** argv )
         }
 
         /* RE-initialize head of file_info linked list */
-        file_info_list_head = NULL;
+        reset_file_info_list ();
+        g_dir_path = ".";
 
         stat_ret = lstat ( *argv, &stat_buf );
 		if ( stat_ret < 0 )
@@ -1313,7 +7319,7 @@ int main ( int argc, char ** argv )
         /* argument is a file */
 		if ( S_ISREG ( stat_buf.st_mode ) )
 		{
-            record_stat ( &stat_buf, *argv );
+            record_stat ( &stat_buf, *argv, NULL );
             print_file_info_list();
 		}
         /* argument is a directory */
@@ -1333,21 +7339,28 @@ int main ( int argc, char ** argv )
                     continue;
                 }
 
-                record_stat ( &stat_buf, *argv );
+                record_stat ( &stat_buf, *argv, NULL );
                 print_file_info_list ();
                 argv++; 
                 continue;
             }
 
+            if ( f_du_option && ( ! f_R_option || f_S_option ) )
+                du_walk ( *argv );
+
             /* non-recursive */
             if ( ! f_R_option )
             {
+                if ( f_latency_option )
+                    lat_begin_dir ( *argv, *argv, &stat_buf );
+
                 /* read directory NAME, and list the files in it */	
-                if ( ( dp = opendir(*argv) ) == NULL )
+                if ( ( dp = timed_opendir ( *argv ) ) == NULL )
                 {
                     fprintf ( stderr, "can't open '%s'\n", *argv );
                     exit(1);
                 }
+                g_dir_path = *argv;
 
                 /* enter directory */
                 if ( chdir(*argv) == -1 )
@@ -1357,29 +7370,36 @@ int main ( int argc, char ** argv )
                     exit (1);
                 }
                 
-                while ( ( dirp = readdir(dp) ) != NULL )
+                if ( ! f_cache_option || ! cache_load ( dp ) )
                 {
-                    if ( lstat ( dirp->d_name, &stat_buf ) < 0 )
-                    {
-                        fprintf ( stderr, "stat() error" );
-                        exit (1);
-                    }
-                    
-                    record_stat ( &stat_buf, dirp->d_name );
+                    read_directory ( dp );
+
+                    if ( link_targets_wanted () )
+                        resolve_link_targets ( dirfd ( dp ), NULL );
+                    if ( f_cache_option && ! g_listing_filtered )
+                        cache_store ();
                 }
+                LS_PROBE2 ( dir_read, g_dir_path, g_list_count );
+                if ( f_du_option )
+                    du_list_dir ( dirfd ( dp ), NULL );
 
                 if ( closedir(dp) < 0 )
                 {
                     fprintf ( stderr, "can't close directory\n" );
                     exit(1);
                 }
+                if ( f_watch_option )
+                    watch_sort_list ();
                 print_file_info_list();
+
+                if ( f_watch_option )
+                    watch_directory ();
             }
             /* -R : recursive */
             else
             {
                 if ( ( ftsp =
-                     fts_open ( &*argv, FTS_LOGICAL, NULL ) ) == NULL )
+                     fts_open ( &*argv, g_fts_options, NULL ) ) == NULL )
                 {
                     // BUG, never executed!!!
                     fprintf ( stderr, "fts_open error %s", 
@@ -1394,26 +7414,14 @@ int main ( int argc, char ** argv )
                     {
                         /* directory */
                         case FTS_D:
+                            if ( fts_enter_dir ( ftsp, p ) )
+                                list_fts_dir ( ftsp, p, *argv );
+                            break;
 
-                            /* print directory path */                        
-                            printf ( "%s:\n", p->fts_path ); 
-
-                            // get files contained in a directory
-                            chp = fts_children ( ftsp, 0 );
-                            
-                            // loop directory's files
-                            for ( cur = chp; cur; cur = cur->fts_link )
-                            {
-                                record_stat ( cur->fts_statp, cur->fts_name );
-                            }
-                            
-                            print_file_info_list();
-                            
-                            printf ( "\n" );
-
-                            /* RE-initialize head of file_info linked list */
-                            file_info_list_head = NULL;
-                            
+                        /* back from under it, or from skipping it */
+                        case FTS_DP:
+                            if ( f_du_option && ! p->fts_number )
+                                du_end_fts_dir ( p );
                             break;
 
                         default:
@@ -1428,16 +7436,21 @@ int main ( int argc, char ** argv )
                     continue;
                 }
 
-                print_file_info_list();
+                if ( ! f_format_option )
+                    print_file_info_list();
 	        }	
         }
 
-        printf ( "\n" );
+        if ( ! f_format_option )
+            out_printf ( "\n" );
 		
         argv++;
 
 	} /* endof while ( argc-- > 0 ) */
 
+    if ( f_index_write_option )
+        index_write_finish ();
+
     /* return with success */
 	exit(0);
 
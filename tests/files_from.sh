@@ -0,0 +1,28 @@
+#!/bin/sh
+#
+# --files-from lists paths in more directories than there are
+# descriptors to open them with
+#
+
+LS=${LS:-$PWD/ls}
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+
+cd "$T" || exit 1
+i=0
+while [ $i -lt 600 ]
+do
+    mkdir d$i && touch d$i/f && echo d$i/f
+    i=$((i + 1))
+done > list
+
+got=$( ulimit -n 64 && "$LS" --files-from=list 2>&1 )
+status=$?
+if [ $status != 0 ] || [ "$got" != "$(cat list)" ]
+then
+    echo "files_from: exit $status with ulimit -n 64, listed"
+    echo "$got" | grep -v '^d[0-9]*/f$' | head -5
+    exit 1
+fi
+
+echo "files_from: ok"
@@ -0,0 +1,126 @@
+/*
+ * humanize.c
+ * fmt_humanize() against libbsd's humanize_number()
+ *
+ * Every flag combination, buffer length, suffix and scale, on the
+ * powers of 1000 and 1024 and the numbers around them, where the
+ * rounding goes one way or the other, and on random numbers.
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <libutil.h>    /* humanize_number() */
+
+#include "../fmt.h"
+
+/* numbers compared, besides the random ones */
+#define MAX_VALUES  16384
+
+int64_t values [MAX_VALUES];
+int value_count;
+
+void add_value( int64_t n )
+{
+    if ( value_count < MAX_VALUES )
+        values[value_count++] = n;
+}
+
+/* n and the numbers around it, on both sides of 0 */
+void add_around( int64_t n )
+{
+    int64_t d;
+
+    for ( d = -3; d <= 3; d++ )
+    {
+        add_value ( n + d );
+        add_value ( - ( n + d ) );
+    }
+}
+
+int check( int64_t n, const char * suffix, int scale, int flags,
+           size_t len )
+{
+    char want [64];
+    char got [64];
+    int want_ret, got_ret;
+
+    memset ( want, 'x', sizeof(want) );
+    memset ( got, 'x', sizeof(got) );
+    want_ret = humanize_number ( want, len, n, suffix, scale, flags );
+    got_ret = fmt_humanize ( got, len, n, suffix, scale, flags );
+
+    if ( want_ret != got_ret ||
+         ( len > 0 && strcmp ( want, got ) != 0 ) )
+    {
+        printf ( "humanize: %lld len %zu suffix \"%s\" scale %#x "
+                 "flags %#x: \"%s\" ( %d ) instead of \"%s\" ( %d )\n",
+                 (long long)n, len, suffix, scale, flags,
+                 got, got_ret, want, want_ret );
+        return 1;
+    }
+    return 0;
+}
+
+int main()
+{
+    static const char * const suffixes[] = { "", "B", "k", "iB" };
+    static const int scales[] =
+        { FMT_HN_AUTOSCALE, 0, 1, 2, 3, 6, 7, 8 };
+    int64_t p;
+    int flags, i, j, k;
+    size_t len;
+    int failed = 0;
+    long long compared = 0;
+
+    for ( i = 0; i < 2100; i++ )
+        add_value ( i );
+    for ( p = 1000; p <= INT64_MAX / 1024; p *= 1000 )
+    {
+        /* the x.y and the rounding boundaries of each scale */
+        add_around ( p );
+        add_around ( p * 95 / 100 );
+        add_around ( p * 995 / 1000 );
+        add_around ( p * 9 );
+        add_around ( p * 99 );
+        add_around ( p * 999 );
+    }
+    for ( p = 1024; p <= INT64_MAX / 1024; p *= 1024 )
+    {
+        add_around ( p );
+        add_around ( p / 1024 * 973 );
+        add_around ( p * 9 + p / 1024 * 973 );
+        add_around ( p * 9 + p / 2 );
+        add_around ( p * 99 + p / 2 );
+        add_around ( p * 999 + p / 2 );
+        add_around ( p * 1023 );
+    }
+    add_value ( INT64_MAX );
+    add_value ( 1101592 );              /* 1.0M, not 1.1M */
+    add_value ( 2569214 );              /* 2.4M, not 2.5M */
+
+    srandom ( 1 );
+    for ( i = 0; i < 4096; i++ )
+        add_value ( ( (int64_t)random () << 31 | random () ) >>
+                    ( random () % 60 ) );
+
+    for ( flags = 0; flags < 16; flags++ )
+        for ( i = 0; i < (int)( sizeof(suffixes) / sizeof(*suffixes) ); i++ )
+            for ( j = 0; j < (int)( sizeof(scales) / sizeof(*scales) ); j++ )
+                for ( len = 0; len <= 12; len++ )
+                    for ( k = 0; k < value_count; k++ )
+                    {
+                        failed += check ( values[k], suffixes[i], scales[j],
+                                          flags, len );
+                        compared++;
+                        if ( failed > 20 )
+                            return 1;
+                    }
+
+    if ( failed )
+        return 1;
+    printf ( "humanize: ok, %lld numbers\n", compared );
+    return 0;
+}
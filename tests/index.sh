@@ -0,0 +1,45 @@
+#!/bin/sh
+#
+# -R --index of "." lists every directory of the index, also those
+# whose names sort before "." : '-' and '+'
+#
+
+LS=${LS:-$PWD/ls}
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+
+mkdir -p "$T/tree/-dash" "$T/tree/+plus" "$T/tree/mid/sub"
+touch "$T/tree/-dash/x" "$T/tree/+plus/y" "$T/tree/mid/sub/z"
+cd "$T/tree" || exit 1
+
+"$LS" -R --index-write="$T/idx" > /dev/null || exit 1
+
+expected='.:
+./+plus:
+./-dash:
+./mid:
+./mid/sub:'
+
+for operand in "" "."
+do
+    got=$( "$LS" -R --index="$T/idx" $operand | grep ':$' )
+    if [ "$got" != "$expected" ]
+    then
+        echo "index: -R --index $operand lists"
+        echo "$got"
+        echo "instead of"
+        echo "$expected"
+        exit 1
+    fi
+done
+
+got=$( "$LS" -R --index="$T/idx" mid | grep ':$' )
+if [ "$got" != "mid:
+mid/sub:" ]
+then
+    echo "index: -R --index mid lists"
+    echo "$got"
+    exit 1
+fi
+
+echo "index: ok"
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+# --format=ndjson stays JSON with names which aren't UTF-8 : the bytes
+# which aren't are U+FFFD in "name", and "name_b64" has them all
+#
+
+LS=${LS:-$PWD/ls}
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+
+mkdir "$T/tree" "$T/tree/$(printf 'd\351')"
+cd "$T/tree" || exit 1
+touch "$(printf '\377\376ab')" "$(printf 'caf\303\251')" \
+      "$(printf 'over\300\257')" "$(printf 'q"\\\001')"
+ln -s "$(printf 'to\351')" link
+
+"$LS" -aR --format=ndjson > "$T/out" || exit 1
+
+fail=0
+for want in \
+    '"name":"\ufffd\ufffdab","name_b64":"//5hYg=="' \
+    "\"name\":\"$(printf 'caf\303\251')\"}" \
+    '"name":"over\ufffd\ufffd","name_b64":"b3ZlcsCv"' \
+    '"name":"q\"\\\u0001"}' \
+    '"target":"to\ufffd","target_b64":"dG/p"' \
+    '{"dir":"./d\ufffd","dir_b64":"Li9k6Q=="}'
+do
+    if ! grep -qF -e "$want" "$T/out"
+    then
+        echo "json: no $want in"
+        cat "$T/out"
+        fail=1
+    fi
+done
+
+# and every line is JSON, where there is something to check it with
+if command -v python3 > /dev/null &&
+   ! python3 -c 'import json, sys
+for line in open(sys.argv[1], "rb"):
+    json.loads(line.decode("utf-8"))' "$T/out"
+then
+    echo "json: not JSON"
+    fail=1
+fi
+
+[ $fail = 0 ] && echo "json: ok"
+exit $fail
@@ -0,0 +1,68 @@
+/*
+ * libls.c
+ * The ls -l lines of a directory through libls, for tests/libls.sh to
+ * hold against ls's own
+ *
+ *     tests/libls -AltF DIR
+ *
+ * takes the letters of ls for what libls has options for : a A r t S f
+ * c u F h, and n for numbers in place of owners.
+ *
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+
+#include "../libls.h"
+
+int main( int argc, char ** argv )
+{
+    struct ls_options options = { LS_OWNERS | LS_LINKS, LS_SORT_NAME };
+    struct ls_listing * lp;
+    const struct ls_entry * ep;
+    char line [LS_LINE_MAX];
+    const char * p;
+
+    if ( argc != 3 || argv[1][0] != '-' )
+    {
+        fprintf ( stderr, "usage: libls -[aArtSfcuFhn] dir\n" );
+        return 2;
+    }
+
+    for ( p = argv[1] + 1; *p != '\0'; p++ )
+    {
+        switch ( *p )
+        {
+            case 'a':   options.flags |= LS_ALL; break;
+            case 'A':   options.flags |= LS_ALMOST_ALL; break;
+            case 'r':   options.flags |= LS_REVERSE; break;
+            case 'F':   options.flags |= LS_TYPE; break;
+            case 'h':   options.flags |= LS_HUMAN; break;
+            case 'n':   options.flags &= ~LS_OWNERS; break;
+            case 't':   options.sort = LS_SORT_TIME; break;
+            case 'S':   options.sort = LS_SORT_SIZE; break;
+            case 'f':   options.sort = LS_SORT_NONE; break;
+            case 'c':   options.time = LS_TIME_CHANGE; break;
+            case 'u':   options.time = LS_TIME_ACCESS; break;
+            case 'l':   break;
+            default:
+                fprintf ( stderr, "libls: no option -%c\n", *p );
+                return 2;
+        }
+    }
+
+    lp = ls_open ( argv[2], &options );
+    if ( lp == NULL )
+    {
+        fprintf ( stderr, "libls: %s: %s\n", argv[2], strerror ( errno ) );
+        return 1;
+    }
+    while ( ( ep = ls_next ( lp ) ) != NULL )
+    {
+        ls_format ( lp, ep, line, sizeof(line) );
+        printf ( "%s\n", line );
+    }
+    ls_close ( lp );
+    return 0;
+}
@@ -0,0 +1,92 @@
+#!/bin/sh
+#
+# libls formats like ls : the lines of tests/libls are those of ls -l,
+# without its total, for each of the options libls has, sorted by the
+# whole name and then by time or size
+#
+
+LS=${LS:-$PWD/ls}
+LIBLS=${LIBLS:-$PWD/tests/libls}
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+
+# names which share a first character, times and sizes which are the
+# same, so that the order of the ties shows
+mkdir "$T/tree" || exit 1
+cd "$T/tree" || exit 1
+for name in a3 a1 a2 b +plus -dash .dot zz
+do
+    echo "$name" > "$name"
+done
+head -c 5000 /dev/zero > big
+head -c 3 /dev/zero > a2
+mkdir d .hid
+touch d/x
+printf '#!/bin/sh\n' > x
+chmod 755 x
+chmod 4755 a3
+ln -s a1 link
+ln -s nowhere broken
+ln b hard
+mkfifo fifo
+touch -m -d '2001-02-03 04:05' a1 a3 b d
+touch -m -d '2010-06-07 08:09' big x
+touch -a -d '2005-01-01 12:00' a1 zz
+
+# -a is left out : ls run by root takes it as -A
+fail=0
+for options in A Ar At Atr AS ASr Atc Ac Au Af AF An Ah AtF ASh
+do
+    # -n is ls -l with numbers, -ln would be -l
+    case $options in
+        *n*)    ls_options=-$options ;;
+        *)      ls_options=-l$options ;;
+    esac
+
+    # ls sorts names by their first byte only : the lines, in any order
+    "$LS" $ls_options "$T/tree" | grep -v '^total \|^$' | sort > "$T/ls" ||
+        exit 1
+    "$LIBLS" -$options "$T/tree" | sort > "$T/libls" || exit 1
+    if ! cmp -s "$T/ls" "$T/libls"
+    then
+        echo "libls: -$options differs from ls $ls_options"
+        diff "$T/ls" "$T/libls"
+        fail=1
+    fi
+done
+
+# the order : by name, or by time or size and then name, -r the other
+# way round; the -l name is the ninth field
+for options in A Ar At Atr AS ASr Atc Atu Au
+do
+    case $options in
+        *tc*)   key='-k1,1nr -k3' format='%.9Z %s %n' ;;
+        *tu*)   key='-k1,1nr -k3' format='%.9X %s %n' ;;
+        *t*)    key='-k1,1nr -k3' format='%.9Y %s %n' ;;
+        *S*)    key='-k2,2nr -k3' format='%.9Y %s %n' ;;
+        *)      key='-k3' format='%.9Y %s %n' ;;
+    esac
+    case $options in
+        *r*)    reverse=1 ;;
+        *)      reverse= ;;
+    esac
+
+    ( cd "$T/tree" && stat -c "$format" -- * .[!.]* ) |
+        LC_ALL=C sort $key | cut -d' ' -f3 > "$T/expected"
+    if [ -n "$reverse" ]
+    then
+        tac "$T/expected" > "$T/x" && mv "$T/x" "$T/expected"
+    fi
+    # a link's name runs into its "->"
+    LC_ALL=C "$LIBLS" -$options "$T/tree" |
+        awk '{ sub ( /->$/, "", $9 ); print $9 }' > "$T/libls" || exit 1
+    if ! cmp -s "$T/expected" "$T/libls"
+    then
+        echo "libls: -$options is not in the order of its keys"
+        diff "$T/expected" "$T/libls"
+        fail=1
+    fi
+done
+
+[ $fail = 0 ] && echo "libls: ok"
+exit $fail
@@ -0,0 +1,48 @@
+#!/bin/sh
+#
+# --max-depth and --prune keep -R out of every directory they leave out,
+# the first one fts_children() returns too, as --count -R does
+#
+
+LS=${LS:-$PWD/ls}
+T=$(mktemp -d) || exit 1
+trap 'rm -rf "$T"' EXIT
+
+mkdir -p "$T/p/a/deep" "$T/p/b/deep" "$T/p/c/deep" "$T/x/y/z"
+touch "$T/p/a/deep/f" "$T/p/b/f" "$T/x/y/z/f"
+cd "$T" || exit 1
+
+fail=0
+check()
+{
+    options=$1
+    operand=$2
+    expected=$3
+
+    got=$( "$LS" -R $options $operand | grep ':$' | sort | tr '\n' ' ' )
+    if [ "$got" != "$expected" ]
+    then
+        echo "prune: -R $options $operand lists $got"
+        echo "instead of $expected"
+        fail=1
+    fi
+
+    # a directory listed and the entries in it, those of --count -R
+    listed=$( "$LS" -R $options $operand | grep -vc ':$\|^$' )
+    counted=$( "$LS" -R --count $options $operand | cut -d' ' -f1 )
+    if [ "$listed" != "$counted" ]
+    then
+        echo "prune: -R $options $operand lists $listed entries," \
+             "--count says $counted"
+        fail=1
+    fi
+}
+
+check --max-depth=0 p "p: "
+check --max-depth=1 p "p/a: p/b: p/c: p: "
+check --prune=deep p "p/a: p/b: p/c: p: "
+check --prune=b p "p/a/deep: p/a: p/c/deep: p/c: p: "
+check --max-depth=1 x "x/y: x: "
+
+[ $fail = 0 ] && echo "prune: ok"
+exit $fail